@@ -1,9 +1,481 @@
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <set>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <typeinfo>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <malloc.h>
+#include <cxxabi.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <boost/flyweight.hpp>
+#include <boost/flyweight/no_locking.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/identity.hpp>
+
+// -- Per-thread slots --
+// State S of every thread working under a tracker tag R, each on cache
+// lines of its own, in a list that readers walk without locks. A thread
+// claims a slot on first use and leaves it as is at exit, for the next
+// thread to take over.
+template<typename S, typename R>
+class ThreadSlots {
+public:
+    struct Slot : S {
+        volatile int used;      // Owned by a live thread
+        Slot* next;
+    } __attribute__((aligned(64)));
+
+    static Slot& mine() { return mine_ ? *mine_ : *claim(); }
+    static Slot* first() { return head(); }
+
+private:
+    static Slot* volatile& head() { static Slot* volatile slots(NULL); return slots; }
+
+    static Slot* claim() {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        pthread_once(&once, make_key);
+
+        Slot* s = __atomic_load_n(&head(), __ATOMIC_ACQUIRE);
+        while (s && !(0 == __atomic_load_n(&s->used, __ATOMIC_RELAXED) &&
+                      __sync_bool_compare_and_swap(&s->used, 0, 1))) {
+            s = s->next;
+        }
+
+        if (!s) {
+            void* mem = NULL;
+            if (posix_memalign(&mem, 64, sizeof(Slot))) {
+                throw std::bad_alloc();
+            }
+            s = new(mem) Slot();
+            s->used = 1;
+            do {
+                s->next = __atomic_load_n(&head(), __ATOMIC_RELAXED);
+            } while (!__sync_bool_compare_and_swap(&head(), s->next, s));
+        }
+
+        pthread_setspecific(key(), s);
+        mine_ = s;
+        return s;
+    }
+
+    // Publishes the slot's state before the next owner's claim sees it free
+    static void release(void* arg) {
+        mine_ = NULL;
+        __sync_lock_release(&((Slot*)arg)->used);
+    }
+
+    static pthread_key_t& key() { static pthread_key_t k; return k; }
+    static void make_key() { pthread_key_create(&key(), release); }
+
+    static __thread Slot* mine_;
+};
+
+template<typename S, typename R>
+__thread typename ThreadSlots<S, R>::Slot* ThreadSlots<S, R>::mine_ = NULL;
+
+static double
+now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// -- Tracker registry --
+// The statistics of every tracker tag in use: bytes now and at the peak,
+// allocations and frees, and allocations by size, in power of 2 classes
+// up to 2^(MEMTRACK_CLASSES - 1) bytes and a last one for anything larger.
+// dump() lists all tags with their allocation rate since the last dump.
+static const size_t MEMTRACK_CLASSES = 32;
+
+struct MemTrackerStats {
+    long bytes;
+    long peak;                  // Less than peak_slack under the true peak
+    long peak_slack;            // MEMTRACK_FLUSH per counting thread
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long sizes[MEMTRACK_CLASSES];
+};
+
+class MemTrackerRegistry {
+public:
+    typedef void (*Read_t)(MemTrackerStats&);
+
+    // By the counter of each tag, once
+    static void add(const char* mangled, Read_t read) {
+        int status = 0;
+        char* name = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+        Tag t = { name ? name : mangled, read, 0, now() };
+        free(name);
+
+        pthread_mutex_lock(&lock());
+        tags().push_back(t);
+        pthread_mutex_unlock(&lock());
+    }
+
+    static void dump(std::ostream& os, bool json = false) {
+        pthread_mutex_lock(&lock());
+        double when = now();
+        if (json) {
+            os << "{\"tags\": [";
+        } else {
+            os << std::left << std::setw(40) << "tag" << std::right
+               << std::setw(14) << "bytes" << std::setw(14) << "peak"
+               << std::setw(12) << "allocs" << std::setw(12) << "frees"
+               << std::setw(12) << "allocs/s" << "\n";
+        }
+
+        for (size_t cc = 0; cc < tags().size(); ++cc) {
+            Tag& t = tags()[cc];
+            MemTrackerStats s;
+            t.read(s);
+            double rate = (s.allocs - t.allocs) / std::max(when - t.when, 1e-6);
+            t.allocs = s.allocs;
+            t.when = when;
+
+            if (json) {
+                os << (cc ? ", " : "") << "{\"name\": \"" << escape(t.name)
+                   << "\", \"bytes\": " << s.bytes << ", \"peak\": " << s.peak
+                   << ", \"peak_slack\": " << s.peak_slack
+                   << ", \"allocs\": " << s.allocs << ", \"frees\": " << s.frees
+                   << ", \"allocs_per_sec\": " << (unsigned long)rate
+                   << ", \"sizes\": {";
+            } else {
+                os << std::left << std::setw(40) << t.name << std::right
+                   << std::setw(14) << s.bytes << std::setw(14) << s.peak
+                   << std::setw(12) << s.allocs << std::setw(12) << s.frees
+                   << std::setw(12) << (unsigned long)rate << "\n   ";
+            }
+
+            // Classes by their upper bound, the last one as "more"
+            const char* sep = "";
+            for (size_t k = 0; k < MEMTRACK_CLASSES; ++k) {
+                if (!s.sizes[k]) {
+                    continue;
+                }
+                std::ostringstream bound;
+                if (k + 1 < MEMTRACK_CLASSES) {
+                    bound << (1UL << k);
+                } else {
+                    bound << "more";
+                }
+                if (json) {
+                    os << sep << "\"" << bound.str() << "\": " << s.sizes[k];
+                    sep = ", ";
+                } else {
+                    os << " <=" << bound.str() << ":" << s.sizes[k];
+                }
+            }
+            os << (json ? "}}" : "\n");
+        }
+
+        os << (json ? "]}\n" : "");
+        pthread_mutex_unlock(&lock());
+    }
+
+private:
+    struct Tag {
+        std::string name;
+        Read_t read;
+        unsigned long allocs;   // At the last dump
+        double when;
+    };
+
+    static std::vector<Tag>& tags() { static std::vector<Tag> t; return t; }
+    static pthread_mutex_t& lock() { static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER; return m; }
+
+    static std::string escape(const std::string& s) {
+        std::string r;
+        for (size_t cc = 0; cc < s.size(); ++cc) {
+            if ('"' == s[cc] || '\\' == s[cc]) {
+                r += '\\';
+            }
+            r += s[cc];
+        }
+        return r;
+    }
+};
+
+// -- Per-thread memory counters --
+// Bytes in use under a tracker tag R, and its statistics. Every thread
+// counts on cache lines of its own and moves its bytes to the shared total
+// only once they are MEMTRACK_FLUSH off, so allocating threads do not
+// fight over one line. The peak is raised to the total plus what every
+// thread holds at those moves and on reads, so a peak between them can be
+// missed by less than MEMTRACK_FLUSH per thread. Counters of threads that
+// exit are taken over by new threads.
+static const long MEMTRACK_FLUSH = 64 * 1024;
+
+template<typename R>
+class MemTrackerCounter {
+public:
+    // Allocations add bytes, frees take them away
+    static void add(long bytes) {
+        count(bytes);
+        hold(bytes);
+    }
+
+    // An allocation, or a free when negative, without its bytes
+    static void count(long bytes) {
+        (void)&registrar_;
+        Counts& s = Slots_t::mine();
+        if (bytes > 0) {
+            ++s.allocs;
+            ++s.sizes[size_class(bytes)];
+        } else if (bytes < 0) {
+            ++s.frees;
+        }
+    }
+
+    // Bytes in use, without counting an allocation or free
+    static void hold(long bytes) {
+        (void)&registrar_;
+        Counts& s = Slots_t::mine();
+        long v = s.bytes + bytes;
+        if (v > MEMTRACK_FLUSH || v < -MEMTRACK_FLUSH) {
+            __atomic_store_n(&s.bytes, 0, __ATOMIC_RELAXED);
+            (void)__sync_add_and_fetch(&total(), v);
+            if (v > 0) {
+                (void)exact();
+            }
+            return;
+        }
+        __atomic_store_n(&s.bytes, v, __ATOMIC_RELAXED);
+    }
+
+    // The shared total plus what every thread holds, exact when the
+    // allocating threads are quiet
+    static long exact() {
+        long sum = total();
+        for (typename Slots_t::Slot* s = Slots_t::first(); s; s = s->next) {
+            sum += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+        }
+        raise_peak(sum);
+        return sum;
+    }
+
+    // The shared total alone, off by less than MEMTRACK_FLUSH per thread
+    static long approx() { return total(); }
+
+    static void read(MemTrackerStats& stats) {
+        stats.bytes = exact();
+        stats.peak = peak();
+        stats.peak_slack = 0;
+        stats.allocs = stats.frees = 0;
+        std::fill(stats.sizes, stats.sizes + MEMTRACK_CLASSES, 0UL);
+        for (typename Slots_t::Slot* s = Slots_t::first(); s; s = s->next) {
+            stats.peak_slack += MEMTRACK_FLUSH;
+            stats.allocs += s->allocs;
+            stats.frees += s->frees;
+            for (size_t k = 0; k < MEMTRACK_CLASSES; ++k) {
+                stats.sizes[k] += s->sizes[k];
+            }
+        }
+    }
+
+private:
+    struct Counts {
+        volatile long bytes;
+        volatile unsigned long allocs;
+        volatile unsigned long frees;
+        volatile unsigned long sizes[MEMTRACK_CLASSES];
+    };
+    typedef ThreadSlots<Counts, R> Slots_t;
+
+    static volatile long& total() { static volatile long bytes(0); return bytes; }
+    static volatile long& peak() { static volatile long bytes(0); return bytes; }
+
+    static void raise_peak(long bytes) {
+        long p = peak();
+        while (bytes > p && !__sync_bool_compare_and_swap(&peak(), p, bytes)) {
+            p = peak();
+        }
+    }
+
+    // Of n bytes, with 2^(k-1) < n <= 2^k
+    static size_t size_class(unsigned long n) {
+        size_t k = (n > 1) ? sizeof(n) * 8 - __builtin_clzl(n - 1) : 0;
+        return std::min(k, MEMTRACK_CLASSES - 1);
+    }
+
+    // Puts the tag in the registry before main, whether or not it is dumped
+    struct Registrar {
+        Registrar() { MemTrackerRegistry::add(typeid(R).name(), read); }
+    };
+    static Registrar registrar_;
+};
+
+template<typename R>
+typename MemTrackerCounter<R>::Registrar MemTrackerCounter<R>::registrar_;
+
+// -- Backing stores --
+// Where MemTrackerAllocator<T, R> takes its memory from, picked by the
+// tag: the heap, unless R is a MemTrackerArena<>
+template<typename R>
+struct MemTrackerStore {
+    static void* allocate(size_t bytes, size_t) {
+        void* p = ::operator new(bytes);
+        MemTrackerCounter<R>::add(bytes);
+        return p;
+    }
+
+    static void deallocate(void* p, size_t bytes, size_t) {
+        MemTrackerCounter<R>::add(-(long)bytes);
+        ::operator delete(p);
+    }
+};
+
+// Tag wrapper: MemTrackerAllocator<T, MemTrackerArena<R> > carves blocks
+// out of ARENA_CHUNK byte chunks instead of asking the heap for each one.
+// A thread bumps through a chunk of its own and keeps the blocks it frees
+// on lists by size for its next allocations, all without locks; past
+// 2 * ARENA_BATCH blocks on a list, it hands a batch to a shared depot
+// where threads that run out look first. Chunks stay with the arena until
+// the process exits, and the bytes tracked are theirs, slack included; the
+// allocations, frees and sizes are those of the blocks. Made for many small
+// blocks living long, like interned strings; larger or more aligned blocks
+// still go to the heap.
+template<typename R>
+struct MemTrackerArena {};
+
+static const size_t ARENA_CHUNK = 1024 * 1024;
+static const size_t ARENA_GRAIN = 8;
+static const size_t ARENA_MAX_BLOCK = 256;
+static const size_t ARENA_BATCH = 64;
+
+template<typename R>
+class MemTrackerStore<MemTrackerArena<R> > {
+public:
+    typedef MemTrackerArena<R> Tag_t;
+
+    static void* allocate(size_t bytes, size_t align) {
+        if (!in_arena(bytes, align)) {
+            void* p = ::operator new(bytes);
+            MemTrackerCounter<Tag_t>::add(bytes);
+            return p;
+        }
+
+        Arena& a = Slots_t::mine();
+        size_t cls = (bytes - 1) / ARENA_GRAIN;
+        if (!a.free[cls] && (a.free[cls] = depot(cls).take())) {
+            a.count[cls] = ARENA_BATCH;
+        }
+
+        MemTrackerCounter<Tag_t>::count(bytes);
+        Block* b = a.free[cls];
+        if (b) {
+            a.free[cls] = b->next;
+            --a.count[cls];
+            return b;
+        }
+
+        // What is left of the last chunk, less than a block, is lost
+        size_t size = (cls + 1) * ARENA_GRAIN;
+        if ((size_t)(a.end - a.pos) < size) {
+            a.pos = (char*)::operator new(ARENA_CHUNK);
+            a.end = a.pos + ARENA_CHUNK;
+            MemTrackerCounter<Tag_t>::hold(ARENA_CHUNK);
+        }
+
+        void* p = a.pos;
+        a.pos += size;
+        return p;
+    }
+
+    // Into the lists of the freeing thread, whichever thread allocated it
+    static void deallocate(void* p, size_t bytes, size_t align) {
+        if (!in_arena(bytes, align)) {
+            MemTrackerCounter<Tag_t>::add(-(long)bytes);
+            ::operator delete(p);
+            return;
+        }
+
+        MemTrackerCounter<Tag_t>::count(-(long)bytes);
+        Arena& a = Slots_t::mine();
+        size_t cls = (bytes - 1) / ARENA_GRAIN;
+        Block* b = (Block*)p;
+        b->next = a.free[cls];
+        a.free[cls] = b;
+
+        // The newest blocks stay, the batch after them goes
+        if (++a.count[cls] >= 2 * ARENA_BATCH) {
+            for (size_t cc = 1; cc < ARENA_BATCH; ++cc) {
+                b = b->next;
+            }
+            depot(cls).give(b->next);
+            b->next = NULL;
+            a.count[cls] = ARENA_BATCH;
+        }
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    struct Arena {
+        char* pos;
+        char* end;
+        Block* free[ARENA_MAX_BLOCK / ARENA_GRAIN];
+        size_t count[ARENA_MAX_BLOCK / ARENA_GRAIN];
+    };
+    typedef ThreadSlots<Arena, Tag_t> Slots_t;
+
+    // Batches of ARENA_BATCH blocks of one size, each a chain of blocks.
+    // Threads that run out of blocks ask on every allocation until they
+    // get a batch, so an empty depot answers without its lock.
+    class Depot {
+    public:
+        Depot() : count_(0) { pthread_mutex_init(&lock_, NULL); }
+
+        void give(Block* batch) {
+            pthread_mutex_lock(&lock_);
+            batches_.push_back(batch);
+            __atomic_store_n(&count_, batches_.size(), __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&lock_);
+        }
+
+        Block* take() {
+            if (!__atomic_load_n(&count_, __ATOMIC_RELAXED)) {
+                return NULL;
+            }
+
+            Block* batch = NULL;
+            pthread_mutex_lock(&lock_);
+            if (!batches_.empty()) {
+                batch = batches_.back();
+                batches_.pop_back();
+                __atomic_store_n(&count_, batches_.size(), __ATOMIC_RELAXED);
+            }
+            pthread_mutex_unlock(&lock_);
+            return batch;
+        }
+
+    private:
+        pthread_mutex_t lock_;
+        size_t count_;          // Batches, read without the lock
+        std::vector<Block*> batches_;
+    };
+
+    static Depot& depot(size_t cls) {
+        static Depot depots[ARENA_MAX_BLOCK / ARENA_GRAIN];
+        return depots[cls];
+    }
+
+    static bool in_arena(size_t bytes, size_t align) {
+        return bytes > 0 && bytes <= ARENA_MAX_BLOCK && align <= ARENA_GRAIN;
+    }
+};
 
 // -- Boost flyweight with memory usage tracking --
 template<typename T, typename R>
@@ -23,23 +495,20 @@ public:
     };
 
 public:
+    MemTrackerAllocator() {}
+    template<typename U>
+    MemTrackerAllocator(const MemTrackerAllocator<U, R>&) {}
+
     inline pointer address(reference r) { return &r; }
     inline const_pointer address(const_reference r) { return &r; }
 
     inline pointer allocate(size_type cnt, typename std::allocator<void>::const_pointer = 0) {
-        pointer p = reinterpret_cast<pointer>(::operator new(cnt * sizeof (T)));
-        if (p) {
-            volatile size_t &bytes = mem_used();
-	        (void)__sync_fetch_and_add(&bytes, cnt);
-        }
-
-        return p;
+        return reinterpret_cast<pointer>(
+            MemTrackerStore<R>::allocate(cnt * sizeof (T), __alignof__(T)));
     }
 
     inline void deallocate(pointer p, size_type cnt) {
-        ::operator delete(p);
-        volatile size_t &bytes = mem_used();
-        (void)__sync_fetch_and_sub(&bytes, cnt);
+        MemTrackerStore<R>::deallocate(p, cnt * sizeof (T), __alignof__(T));
     }
 
     inline size_type max_size() const {
@@ -52,59 +521,669 @@ public:
     inline bool operator==(MemTrackerAllocator const&) const { return true; }
     inline bool operator!=(MemTrackerAllocator const& a) const { return !operator==(a); }
 
-    static volatile size_t& mem_used() { static volatile size_t bytes(0); return bytes; }
+    // Bytes in use under R, whatever T it was rebound to, or the chunks of
+    // an arena. mem_used() sums the counters of all threads,
+    // mem_used_approx() only reads the total.
+    static size_t mem_used() { return MemTrackerCounter<R>::exact(); }
+    static size_t mem_used_approx() { return MemTrackerCounter<R>::approx(); }
+
+    // Peak, counts and sizes of allocations under R; of the blocks for an
+    // arena, whose peak is that of its chunks
+    static MemTrackerStats stats() {
+        MemTrackerStats s;
+        MemTrackerCounter<R>::read(s);
+        return s;
+    }
+};
+
+// -- Sharded intern factory --
+// Replaces the default hashed_factory, one table behind one mutex, with
+// N tables each behind its own mutex, picked by the hash of the value, so
+// threads interning different hosts rarely wait on each other. Flyweights
+// using it run with no_locking and sharded_refcounted: the shard lock
+// covers the lookup, the first reference and the erase check.
+template<typename Value, typename Key>
+class ShardedRefValue {
+public:
+    explicit ShardedRefValue(const Value& x) : x_(x), ref_(0), del_ref_(0) {}
+    ShardedRefValue(const ShardedRefValue& r) : x_(r.x_), ref_(0), del_ref_(0) {}
+
+    operator const Value&() const { return x_; }
+    operator const Key&() const { return x_; }
+
+    // Under the shard lock, by the factory handing out the entry. As in
+    // refcounted, the deleter count goes up on every 0 to 1 transition so
+    // a thread that saw the count drop to 0 erases only if nobody came back.
+    void attach() const {
+        if (1 == __sync_add_and_fetch(&ref_, 1)) {
+            ++del_ref_;
+        }
+    }
+    bool release_deleter() const { return 0 == --del_ref_; }
+
+    // Lock free, by the copies and destructors of handles
+    void add_ref() const { (void)__sync_add_and_fetch(&ref_, 1); }
+    bool release() const { return 0 == __sync_sub_and_fetch(&ref_, 1); }
+
+private:
+    Value x_;
+    mutable volatile long ref_;
+    mutable long del_ref_;
+};
+
+template<typename Handle, typename TrackingHelper>
+class ShardedRefHandle {
+public:
+    // The factory already attached the entry
+    explicit ShardedRefHandle(const Handle& h) : h_(h) {}
+    ShardedRefHandle(const ShardedRefHandle& x) : h_(x.h_) {
+        TrackingHelper::entry(*this).add_ref();
+    }
+    ShardedRefHandle& operator=(ShardedRefHandle x) {
+        std::swap(h_, x.h_);
+        return *this;
+    }
+    ~ShardedRefHandle() {
+        if (TrackingHelper::entry(*this).release()) {
+            TrackingHelper::erase(*this, check_erase);
+        }
+    }
+
+    operator const Handle&() const { return h_; }
+
+private:
+    // The factory checks the deleter count under the shard lock
+    static bool check_erase(const ShardedRefHandle&) { return true; }
+
+    Handle h_;
+};
+
+struct sharded_refcounted : boost::flyweights::tracking_marker {
+    struct entry_type {
+        template<typename Value, typename Key>
+        struct apply {
+            typedef ShardedRefValue<Value, Key> type;
+        };
+    };
+
+    struct handle_type {
+        template<typename Handle, typename TrackingHelper>
+        struct apply {
+            typedef ShardedRefHandle<Handle, TrackingHelper> type;
+        };
+    };
+};
+
+// Nodes of the shard tables are tracked under their own tag R
+typedef struct {} stub_HostFactory_t;
+
+template<typename Entry, typename Key, size_t N, typename R>
+class ShardedFactoryClass : public boost::flyweights::factory_marker {
+public:
+    typedef const Entry* handle_type;
+
+    ShardedFactoryClass() {
+        for (size_t cc = 0; cc < N; ++cc) {
+            pthread_mutex_init(&shards_[cc].lock, NULL);
+        }
+    }
+
+    ~ShardedFactoryClass() {
+        for (size_t cc = 0; cc < N; ++cc) {
+            pthread_mutex_destroy(&shards_[cc].lock);
+        }
+    }
+
+    handle_type insert(const Entry& x) {
+        Shard& shard = shard_of(x);
+        pthread_mutex_lock(&shard.lock);
+        handle_type h = &*shard.entries.insert(x).first;
+        h->attach();
+        pthread_mutex_unlock(&shard.lock);
+
+        return h;
+    }
+
+    void erase(handle_type h) {
+        Shard& shard = shard_of(*h);
+        pthread_mutex_lock(&shard.lock);
+        if (h->release_deleter()) {
+            shard.entries.erase(shard.entries.iterator_to(*h));
+        }
+        pthread_mutex_unlock(&shard.lock);
+    }
+
+    static const Entry& entry(handle_type h) { return *h; }
+
+private:
+    typedef boost::multi_index::multi_index_container<
+        Entry,
+        boost::multi_index::indexed_by<
+            boost::multi_index::hashed_unique<
+                boost::multi_index::identity<Entry>,
+                boost::hash<Key>,
+                std::equal_to<Key> > >,
+        MemTrackerAllocator<Entry, R> > Table_t;
+
+    // One per cache line, so that the locks of shards do not share one
+    struct Shard {
+        pthread_mutex_t lock;
+        Table_t entries;
+    } __attribute__((aligned(64)));
+
+    Shard& shard_of(const Key& k) {
+        // The tables use the low bits of the same hash, pick with the high
+        size_t h = boost::hash<Key>()(k);
+        return shards_[(h ^ (h >> (sizeof(h) * 4))) % N];
+    }
+
+    Shard shards_[N];
 };
 
+template<size_t N, typename R = stub_HostFactory_t>
+struct sharded_factory : boost::flyweights::factory_marker {
+    template<typename Entry, typename Key>
+    struct apply {
+        typedef ShardedFactoryClass<Entry, Key, N, R> type;
+    };
+};
+
+// Shards of the host factory, a few per core of the largest machines
+static const size_t HOST_SHARDS = 64;
+
+// Interned strings and the factory nodes holding them packed in arenas
 typedef struct {} stub_HostString_t;
-typedef MemTrackerAllocator<char, stub_HostString_t> HostAllocator;
+typedef MemTrackerArena<stub_HostString_t> HostArena_t;
+typedef MemTrackerArena<stub_HostFactory_t> HostFactoryArena_t;
+typedef MemTrackerAllocator<char, HostArena_t> HostAllocator;
 typedef std::basic_string<char, std::char_traits<char>, HostAllocator> HostString_t;
 
-typedef boost::flyweights::flyweight<HostString_t> HostName_t;
+typedef boost::flyweights::flyweight<HostString_t,
+                                     sharded_factory<HOST_SHARDS, HostFactoryArena_t>,
+                                     sharded_refcounted,
+                                     boost::flyweights::no_locking> HostName_t;
 typedef std::set<HostName_t> Host_t;
 
+// Both on the heap, as the baseline of the arenas
+typedef struct {} stub_HeapHostString_t;
+typedef MemTrackerAllocator<char, stub_HeapHostString_t> HeapHostAllocator;
+typedef std::basic_string<char, std::char_traits<char>, HeapHostAllocator> HeapHostString_t;
+
+typedef boost::flyweights::flyweight<HeapHostString_t,
+                                     sharded_factory<HOST_SHARDS>,
+                                     sharded_refcounted,
+                                     boost::flyweights::no_locking> HeapHostName_t;
+
+// The default, single mutex factory, as the baseline of the benchmark
+typedef boost::flyweights::flyweight<HostString_t> GlobalHostName_t;
+
+// -- Host IDs --
+// Interning down to a dense 32-bit ID, numbered from 1 in order of first
+// sight, so that sets of hosts are flat arrays of integers; 0 is no host.
+// Strings stay in an arena for good and IDs are never reused. An ID goes
+// back to its string without locks, through a directory of pages that
+// never move; the index from strings to IDs is split into HOST_SHARDS open
+// addressed tables behind a lock each, picked as in the sharded factory.
+typedef struct {} stub_HostIds_t;
+typedef MemTrackerArena<stub_HostIds_t> HostIdArena_t;
+
+static const size_t HOSTID_PAGE_BITS = 16;
+static const size_t HOSTID_PAGE = 1 << HOSTID_PAGE_BITS;
+static const size_t HOSTID_PAGES = (size_t)1 << (32 - HOSTID_PAGE_BITS);
+
+class HostIdTable {
+public:
+    static uint32_t intern(const char* s, size_t len) {
+        size_t h = boost::hash_range(s, s + len);
+        Shard& shard = shards()[(h ^ (h >> (sizeof(h) * 4))) % HOST_SHARDS];
+
+        ShardLock locked(shard);
+        if (2 * (shard.used + 1) > shard.slots.size()) {
+            grow(shard);
+        }
+
+        size_t mask = shard.slots.size() - 1;
+        size_t cc = h & mask;
+        for (; shard.slots[cc].id; cc = (cc + 1) & mask) {
+            const Slot& slot = shard.slots[cc];
+            if (slot.hash == (uint32_t)h) {
+                const char* t = str(slot.id);
+                if (0 == strncmp(t, s, len) && '\0' == t[len]) {
+                    break;
+                }
+            }
+        }
+
+        Slot& slot = shard.slots[cc];
+        if (!slot.id) {
+            slot.hash = (uint32_t)h;
+            slot.id = add(s, len);
+            ++shard.used;
+        }
+
+        return slot.id;
+    }
+
+    // Of an ID handed out by intern(), or "" for no host
+    static const char* str(uint32_t id) {
+        return id ? dir()[id >> HOSTID_PAGE_BITS][id & (HOSTID_PAGE - 1)] : "";
+    }
+
+    // Hosts interned
+    static uint32_t size() { return next() - 1; }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;            // 0 when free
+    };
+    typedef std::vector<Slot, MemTrackerAllocator<Slot, stub_HostIds_t> > Slots_t;
+
+    struct Shard {
+        Shard() : used(0) { pthread_mutex_init(&lock, NULL); }
+
+        pthread_mutex_t lock;
+        Slots_t slots;
+        size_t used;
+    } __attribute__((aligned(64)));
+
+    // Held until the end of the scope, whatever throws
+    struct ShardLock {
+        explicit ShardLock(Shard& shard) : shard_(shard) { pthread_mutex_lock(&shard_.lock); }
+        ~ShardLock() { pthread_mutex_unlock(&shard_.lock); }
+
+        Shard& shard_;
+    };
+
+    static Shard* shards() { static Shard s[HOST_SHARDS]; return s; }
+    static volatile uint32_t& next() { static volatile uint32_t id(1); return id; }
+    static const char** volatile* dir() { static const char** volatile pages[HOSTID_PAGES]; return pages; }
+
+    static void grow(Shard& shard) {
+        Slots_t slots(std::max<size_t>(64, 2 * shard.slots.size()));
+        size_t mask = slots.size() - 1;
+        for (size_t cc = 0; cc < shard.slots.size(); ++cc) {
+            const Slot& slot = shard.slots[cc];
+            if (slot.id) {
+                size_t dd = slot.hash & mask;
+                while (slots[dd].id) {
+                    dd = (dd + 1) & mask;
+                }
+                slots[dd] = slot;
+            }
+        }
+        shard.slots.swap(slots);
+    }
+
+    // A copy of the string under the next ID, with the page of the ID made
+    // by whichever shard gets there first. The counter wraps to 0 past the
+    // last ID and stays there.
+    static uint32_t add(const char* s, size_t len) {
+        uint32_t id;
+        do {
+            id = next();
+            if (0 == id) {
+                throw std::overflow_error("out of host IDs");
+            }
+        } while (!__sync_bool_compare_and_swap(&next(), id, id + 1));
+
+        const char** volatile& page = dir()[id >> HOSTID_PAGE_BITS];
+        if (!page) {
+            size_t bytes = HOSTID_PAGE * sizeof (const char*);
+            const char** mem = (const char**)
+                MemTrackerStore<stub_HostIds_t>::allocate(bytes, __alignof__(const char*));
+            memset(mem, 0, bytes);
+            if (!__sync_bool_compare_and_swap(&page, (const char**)NULL, mem)) {
+                MemTrackerStore<stub_HostIds_t>::deallocate(mem, bytes, __alignof__(const char*));
+            }
+        }
+
+        char* p = (char*)MemTrackerStore<HostIdArena_t>::allocate(len + 1, 1);
+        memcpy(p, s, len);
+        p[len] = '\0';
+        page[id & (HOSTID_PAGE - 1)] = p;
+
+        return id;
+    }
+};
+
+// A host as its ID, compared and ordered by ID, that is in order of
+// interning rather than by name. Unset, it is no host, before all others.
+class HostId {
+public:
+    HostId() : id_(0) {}
+    explicit HostId(const char* s) : id_(HostIdTable::intern(s, strlen(s))) {}
+    explicit HostId(const std::string& s) : id_(HostIdTable::intern(s.data(), s.size())) {}
+
+    static HostId from_id(uint32_t id) { HostId h; h.id_ = id; return h; }
+
+    uint32_t id() const { return id_; }
+    const char* c_str() const { return HostIdTable::str(id_); }
+    size_t size() const { return id_ ? strlen(c_str()) : 0; }
+
+    bool operator==(HostId h) const { return id_ == h.id_; }
+    bool operator!=(HostId h) const { return id_ != h.id_; }
+    bool operator<(HostId h) const { return id_ < h.id_; }
+
+private:
+    uint32_t id_;
+};
+
+// A set of hosts as a sorted array of their IDs: lookups are binary
+// searches, and unions, intersections and differences single merges
+typedef struct {} stub_HostIdSet_t;
+
+class HostIdSet {
+public:
+    typedef std::vector<HostId, MemTrackerAllocator<HostId, stub_HostIdSet_t> > Ids_t;
+    typedef Ids_t::const_iterator const_iterator;
+
+    HostIdSet() {}
+
+    // Of hosts in any order, repeats dropped; much faster than inserting
+    // them one by one
+    template<typename It>
+    HostIdSet(It first, It last) : ids_(first, last) {
+        std::sort(ids_.begin(), ids_.end());
+        ids_.erase(std::unique(ids_.begin(), ids_.end()), ids_.end());
+    }
+
+    bool insert(HostId h) {
+        Ids_t::iterator it = std::lower_bound(ids_.begin(), ids_.end(), h);
+        if (it != ids_.end() && *it == h) {
+            return false;
+        }
+        ids_.insert(it, h);
+        return true;
+    }
+
+    bool erase(HostId h) {
+        Ids_t::iterator it = std::lower_bound(ids_.begin(), ids_.end(), h);
+        if (it == ids_.end() || *it != h) {
+            return false;
+        }
+        ids_.erase(it);
+        return true;
+    }
+
+    bool contains(HostId h) const {
+        return std::binary_search(ids_.begin(), ids_.end(), h);
+    }
+
+    size_t size() const { return ids_.size(); }
+    bool empty() const { return ids_.empty(); }
+    const_iterator begin() const { return ids_.begin(); }
+    const_iterator end() const { return ids_.end(); }
+
+    bool operator==(const HostIdSet& s) const { return ids_ == s.ids_; }
+
+    HostIdSet operator|(const HostIdSet& s) const {
+        HostIdSet r;
+        r.ids_.reserve(size() + s.size());
+        std::set_union(begin(), end(), s.begin(), s.end(), std::back_inserter(r.ids_));
+        return r;
+    }
+
+    HostIdSet operator&(const HostIdSet& s) const {
+        HostIdSet r;
+        r.ids_.reserve(std::min(size(), s.size()));
+        std::set_intersection(begin(), end(), s.begin(), s.end(), std::back_inserter(r.ids_));
+        return r;
+    }
+
+    HostIdSet operator-(const HostIdSet& s) const {
+        HostIdSet r;
+        r.ids_.reserve(size());
+        std::set_difference(begin(), end(), s.begin(), s.end(), std::back_inserter(r.ids_));
+        return r;
+    }
+
+private:
+    Ids_t ids_;
+};
+
 typedef std::vector<std::string> Hosts_t;
 
 Hosts_t hosts;
 
+// Intern all hosts into a set of the thread, then drop them. Threads
+// start at hosts far apart, as unrelated callers would, rather than all
+// asking for the same host, and so the same shard, at the same moment.
+template<typename Name_t>
 void *
 start_routine(void* arg) {
-    Host_t* h = (Host_t*)arg;
+    std::set<Name_t> h;
 
-    for (Hosts_t::iterator it = hosts.begin(); it != hosts.end(); ++it) {
-        h->insert(HostName_t(it->c_str()));
+    size_t n = hosts.size();
+    size_t first = n ? (size_t)(*(size_t*)arg * 0.618034 * n) % n : 0;
+    for (size_t cc = 0; cc < n; ++cc) {
+        h.insert(Name_t(hosts[(first + cc) % n].c_str()));
+    }
+
+    *(size_t*)arg = h.size();
+    return arg;
+}
+
+// Accounting alone, the old shared counter against the per-thread ones:
+// an allocation and a free of 16 bytes per iteration
+static const size_t ACCOUNT_OPS = 10000000;
+
+typedef struct {} stub_Bench_t;
+static volatile long shared_bytes = 0;
+
+void *
+shared_routine(void* arg) {
+    for (size_t cc = 0; cc < ACCOUNT_OPS; ++cc) {
+        (void)__sync_fetch_and_add(&shared_bytes, 16);
+        (void)__sync_fetch_and_sub(&shared_bytes, 16);
     }
 
     return arg;
 }
 
+void *
+account_routine(void* arg) {
+    for (size_t cc = 0; cc < ACCOUNT_OPS; ++cc) {
+        MemTrackerCounter<stub_Bench_t>::add(16);
+        MemTrackerCounter<stub_Bench_t>::add(-16);
+    }
+
+    return arg;
+}
+
+// Seconds for 'nthreads' threads to run the routine at the same time
+double
+run(size_t nthreads, void* (*routine)(void*)) {
+    std::vector<pthread_t> threads(nthreads);
+    std::vector<size_t> counts(nthreads);
+
+    // Each thread gets its index and hands back its result in its count
+    double start = now();
+    for (size_t cc = 0; cc < nthreads; ++cc) {
+        counts[cc] = cc;
+        pthread_create(&threads[cc], NULL, routine, &counts[cc]);
+    }
+    for (size_t cc = 0; cc < nthreads; ++cc) {
+        pthread_join(threads[cc], NULL);
+    }
+
+    return now() - start;
+}
+
+// Bytes the heap hands out, arena chunks included
+static size_t
+heap_used() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+// Interns all hosts from one thread and keeps them, then looks them all up
+// again. Prints the bytes per host as tracked under the string and factory
+// tags S and F and as the heap sees them, and the lookups per second.
+template<typename Name_t, typename S, typename F>
+void
+footprint(const char* name) {
+    std::vector<Name_t> names;
+    names.reserve(hosts.size());
+
+    long tracked = MemTrackerCounter<S>::exact() + MemTrackerCounter<F>::exact();
+    size_t heap = heap_used();
+    for (Hosts_t::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+        names.push_back(Name_t(it->c_str()));
+    }
+    tracked = MemTrackerCounter<S>::exact() + MemTrackerCounter<F>::exact() - tracked;
+    heap = heap_used() - heap;
+
+    size_t found = 0;
+    double start = now();
+    for (Hosts_t::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+        found += (Name_t(it->c_str()) == names[found]);
+    }
+    double secs = now() - start;
+
+    printf("%8s %14.1f %14.1f %14.0f\n", name, (double)tracked / hosts.size(),
+           (double)heap / hosts.size(), found / secs);
+}
+
+// Intersections of the sets in the benchmark of host sets
+static const size_t SET_OPS = 20;
+
+// The hosts at multiples of 2 and of 3 as two Host_t and as two HostIdSet,
+// all interned before. Prints the bytes per host of the sets, then the
+// hosts per second going into the sets and through their intersections.
+void
+host_sets() {
+    std::vector<HostName_t> names;
+    std::vector<HostId> ids;
+    for (Hosts_t::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+        names.push_back(HostName_t(it->c_str()));
+        ids.push_back(HostId(*it));
+    }
+    size_t members = (hosts.size() + 1) / 2 + (hosts.size() + 2) / 3;
+
+    size_t heap = heap_used();
+    double start = now();
+    Host_t treeA, treeB;
+    for (size_t cc = 0; cc < hosts.size(); ++cc) {
+        if (0 == cc % 2) {
+            treeA.insert(names[cc]);
+        }
+        if (0 == cc % 3) {
+            treeB.insert(names[cc]);
+        }
+    }
+    double treeBuild = now() - start;
+    size_t treeBytes = heap_used() - heap;
+
+    size_t found = 0;
+    start = now();
+    for (size_t cc = 0; cc < SET_OPS; ++cc) {
+        Host_t both;
+        std::set_intersection(treeA.begin(), treeA.end(), treeB.begin(), treeB.end(),
+                              std::inserter(both, both.end()));
+        found += both.size();
+    }
+    double treeOps = now() - start;
+
+    heap = heap_used();
+    start = now();
+    std::vector<HostId> a, b;
+    for (size_t cc = 0; cc < hosts.size(); ++cc) {
+        if (0 == cc % 2) {
+            a.push_back(ids[cc]);
+        }
+        if (0 == cc % 3) {
+            b.push_back(ids[cc]);
+        }
+    }
+    HostIdSet flatA(a.begin(), a.end()), flatB(b.begin(), b.end());
+    double flatBuild = now() - start;
+    std::vector<HostId>().swap(a);
+    std::vector<HostId>().swap(b);
+    size_t flatBytes = heap_used() - heap;
+
+    start = now();
+    for (size_t cc = 0; cc < SET_OPS; ++cc) {
+        found -= (flatA & flatB).size();
+    }
+    double flatOps = now() - start;
+
+    printf("%8s %14s %14s %14s\n", "sets", "bytes/host", "build/s",
+           "intersect/s");
+    printf("%8s %14.1f %14.0f %14.0f\n", "tree", (double)treeBytes / members,
+           members / treeBuild, SET_OPS * members / treeOps);
+    printf("%8s %14.1f %14.0f %14.0f%s\n", "flat", (double)flatBytes / members,
+           members / flatBuild, SET_OPS * members / flatOps,
+           found ? " (differs)" : "");
+}
+
+// Usage: flyweight_memtracker [max threads] [hosts] [json]
+// Compares the footprint and lookups of hosts kept in arenas with those
+// kept on the heap, and sets of flyweights with flat sets of IDs. Then
+// interns the hosts from 1, 2, 4... threads with the default factory and
+// with the sharded one, and reports the inserts per second of each, and
+// the same for the accounting of allocations alone, per thread. Ends with
+// the statistics of all tags, as JSON if asked to.
 int
 main(int argc, char* argv[]) {
-    Host_t ht, hm;
-    void* ret = NULL;
-    pthread_t thread;
+    size_t maxthreads = (argc > 1) ? strtoul(argv[1], NULL, 0) : 8;
+    size_t nhosts = (argc > 2) ? strtoul(argv[2], NULL, 0) : 100000;
 
-    for (size_t cc = 1000; cc < 2000; ++cc) {
+    for (size_t cc = 0; cc < nhosts; ++cc) {
         char buff[32];
-        sprintf(buff, "%d", cc);
+        sprintf(buff, "host%07u.example", (unsigned)cc);
         hosts.push_back(buff);
     }
 
-    int tid = pthread_create(&thread, NULL, start_routine, &ht);
-    // start_routine(&hm);
+    // An unset host reads as none, before and after the first interning
+    HostId none;
+    if ('\0' != *none.c_str() || 0 != none.size() ||
+        (!hosts.empty() && HostId(hosts[0]) == none)) {
+        fprintf(stderr, "Error: an unset HostId is a host\n");
+        return 1;
+    }
 
-    Hosts_t hosts2;
-    for (size_t cc = 1000; cc < 2000; ++cc) {
-        char buff[32];
-        sprintf(buff, "%d", cc);
-        hosts2.push_back(buff);
+    // First, while the arenas are still empty
+    printf("%8s %14s %14s %14s\n", "strings", "tracked/host", "heap/host",
+           "lookups/s");
+    footprint<HeapHostName_t, stub_HeapHostString_t, stub_HostFactory_t>("heap");
+    footprint<HostName_t, HostArena_t, HostFactoryArena_t>("arena");
+    host_sets();
+
+    printf("%8s %14s %14s %8s\n", "threads", "global/s", "sharded/s",
+           "speedup");
+    for (size_t nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        double global = run(nthreads, start_routine<GlobalHostName_t>);
+        double sharded = run(nthreads, start_routine<HostName_t>);
+        double inserts = (double)nthreads * nhosts;
+        printf("%8u %14.0f %14.0f %8.2f\n", (unsigned)nthreads,
+               inserts / global, inserts / sharded, global / sharded);
     }
 
-    for (Hosts_t::iterator it = hosts2.begin(); it != hosts2.end(); ++it) {
-        hm.insert(HostName_t(it->c_str()));
+    printf("%8s %14s %14s %8s\n", "threads", "shared/thr/s", "local/thr/s",
+           "speedup");
+    for (size_t nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        double shared = run(nthreads, shared_routine);
+        double local = run(nthreads, account_routine);
+        printf("%8u %14.0f %14.0f %8.2f\n", (unsigned)nthreads,
+               ACCOUNT_OPS / shared, ACCOUNT_OPS / local, shared / local);
     }
 
-    pthread_join(thread, &ret);
-    std::cout << HostAllocator::mem_used() << std::endl;
+    // Every host was released, the arenas keep their chunks and the
+    // factory its bucket arrays
+    std::cout << "mem_used: " << HostAllocator::mem_used()
+              << " approx: " << HostAllocator::mem_used_approx()
+              << " factory: "
+              << MemTrackerAllocator<char, HostFactoryArena_t>::mem_used()
+              << " heap: " << HeapHostAllocator::mem_used()
+              << " ids: " << HostIdTable::size() << " id strings: "
+              << MemTrackerAllocator<char, HostIdArena_t>::mem_used()
+              << " id index: "
+              << MemTrackerAllocator<char, stub_HostIds_t>::mem_used()
+              << " accounting: " << MemTrackerCounter<stub_Bench_t>::exact()
+              << std::endl;
+
+    MemTrackerRegistry::dump(std::cout, argc > 3 && 0 == strcmp(argv[3], "json"));
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env bash
+#------------------------------------------------------------------------------
+# File  : dbbench.sh
+# Usage : ./dbbench.sh [records] [workdir]
+# Desc  : Generates DBs of every access method with dbgen and reports the
+#         dbdump throughput, peak RSS and syscalls per record of each mode
+#------------------------------------------------------------------------------
+RECORDS=${1:-1000000}
+WORKDIR=${2:-/tmp/dbbench.$$}
+JOBS=${JOBS:-4}
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-O2 -g"}
+LIBS=${LIBS:-"-ldb_cxx -lpthread"}
+SRCDIR=`dirname $0`
+DBDUMP=${DBDUMP:-$WORKDIR/dbdump}
+DBGEN=${DBGEN:-$WORKDIR/dbgen}
+TIME=${TIME:-/usr/bin/time}
+
+# GNU time reports the peak RSS
+if ! $TIME -f "%M" -o /dev/null true 2> /dev/null ; then
+    echo "Error: Needs GNU time, set TIME to its path" 1>&2
+    exit 1
+fi
+
+mkdir -p $WORKDIR || exit 1
+
+# Build the tools unless given
+build() {
+    if [ ! -x "$2" ] ; then
+        echo "Building $2"
+        $CXX $CXXFLAGS -o $2 $SRCDIR/$1 $LIBS || exit 1
+    fi
+}
+build dbdump.cc $DBDUMP
+build dbgen.cc $DBGEN
+
+# Access method, dbgen arguments and the file named like a known DB so that
+# both tools agree on its formats. Values start with a u32/u64 record number.
+METHODS="btree dup hash recno queue"
+declare -A GENARGS=(
+    [btree]="-t btree oid.db"
+    [dup]="-t btree -d 4 oidid.db"
+    [hash]="-t hash attrname.db"
+    [recno]="-t recno -v u32:i32 recno.db"
+    [queue]="-t queue -v u32:i32 queue.db"
+)
+declare -A DUMPARGS=(
+    [recno]="-v u32:i32"
+    [queue]="-v u32:i32"
+)
+
+# Dump modes, '-j' only splits BTREEs and '-m' only reads BTREE and HASH
+# pages itself, other methods fall back to libdb and measure the plain dump
+MODES="plain jobs mmap stats filter pipe zip"
+declare -A MODEARGS=(
+    [plain]=""
+    [jobs]="-j $JOBS"
+    [mmap]="-m"
+    [stats]="--stats"
+    [filter]="--filter v.0<1000"
+    [pipe]="--pipeline"
+    [zip]="--compress"
+)
+
+# Measure one dump: wall time and peak RSS from time(1), then the syscalls
+# from a second, traced run as tracing slows it down
+run() {
+    local method=$1 mode=$2 dbfile=$3
+    shift 3
+
+    $TIME -f "%e %M" -o $WORKDIR/time \
+        $DBDUMP "$@" $dbfile > $WORKDIR/out 2> /dev/null
+    if [ $? -ne 0 ] ; then
+        printf "%-6s %-7s failed\n" $method $mode
+        return
+    fi
+    read secs rss < $WORKDIR/time
+    outsz=`stat -c %s $WORKDIR/out`
+    dbsz=`stat -c %s $dbfile`
+
+    calls=-
+    if which strace > /dev/null 2>&1 ; then
+        strace -f -o $WORKDIR/strace $DBDUMP "$@" $dbfile > /dev/null 2>&1
+        calls=`grep -vc 'resumed>' $WORKDIR/strace`
+    fi
+
+    awk -v m=$method -v o=$mode -v n=$records -v s=$secs -v r=$rss \
+        -v db=$dbsz -v out=$outsz -v c=$calls 'BEGIN {
+        if (s <= 0) s = 0.01
+        printf "%-6s %-7s %10d %12.0f %9.1f %9.1f %9d %9s\n", m, o, n,
+            n / s, db / s / 1048576, out / s / 1048576, r,
+            c == "-" ? "-" : sprintf("%.4f", c / n)
+    }'
+}
+
+printf "%-6s %-7s %10s %12s %9s %9s %9s %9s\n" method mode records \
+    "records/s" "DB MB/s" "out MB/s" "RSS KB" "sys/rec"
+
+for method in $METHODS ; do
+    set -- ${GENARGS[$method]}
+    dbfile=$WORKDIR/${@: -1}
+    if ! $DBGEN -n $RECORDS "${@:1:$#-1}" $dbfile 2> $WORKDIR/err ; then
+        printf "%-6s %-7s failed: %s\n" $method dbgen "`tail -1 $WORKDIR/err`"
+        continue
+    fi
+
+    # Rates are of the records the DB holds, formats may repeat some
+    records=`awk '/^Wrote/ { print $2 }' $WORKDIR/err`
+    records=${records:-$RECORDS}
+
+    for mode in $MODES ; do
+        if [ $mode = jobs ] && [ $method != btree ] && [ $method != dup ] ; then
+            continue
+        fi
+        run $method $mode $dbfile ${DUMPARGS[$method]} ${MODEARGS[$mode]}
+    done
+done
+
+# Keep the DBs of a given workdir for the next run
+if [ -z "$2" ] ; then
+    rm -rf $WORKDIR
+fi
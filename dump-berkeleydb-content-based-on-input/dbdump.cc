@@ -3,13 +3,43 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <byteswap.h>
+#include <endian.h>
+#include <fnmatch.h>
+#include <fcntl.h>
 #include <time.h>
 #include <libgen.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include <iomanip>
 #include <typeinfo>
 #include <iostream>
+#include <fstream>
 #include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <cstring>
 
 // Some stuff from tr1
 #include <tr1/tuple>
@@ -17,27 +47,47 @@
 
 #ifdef _ONTAP_
 #include <bdb/db_cxx.h>
-#include <bdb/dbstl_map.h>
-#include <bdb/dbstl_vector.h>
 #else
 #include <db_cxx.h>
-#include <dbstl_map.h>
-#include <dbstl_vector.h>
 #endif
 
 using namespace std;
-using namespace dbstl;
 
-// Generic containers mapping to various BerkeleyDB access methods
-typedef db_vector<ElementRef<Dbt> > mds_vec_t;
-typedef db_map<Dbt, Dbt, ElementRef<Dbt> > mds_map_t;
-typedef db_multimap<Dbt, Dbt, ElementRef<Dbt> > mds_mmap_t;
+// Key/value pair as read from a cursor
+typedef pair<Dbt, Dbt> mds_rec_t;
+
+// Default size of the user buffer for bulk reads, a multiple of 1024
+static const size_t BULK_BUFSZ = 4 * 1024 * 1024;
+
+// Size of the first bulk read after positioning, doubled for every read
+// that follows so that short ranges do not copy a full buffer
+static const size_t BULK_MINSZ = 64 * 1024;
+
+// Default size of the output buffer
+static const size_t OUT_BUFSZ = 1024 * 1024;
+
+// Buffers of a pipelined output, queued for the writer thread
+static const size_t PIPE_BUFS = 4;
+
+// Rows per row group of a columnar export
+static const size_t COL_GROUP_ROWS = 64 * 1024;
+
+// Bulk put bytes per transaction of a load, halved when the lock table of
+// the environment cannot hold them
+static const size_t LOAD_TXN_SZ = 64 * 1024 * 1024;
+
+// Output buffer, longest request line and first bulk buffer of a server
+// connection
+static const size_t SERVE_OUT_BUFSZ = 64 * 1024;
+static const size_t SERVE_MAX_LINE = 64 * 1024;
+static const size_t SERVE_BULK_BUFSZ = 256 * 1024;
 
 // A type for hex printing
 typedef struct hex_t;
 
 // Function pointer of PrintDataByType
-typedef size_t (*f_PrintDataByType)(void *, size_t);
+class OutBuf;
+typedef size_t (*f_PrintDataByType)(OutBuf &, const char *, size_t);
 
 // Store the program name without the path information
 static string progname;
@@ -53,9 +103,51 @@ usage(int ret, const char *msg = NULL)
     }
 
     cerr << "Usage: " << progname
-         << " [-k fmt] [-v fmt] [-erh] [-f] db_file" << endl;
+         << " [-k fmt] [-v fmt] [-j jobs] [-ermh]" << endl
+         << "       [--from key] [--to key] [--prefix key]..."
+         << " [--prefix-file file]" << endl
+         << "       [--filter expr] [--stats] [--binary] [--columnar"
+         << " [--row-group n]]" << endl
+         << "       [--pipeline] [--compress] [--schema file]... [-f] db_file"
+         << endl;
+    cerr << "       " << progname << " -o dir [-k fmt] [-v fmt] [-j jobs]"
+         << " [-ermh] [--filter expr]" << endl
+         << "       [--stats] [--pipeline] [--compress] db_file|db_dir..."
+         << endl;
+    cerr << "       " << progname << " --diff [-k fmt] [-v fmt] [-er]"
+         << " [--from key] [--to key]" << endl
+         << "       [--prefix key]... [--filter expr] db_file db_file"
+         << endl;
+    cerr << "       " << progname << " --cdc state_file -e [-k fmt] [-v fmt]"
+         << " db_file" << endl;
+    cerr << "       " << progname << " --live|--snapshot -e [--max-rate n]"
+         << " [--max-mbps n] [-k fmt]" << endl
+         << "       [-v fmt] [--from key] [--to key] [--prefix key]..."
+         << " [--filter expr]" << endl
+         << "       [--stats] db_file" << endl;
+    cerr << "       " << progname << " --join file[:k|:v][.N]... [-k fmt]"
+         << " [-v fmt] [-er]" << endl
+         << "       [--from key] [--to key] [--prefix key]... [--filter expr]"
+         << " db_file" << endl;
+    cerr << "       " << progname << " --load file|- [--type type] [-k fmt]"
+         << " [-v fmt] [-j jobs] [-er]" << endl
+         << "       db_file" << endl;
+    cerr << "       " << progname << " --serve socket [-k fmt] [-v fmt]"
+         << " [-j jobs] [-er] db_file|db_dir..." << endl;
+    cerr << "       " << progname << " --decompress file|-" << endl;
+    cerr << "       " << progname << " -k fmt -v fmt -B count" << endl;
     cerr << "\t -e \tUse DB environment to open DB file" << endl;
     cerr << "\t -r \tRun recovery on the environment" << endl;
+    cerr << "\t -m \tRead BTREE/HASH pages from the file without libdb,"
+         << " in page order," << endl;
+    cerr << "\t    \t falls back to libdb for files it cannot parse"
+         << endl;
+    cerr << "\t -j \tSplit a BTREE into key ranges dumped by 'jobs' threads"
+         << endl;
+    cerr << "\t -o \tDump many DBs, or the .db/.sdb files of folders, in"
+         << " one environment" << endl;
+    cerr << "\t    \t to dir/<db_file>.dump, 'jobs' DBs at once (default"
+         << " one per CPU)" << endl;
     cerr << "\t -k \tSpecify the format to interpret the key" << endl;
     cerr << "\t -v \tSpecify the format to interpret the value" << endl;
     cerr << "\t    \tFormat is ':' separated combination of the following"
@@ -66,288 +158,8203 @@ usage(int ret, const char *msg = NULL)
     cerr << "\t    \t o 'u32' for unit32" << endl;
     cerr << "\t    \t o 'i64' for int64" << endl;
     cerr << "\t    \t o 'u64' for uint64" << endl;
-    cerr << "\t    \t o 'hex' for hexadecimal" << endl;
+    cerr << "\t    \t o 'hex' for hexadecimal, two digits per byte" << endl;
+    cerr << "\t    \tand, mostly for schema files, of" << endl;
+    cerr << "\t    \t o 'i32be', 'u64le'... for numbers in a byte order"
+         << endl;
+    cerr << "\t    \t o 'sN', 'hexN' for N bytes of NUL padded string or"
+         << " hex" << endl;
+    cerr << "\t    \t o 's/W', 'hex/W' for either after a W byte length,"
+         << " W 1, 2, 4 or 8," << endl;
+    cerr << "\t    \t   with be or le for its byte order" << endl;
+    cerr << "\t    \t o 'T*N', 'T*/W', 'T*' for N elements of type T, a"
+         << " W byte count of" << endl;
+    cerr << "\t    \t   them then the elements, or all up to the end,"
+         << " space separated" << endl;
+    cerr << "\t    \t o 'padN', 'alignN' to skip N bytes, or up to a"
+         << " multiple of N," << endl;
+    cerr << "\t    \t   before the next field" << endl;
+    cerr << "\t    \t o '@name' for the fields of a schema layout" << endl;
+    cerr << "\t --schema\tRead DB formats from file, after those of"
+         << " DBDUMP_SCHEMA, a ':'" << endl;
+    cerr << "\t    \t separated list of files. Lines are 'layout name fmt'"
+         << " or" << endl;
+    cerr << "\t    \t 'db_file|pattern key_fmt|- val_fmt|-', '#' starts a"
+         << " comment. May repeat," << endl;
+    cerr << "\t    \t later files override earlier ones" << endl;
+    cerr << "\t --from\tStart a BTREE dump at this key" << endl;
+    cerr << "\t --to\tEnd a BTREE dump after this key and all keys it"
+         << " prefixes" << endl;
+    cerr << "\t --prefix\tDump only keys starting with this, may repeat"
+         << endl;
+    cerr << "\t --prefix-file\tRead one --prefix per line from file"
+         << endl;
+    cerr << "\t    \tKeys are written as printed, in the '-k' format"
+         << endl;
+    cerr << "\t --filter\tDump only records matching expr, such as" << endl;
+    cerr << "\t    \t 'v.1 > 1000 && (k.0 == \"foo\" || k.0 ~ \"bar\")'"
+         << endl;
+    cerr << "\t    \t k.N/v.N is field N of the key/value format, '~'"
+         << " tests for a substring," << endl;
+    cerr << "\t    \t hex fields compare to hex digits in quotes" << endl;
+    cerr << "\t --stats\tPrint sizes, duplicate chains, distinct counts and"
+         << " top values" << endl;
+    cerr << "\t    \t per field instead of the records, in one pass"
+         << endl;
+    cerr << "\t --diff\tPrint the records of two BTREE DBs that differ,"
+         << " walking both in key" << endl;
+    cerr << "\t    \t order: '-' only or changed in the first, '+' only"
+         << " or changed in" << endl;
+    cerr << "\t    \t the second" << endl;
+    cerr << "\t --cdc\tPrint the keys changed since the position saved in"
+         << " state_file by the" << endl;
+    cerr << "\t    \t last run, from the transaction log: '+' with their"
+         << " records, or '-'" << endl;
+    cerr << "\t    \t when deleted. The first run only saves the end of the"
+         << " log" << endl;
+    cerr << "\t --join\tPrint the records that resolve through the keys of"
+         << " file, with the" << endl;
+    cerr << "\t    \t values found there: by key, value, or field N of"
+         << " either. May repeat." << endl;
+    cerr << "\t    \t Two BTREEs joined by key are walked in order,"
+         << " otherwise the" << endl;
+    cerr << "\t    \t smaller DB is loaded in a hash table" << endl;
+    cerr << "\t --live\tDump a BTREE in use by others: every bulk read"
+         << " runs in its own" << endl;
+    cerr << "\t    \t read committed transaction, no lock is held"
+         << " between reads" << endl;
+    cerr << "\t --snapshot\tDump a BTREE in use as one snapshot"
+         << " transaction, without read" << endl;
+    cerr << "\t    \t locks if its writers open it with DB_MULTIVERSION"
+         << endl;
+    cerr << "\t --max-rate\tRead at most n records per second, implies"
+         << " --live" << endl;
+    cerr << "\t --max-mbps\tRead at most n MB of records per second,"
+         << " implies --live" << endl;
+    cerr << "\t    \tRates and time spent in reads are reported at the end"
+         << endl;
+    cerr << "\t --binary\tDump records as 32 bit lengths and bytes, in"
+         << " host order, for --load" << endl;
+    cerr << "\t --columnar\tExport every field of the formats as a typed"
+         << " column, in row groups" << endl;
+    cerr << "\t    \t of --row-group rows (default " << COL_GROUP_ROWS
+         << ") with the min and max" << endl;
+    cerr << "\t    \t of each column, for readers that mmap the file"
+         << endl;
+    cerr << "\t --pipeline\tRead ahead in a reader thread and write in a"
+         << " writer thread, with" << endl;
+    cerr << "\t    \t writev, while records are formatted" << endl;
+    cerr << "\t --compress\tWrite compressed blocks, implies --pipeline."
+         << " -o writes" << endl;
+    cerr << "\t    \t <db_file>.dump.z" << endl;
+    cerr << "\t --decompress\tPrint the text of a compressed dump, '-'"
+         << " for stdin" << endl;
+    cerr << "\t --load\tCreate db_file from a text dump in the '-k'/'-v'"
+         << " formats or a binary" << endl;
+    cerr << "\t    \t one, '-' for stdin. Text is parsed by 'jobs' threads,"
+         << " BTREE keys are" << endl;
+    cerr << "\t    \t sorted and records go in with bulk puts, in large"
+         << " transactions with '-e'." << endl;
+    cerr << "\t    \t Compressed dumps are expanded first" << endl;
+    cerr << "\t --type\tAccess method to load into: btree (default for"
+         << " keys), hash, recno" << endl;
+    cerr << "\t    \t (default for values) or queue" << endl;
+    cerr << "\t --serve\tKeep the DBs open with a warm cache and answer"
+         << " requests on a Unix" << endl;
+    cerr << "\t    \t socket, 'jobs' connections at once (default one per"
+         << " CPU), one per line:" << endl;
+    cerr << "\t    \t 'get db key', 'prefix db key', 'range db from to',"
+         << " 'scan db [filter]'" << endl;
+    cerr << "\t    \t or 'dbs'. Records come back as dumped, then '#end"
+         << " count' or '#error msg'." << endl;
+    cerr << "\t    \t Runs until SIGINT or SIGTERM" << endl;
     cerr << "\t -f \tSpecify the db_file" << endl;
+    cerr << "\t -B \tBenchmark the record decoders of the formats on"
+         << endl;
+    cerr << "\t    \t 'count' synthetic records" << endl;
     cerr << "\t -h \tShow this help" << endl;
 
     exit(ret);
 }
 
 //-----------------------------------------------------------------------------
-// PrintDataByType
-//  Functor to print data as per type
+// OutBuf
+//  Buffered writer on a file descriptor. Formats numbers itself, without
+//  locales, and only issues a write when the buffer fills up or on Flush.
 //-----------------------------------------------------------------------------
-template <typename T>
-size_t PrintDataByType(void *data, size_t remaining) {
-    cout << *(T *)data;
-    return (remaining > sizeof(T)) ? sizeof(T) : remaining;
+class OutBuf {
+public:
+    OutBuf(int fd, size_t sz = OUT_BUFSZ)
+        : _fd(fd), _bGood(true), _buff(sz), _pipe(NULL) {
+        _pos = &_buff[0];
+        _end = _pos + _buff.size();
+    }
+
+    ~OutBuf() {
+        Flush();
+        StopPipeline();
+    }
+
+    OutBuf &operator<<(char c) {
+        if (_pos == _end) {
+            Drain();
+        }
+        *_pos++ = c;
+        return *this;
+    }
+
+    OutBuf &operator<<(const char *str) { return Write(str, strlen(str)); }
+    OutBuf &operator<<(const string &str) {
+        return Write(str.data(), str.size());
+    }
+
+    OutBuf &operator<<(int v) { return PutSigned(v); }
+    OutBuf &operator<<(long v) { return PutSigned(v); }
+    OutBuf &operator<<(long long v) { return PutSigned(v); }
+    OutBuf &operator<<(unsigned v) { return PutUnsigned(v); }
+    OutBuf &operator<<(unsigned long v) { return PutUnsigned(v); }
+    OutBuf &operator<<(unsigned long long v) { return PutUnsigned(v); }
+
+    OutBuf &Write(const void *data, size_t len);
+
+    // Make room for 'len' contiguous bytes (at most the buffer size) and
+    // return where to put them. Commit() with the end of what was used.
+    char *Reserve(size_t len) {
+        if ((size_t)(_end - _pos) < len) {
+            Drain();
+        }
+        return _pos;
+    }
+
+    void Commit(char *end) { _pos = end; }
+
+    // Write out everything buffered so far
+    bool Flush() {
+        Drain();
+        if (_pipe) {
+            Wait();
+        }
+        return _bGood;
+    }
+
+    bool Good() const { return _bGood; }
+    int Fd() const { return _fd; }
+
+    // Hand full buffers to a writer thread, which writes them with writev,
+    // instead of writing them inline, so that formatting goes on while
+    // the output blocks. With bCompress they go out as compressed blocks.
+    // False if the thread cannot start.
+    bool Pipeline(bool bCompress);
+    bool Pipelined() const { return NULL != _pipe; }
+
+private:
+    OutBuf &PutSigned(long long v) {
+        char *pos = Reserve(MAX_DIGITS + 1);
+        unsigned long long u = v;
+        if (v < 0) {
+            *pos++ = '-';
+            u = 0 - u;
+        }
+        Commit(FormatUnsigned(pos, u));
+        return *this;
+    }
+
+    OutBuf &PutUnsigned(unsigned long long v) {
+        Commit(FormatUnsigned(Reserve(MAX_DIGITS), v));
+        return *this;
+    }
+
+    static char *FormatUnsigned(char *pos, unsigned long long v);
+    void Drain();
+
+    struct Pipe;
+    static void *Writer(void *arg);
+    void Queue();
+    void Wait();
+    void StopPipeline();
+    static void DeletePipe(Pipe *pipe);
+
+    enum { MAX_DIGITS = 20 };
+
+    int _fd;
+    bool _bGood;                // No write error so far
+    vector<char> _buff;
+    Pipe *_pipe;                // Writer thread, if any
+    char *_pos;
+    char *_end;
+};
+
+// Two digit lookup table for number formatting
+static const char s_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+char *
+OutBuf::FormatUnsigned(char *pos, unsigned long long v)
+{
+    char tmp[MAX_DIGITS];
+    char *p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        const char *d = &s_digits[(v % 100) * 2];
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+
+    if (v >= 10) {
+        *--p = s_digits[v * 2 + 1];
+        *--p = s_digits[v * 2];
+    } else {
+        *--p = '0' + (char)v;
+    }
+
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(pos, p, len);
+
+    return pos + len;
 }
 
-//-----------------------------------------------------------------------------
-// PrintDataByType<char *>
-//  Specialize for string printing
-//-----------------------------------------------------------------------------
-template <>
-size_t PrintDataByType<char *>(void *data, size_t remaining) {
-    cout << (char *)data;
-    return (strlen((char *)data) + 1);
+OutBuf &
+OutBuf::Write(const void *data, size_t len)
+{
+    const char *src = (const char *)data;
+
+    while (len) {
+        if (_pos == _end) {
+            Drain();
+        }
+
+        size_t cnt = min(len, (size_t)(_end - _pos));
+        memcpy(_pos, src, cnt);
+        _pos += cnt;
+        src += cnt;
+        len -= cnt;
+    }
+
+    return *this;
 }
 
-//-----------------------------------------------------------------------------
-// PrintDataByType<hex_t>
-//   Specialized for hex printing
-//-----------------------------------------------------------------------------
-template <>
-size_t PrintDataByType<hex_t>(void *data, size_t remaining) {
-    for (size_t cc = 0; cc < remaining; cc++) {
-        cout << hex << (int)((char *)data)[cc];
+void
+OutBuf::Drain()
+{
+    if (_pipe) {
+        Queue();
+        return;
     }
-    return remaining;
+
+    const char *pos = &_buff[0];
+
+    // After a failure keep discarding so that callers need not check
+    while (_bGood && pos < _pos) {
+        ssize_t cnt = write(_fd, pos, _pos - pos);
+        if (cnt < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            _bGood = false;
+            break;
+        }
+        pos += cnt;
+    }
+
+    _pos = &_buff[0];
+
+    return;
 }
 
 //-----------------------------------------------------------------------------
-// Generic printer class
+// CompressBlock
+//  LZ77 block compression in the token layout of LZ4: a token byte with
+//  the literal count and the match length - 4 in its nibbles, each
+//  extended by bytes while 255, the literals, then a 16 bit match offset.
+//  Matches come from a hash table of 4 byte sequences, one probe per
+//  position, skipping ahead faster through data that does not compress.
+//  The last token only has literals. 'dst' holds COMPRESS_BOUND(len).
 //-----------------------------------------------------------------------------
-template<typename T>
-class PrintData {
-public:
-    // For vector types: queue and recno
-    PrintData(string &valFmt) {
-        _bFirst = true;
-        ParseOpt(valFmt, _valFmt);
+#define COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)
+
+// Header line of a compressed output, followed by blocks of a u32 length,
+// a u32 stored length, equal when stored as is, and the stored bytes
+static const char COMPRESS_HEADER[] = "#compressed\n";
+
+static inline uint8_t *
+PutLength(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
     }
+    *op++ = (uint8_t)len;
 
-    // For associated types: map or multi-map
-    PrintData(string &keyFmt, string &valFmt) {
-        _bFirst = true;
-        ParseOpt(keyFmt, _keyFmt);
-        ParseOpt(valFmt, _valFmt);
+    return op;
+}
+
+static uint8_t *
+PutSequence(uint8_t *op, const uint8_t *lit, size_t nlit, size_t offset,
+            size_t mlen)
+{
+    uint8_t *token = op++;
+    *token = (uint8_t)(min(nlit, (size_t)15) << 4);
+    if (nlit >= 15) {
+        op = PutLength(op, nlit - 15);
     }
+    memcpy(op, lit, nlit);
+    op += nlit;
 
-    // Functor to enable being called from stl algorithm
-    void operator() (T &obj);
+    // The last sequence has no match
+    if (mlen) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        *token |= (uint8_t)min(mlen - 4, (size_t)15);
+        if (mlen - 4 >= 15) {
+            op = PutLength(op, mlen - 4 - 15);
+        }
+    }
 
-private:
-    bool _bFirst;
-    vector<f_PrintDataByType> _keyFmt;
-    vector<f_PrintDataByType> _valFmt;
+    return op;
+}
+
+static size_t
+CompressBlock(const char *src, size_t len, char *dst)
+{
+    enum { HASH_BITS = 14 };
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *in = (const uint8_t *)src;
+    const uint8_t *end = in + len;
+    const uint8_t *anchor = in;
+    uint8_t *op = (uint8_t *)dst;
+
+    // Matches start 12 bytes and end 5 bytes before the end at the latest
+    if (len > 12) {
+        const uint8_t *limit = end - 12;
+        for (const uint8_t *ip = in + 1; ip < limit; ) {
+            uint32_t seq;
+            memcpy(&seq, ip, sizeof(seq));
+            uint32_t hash = (seq * 2654435761U) >> (32 - HASH_BITS);
+            const uint8_t *ref = in + table[hash];
+            table[hash] = ip - in;
+
+            uint32_t old;
+            memcpy(&old, ref, sizeof(old));
+            if (ref >= ip || ip - ref > 65535 || old != seq) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            const uint8_t *mend = ip + 4;
+            for (ref += 4; mend < end - 5 && *mend == *ref; mend++, ref++) {
+            }
+            op = PutSequence(op, anchor, ip - anchor, mend - ref,
+                             mend - ip);
+            ip = anchor = mend;
+        }
+    }
+
+    op = PutSequence(op, anchor, end - anchor, 0, 0);
+
+    return op - (uint8_t *)dst;
+}
 
-    static bool
-    IsPrintable(char *ptr, size_t sz) {
-        if ('\0' != ptr[--sz]) {
+//-----------------------------------------------------------------------------
+// DecompressBlock
+//  Expand a block of CompressBlock into exactly 'len' bytes, false if it
+//  is corrupt
+//-----------------------------------------------------------------------------
+static inline bool
+GetLength(const uint8_t *&ip, const uint8_t *end, size_t &len)
+{
+    uint8_t b;
+    do {
+        if (ip == end) {
             return false;
         }
+        len += (b = *ip++);
+    } while (255 == b);
 
-        for (size_t cc = 0; cc < sz; cc++) {
-            if (!isprint(ptr[cc])) {
-                return false;
-            }
+    return true;
+}
+
+static bool
+DecompressBlock(const char *src, size_t slen, char *dst, size_t len)
+{
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + slen;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t nlit = token >> 4;
+        if (15 == nlit && !GetLength(ip, iend, nlit)) {
+            return false;
         }
+        if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op)) {
+            return false;
+        }
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
 
-        return true;
-    }
+        // The last sequence ends with its literals
+        if (ip == iend) {
+            break;
+        }
 
-    // Parse the output format into more usable format
-    static bool
-    ParseOpt(string &fmt, vector<f_PrintDataByType> &funcs) {
-        char buff[1024];
-        strcpy(buff, fmt.c_str());
-        char *tok = strtok((char *)buff, ":");
-
-        while (NULL != tok) {
-            if (0 == strcmp(tok, "c")) {
-                funcs.push_back(PrintDataByType<char>);
-            } else if (0 == strcmp(tok, "s")) {
-                funcs.push_back(PrintDataByType<char *>);
-            } else if (0 == strcmp(tok, "i32")) {
-                funcs.push_back(PrintDataByType<int32_t>);
-            } else if (0 == strcmp(tok, "u32")) {
-                funcs.push_back(PrintDataByType<uint32_t>);
-            } else if (0 == strcmp(tok, "i64")) {
-                funcs.push_back(PrintDataByType<int64_t>);
-            } else if (0 == strcmp(tok, "u64")) {
-                funcs.push_back(PrintDataByType<uint64_t>);
-            } else if (0 == strcmp(tok, "hex")) {
-                funcs.push_back(PrintDataByType<hex_t>);
-            } else {
-                funcs.clear();
-                cerr << "Error: Unrecognized format \""
-                     << tok << "\"" << endl;
-                usage(-1);
-                return false;
-            }
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t mlen = token & 15;
+        if (15 == mlen && !GetLength(ip, iend, mlen)) {
+            return false;
+        }
+        mlen += 4;
+        if (0 == offset || offset > (size_t)(op - (uint8_t *)dst) ||
+            mlen > (size_t)(oend - op)) {
+            return false;
+        }
 
-            tok = strtok(NULL, ":");
+        // Byte by byte, matches may overlap what they produce
+        const uint8_t *ref = op - offset;
+        while (mlen--) {
+            *op++ = *ref++;
         }
+    }
+
+    return op == oend;
+}
+
+//-----------------------------------------------------------------------------
+// OutBuf::Pipe
+//  Writer thread of a pipelined OutBuf, with a fixed pool of buffers that
+//  the OutBuf fills and the writer drains, in order
+//-----------------------------------------------------------------------------
+struct OutBuf::Pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    vector<vector<char> *> pool;    // All buffers, for cleanup
+    vector<vector<char> *> free;    // Ready to be filled
+    deque<pair<vector<char> *, size_t> > full;
+    size_t busy;                    // Buffers being written
+    bool bCompress;
+    bool bStop;
+    bool bGood;                     // No write error so far
+    int fd;
+    pthread_t thread;
+};
 
+bool
+OutBuf::Pipeline(bool bCompress)
+{
+    if (_pipe) {
         return true;
     }
 
-    // Interpret and print the data based on the format specified
-    void
-    static DoPrint(Dbt &obj, vector<f_PrintDataByType> &fmt) {
-        vector<f_PrintDataByType>::const_iterator it;
+    Pipe *pipe = new Pipe;
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+    for (size_t cc = 0; cc < PIPE_BUFS; cc++) {
+        pipe->pool.push_back(new vector<char>(_buff.size()));
+    }
+    pipe->free = pipe->pool;
+    pipe->busy = 0;
+    pipe->bCompress = bCompress;
+    pipe->bStop = false;
+    pipe->bGood = _bGood;
+    pipe->fd = _fd;
 
-        size_t sz = obj.get_size();
-        void *data = obj.get_data();
+    // What is buffered so far goes to the writer with the rest
+    if (pthread_create(&pipe->thread, NULL, Writer, pipe)) {
+        cerr << "Error: Unable to create writer thread" << endl;
+        DeletePipe(pipe);
+        return false;
+    }
+    _pipe = pipe;
 
-        // Should happen only for Attribute Db
-        if (fmt.empty()) {
-            string opt;
+    return true;
+}
 
-            if (PrintData<T>::IsPrintable((char *)data, sz)) {
-                opt = "s";
-            } else {
-                // We know it is long but the size of long on 32b is 4
-                // and on 64b is 8. Attempting to print the right long type
-                if (sz == sizeof(int32_t)) {
-                    opt = "i32";
-                } else if (sz == sizeof(int64_t)) {
-                    opt = "i64";
-                } else {
-                    // Fallback on printing it as a bunch of int64_t types
-                    opt = "i64";
-                    for (size_t cc = 1; cc < sz/sizeof(int64_t); cc++) {
-                        opt += ":i64";
-                    }
-                }
+// Swap the filled buffer for a free one and queue it for the writer
+void
+OutBuf::Queue()
+{
+    size_t len = _pos - &_buff[0];
+    if (0 == len) {
+        return;
+    }
+
+    pthread_mutex_lock(&_pipe->lock);
+    while (_pipe->free.empty()) {
+        pthread_cond_wait(&_pipe->cond, &_pipe->lock);
+    }
+    vector<char> *buff = _pipe->free.back();
+    _pipe->free.pop_back();
+    buff->swap(_buff);
+    _pipe->full.push_back(make_pair(buff, len));
+    pthread_cond_broadcast(&_pipe->cond);
+    pthread_mutex_unlock(&_pipe->lock);
+
+    _pos = &_buff[0];
+    _end = _pos + _buff.size();
+
+    return;
+}
+
+// Wait until everything queued is written
+void
+OutBuf::Wait()
+{
+    pthread_mutex_lock(&_pipe->lock);
+    while (!_pipe->full.empty() || _pipe->busy) {
+        pthread_cond_wait(&_pipe->cond, &_pipe->lock);
+    }
+    _bGood = _bGood && _pipe->bGood;
+    pthread_mutex_unlock(&_pipe->lock);
+
+    return;
+}
+
+void
+OutBuf::StopPipeline()
+{
+    Pipe *pipe = _pipe;
+    if (!pipe) {
+        return;
+    }
+    _pipe = NULL;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->bStop = true;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+    pthread_join(pipe->thread, NULL);
+
+    DeletePipe(pipe);
+
+    return;
+}
+
+void
+OutBuf::DeletePipe(Pipe *pipe)
+{
+    for (size_t cc = 0; cc < pipe->pool.size(); cc++) {
+        delete pipe->pool[cc];
+    }
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->lock);
+    delete pipe;
+
+    return;
+}
+
+// Write all of the vectors, false on error
+static bool
+WriteAll(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt) {
+        ssize_t len = writev(fd, iov, cnt);
+        if (len < 0) {
+            if (EINTR == errno) {
+                continue;
             }
+            return false;
+        }
 
-            // Get the appropriate list of print functors
-            ParseOpt(opt, fmt);
+        for (; cnt && (size_t)len >= iov->iov_len; iov++, cnt--) {
+            len -= iov->iov_len;
         }
+        if (cnt) {
+            iov->iov_base = (char *)iov->iov_base + len;
+            iov->iov_len -= len;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// OutBuf::Writer
+//  Thread routine: write out the queued buffers, all that are queued at
+//  once with one writev, compressed first if asked to
+//-----------------------------------------------------------------------------
+void *
+OutBuf::Writer(void *arg)
+{
+    Pipe *pipe = (Pipe *)arg;
+    vector<pair<vector<char> *, size_t> > batch;
+    vector<vector<char> > zbuffs(PIPE_BUFS);
+    vector<uint32_t> lengths(2 * PIPE_BUFS);
+    vector<struct iovec> iov;
+
+    pthread_mutex_lock(&pipe->lock);
+    bool bGood = pipe->bGood;
+    pthread_mutex_unlock(&pipe->lock);
+
+    if (bGood && pipe->bCompress) {
+        struct iovec header;
+        header.iov_base = (void *)COMPRESS_HEADER;
+        header.iov_len = sizeof(COMPRESS_HEADER) - 1;
+        bGood = WriteAll(pipe->fd, &header, 1);
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    for (;;) {
+        while (pipe->full.empty() && !pipe->bStop) {
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        }
+        if (pipe->full.empty()) {
+            break;
+        }
+
+        batch.assign(pipe->full.begin(), pipe->full.end());
+        pipe->full.clear();
+        pipe->busy = batch.size();
+        pthread_mutex_unlock(&pipe->lock);
 
-        for (it = fmt.begin(); it != fmt.end(); ++it) {
-            if (it != fmt.begin()) {
-                cout << ",";
+        // After a failure keep discarding, like an inline OutBuf
+        iov.clear();
+        for (size_t cc = 0; bGood && cc < batch.size(); cc++) {
+            char *data = &(*batch[cc].first)[0];
+            size_t len = batch[cc].second;
+            if (!pipe->bCompress) {
+                struct iovec vec = { data, len };
+                iov.push_back(vec);
+                continue;
             }
 
-            // Gets the size of actual data printed
-            size_t written = (*it)(data, sz);
+            // Blocks that do not shrink are stored as they are
+            vector<char> &zbuff = zbuffs[cc];
+            zbuff.resize(COMPRESS_BOUND(len));
+            size_t zlen = CompressBlock(data, len, &zbuff[0]);
+            if (zlen >= len) {
+                zlen = len;
+            } else {
+                data = &zbuff[0];
+            }
 
-            // Offset the data to advance to the next member
-            data = (char *)data + written;
-            sz -= written;
+            uint32_t *header = &lengths[2 * cc];
+            header[0] = len;
+            header[1] = zlen;
+            struct iovec vec[2] = {
+                { header, 2 * sizeof(uint32_t) }, { data, zlen }
+            };
+            iov.insert(iov.end(), vec, vec + 2);
+        }
+        if (bGood && !iov.empty()) {
+            bGood = WriteAll(pipe->fd, &iov[0], iov.size());
         }
 
-        return;
+        pthread_mutex_lock(&pipe->lock);
+        pipe->bGood = pipe->bGood && bGood;
+        for (size_t cc = 0; cc < batch.size(); cc++) {
+            pipe->free.push_back(batch[cc].first);
+        }
+        pipe->busy = 0;
+        pthread_cond_broadcast(&pipe->cond);
     }
-};
+    pipe->bGood = pipe->bGood && bGood;
+    pthread_mutex_unlock(&pipe->lock);
+
+    return pipe;
+}
+
+//-----------------------------------------------------------------------------
+// PrintDataByType
+//  Print one field of the given type, returns the number of bytes consumed.
+//  Fields need not be aligned, a truncated field is zero padded.
+//-----------------------------------------------------------------------------
+template <typename T>
+inline size_t PrintDataByType(OutBuf &out, const char *data, size_t remaining) {
+    T v = 0;
+    size_t sz = (remaining > sizeof(T)) ? sizeof(T) : remaining;
+    memcpy(&v, data, sz);
+    out << v;
+    return sz;
+}
+
+//-----------------------------------------------------------------------------
+// PrintDataByType<char *>
+//  Specialize for string printing
+//-----------------------------------------------------------------------------
+template <>
+inline size_t PrintDataByType<char *>(OutBuf &out, const char *data,
+                                      size_t remaining) {
+    const char *end = (const char *)memchr(data, '\0', remaining);
+    size_t len = end ? (size_t)(end - data) : remaining;
+    out.Write(data, len);
+    return end ? len + 1 : len;
+}
 
 //-----------------------------------------------------------------------------
-// Specialize for vector type
+// EncodeHex
+//  Two lower case hex digits per byte, 'dst' must hold 2 * len bytes.
+//  Vectorized with AVX2 or SSE2 when the compiler targets them.
 //-----------------------------------------------------------------------------
-template<>
-void PrintData<Dbt>::operator() (Dbt &obj)
+#if defined(__SSE2__)
+// Nibbles to ASCII: '0' + n, plus 'a' - '0' - 10 for n > 9
+static inline __m128i
+NibblesToHex(__m128i n)
 {
-    // Print the output header
-    if (_bFirst) {
-        cout << "#value" << endl;
-    }
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                                  _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), alpha);
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i
+NibblesToHex256(__m256i n)
+{
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(n,
+                                                       _mm256_set1_epi8(9)),
+                                     _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), alpha);
+}
+#endif
+
+static void
+EncodeHex(char *dst, const unsigned char *src, size_t len)
+{
+    static const char xdigits[] = "0123456789abcdef";
+
+#if defined(__AVX2__)
+    const __m256i mask256 = _mm256_set1_epi8(0x0f);
+    for (; len >= 32; len -= 32, src += 32, dst += 64) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)src);
+        __m256i hi = NibblesToHex256(_mm256_and_si256(_mm256_srli_epi16(v, 4),
+                                                      mask256));
+        __m256i lo = NibblesToHex256(_mm256_and_si256(v, mask256));
+
+        // Interleaving works within 128 bit lanes, put the lanes in order
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)dst,
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 32),
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for (; len >= 16; len -= 16, src += 16, dst += 32) {
+        __m128i v = _mm_loadu_si128((const __m128i *)src);
+        __m128i hi = NibblesToHex(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = NibblesToHex(_mm_and_si128(v, mask));
+
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+
+    for (; len; len--, src++) {
+        *dst++ = xdigits[*src >> 4];
+        *dst++ = xdigits[*src & 0x0f];
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// PrintDataByType<hex_t>
+//   Specialized for hex printing, fixed width so it can be parsed back
+//-----------------------------------------------------------------------------
+template <>
+inline size_t PrintDataByType<hex_t>(OutBuf &out, const char *data,
+                                     size_t remaining) {
+    static const size_t CHUNK = 4096;
+
+    // Encode straight into the output buffer
+    for (size_t done = 0; done < remaining; done += CHUNK) {
+        size_t len = min(CHUNK, remaining - done);
+        char *pos = out.Reserve(2 * len);
+        EncodeHex(pos, (const unsigned char *)data + done, len);
+        out.Commit(pos + 2 * len);
+    }
+
+    return remaining;
+}
+
+//-----------------------------------------------------------------------------
+// PrintNothing
+//  Placeholder for an unused field of a Layout
+//-----------------------------------------------------------------------------
+inline size_t PrintNothing(OutBuf &, const char *, size_t) {
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// IsPrintable
+//  True for a NUL terminated string of printable characters
+//-----------------------------------------------------------------------------
+static bool
+IsPrintable(const char *ptr, size_t sz) {
+    if (0 == sz || '\0' != ptr[--sz]) {
+        return false;
+    }
+
+    for (size_t cc = 0; cc < sz; cc++) {
+        if (!isprint(ptr[cc])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// InferFormat
+//  Guess a format for data that has none configured
+//-----------------------------------------------------------------------------
+static string
+InferFormat(const char *data, size_t sz) {
+    string opt;
+
+    if (IsPrintable(data, sz)) {
+        opt = "s";
+    } else {
+        // We know it is long but the size of long on 32b is 4
+        // and on 64b is 8. Attempting to print the right long type
+        if (sz == sizeof(int32_t)) {
+            opt = "i32";
+        } else if (sz == sizeof(int64_t)) {
+            opt = "i64";
+        } else {
+            // Fallback on printing it as a bunch of int64_t types
+            opt = "i64";
+            for (size_t cc = 1; cc < sz/sizeof(int64_t); cc++) {
+                opt += ":i64";
+            }
+        }
+    }
+
+    return opt;
+}
+
+//-----------------------------------------------------------------------------
+// FormatRegistry
+//  Formats of the DB files by name, and the named layouts that formats use
+//  as '@name'. The built in formats come first, schema files add to them
+//  or override them. Each line of a schema file is one of
+//      layout <name> <format>
+//      <db file name or shell pattern> <key format|-> <value format|->
+//  with '#' starting a comment. Names match in any case, patterns are
+//  tried in the order given when no name matches.
+//-----------------------------------------------------------------------------
+class FormatRegistry {
+public:
+    static FormatRegistry &Get();
+
+    // Read a schema file and check its formats, false with a message
+    bool Load(const string &file);
+
+    // Formats of a DB file, false if it has none
+    bool Find(const string &dbfile, string &keyfmt, string &valfmt) const;
+
+    // Replace the '@name' fields of a format with their layouts, false
+    // with a message for unknown layouts
+    bool Expand(const string &fmt, string &expanded, string &err) const;
+
+private:
+    typedef tr1::tuple<string, string> format;
+
+    // DB file line of a schema file
+    struct Entry {
+        size_t line;
+        string name;
+        format fmts;
+    };
+
+    FormatRegistry();
+
+    bool Expand(const string &fmt, int depth, string &expanded,
+                string &err) const;
+
+    tr1::unordered_map<string, format> _files;
+    vector<pair<string, format> > _patterns;
+    tr1::unordered_map<string, string> _layouts;
+};
+
+//-----------------------------------------------------------------------------
+// FormatPlan
+//  A key or value format compiled once into typed fields with their widths
+//  and, up to the first variable length field, their offsets.
+//
+//  Besides the plain types, for the layouts of schema files, fields may be
+//      i32be, u64le...  a number in big or little endian
+//      sN, hexN         a string, NUL padded, or bytes, of N bytes
+//      s/W, hex/W       a string or bytes after a W byte length, W being
+//                       1, 2, 4 or 8 with be or le for its byte order
+//      T*N              N elements of a fixed size type T
+//      T*/W             elements after a W byte count
+//      T*               elements up to the end of the record
+//      padN, alignN     skip N bytes, or up to a multiple of N from the
+//                       start of the record, before the next field
+//      @name            the fields of a layout
+//  Elements of a repeated field print space separated. Plain fields keep
+//  their own fast path, so extended ones cost nothing to formats without.
+//-----------------------------------------------------------------------------
+enum FieldType {
+    F_CHAR,
+    F_STR,
+    F_I32,
+    F_U32,
+    F_I64,
+    F_U64,
+    F_HEX
+};
+
+enum FieldRepeat {
+    R_NONE,
+    R_FIXED,                    // Count given in the format
+    R_COUNTED,                  // Count stored before the elements
+    R_REST                      // Up to the end of the record
+};
+
+struct FieldPlan {
+    FieldType type;             // Of each element when repeated
+    size_t width;               // Size in bytes, 0 if variable length
+    size_t offset;              // Offset in the record, valid if bFixed
+    bool bFixed;
+
+    // Extended fields, all that follows is only used if not bPlain
+    bool bPlain;
+    bool bSwap;                 // Numbers not in host order
+    size_t elem;                // Bytes of sN/hexN or of each element
+    size_t lenWidth;            // Bytes of the length or count, 0 if none
+    bool bLenSwap;
+    FieldRepeat repeat;
+    size_t count;               // Elements of R_FIXED
+    size_t pad;                 // Bytes skipped before the field
+    size_t align;               // Start on a multiple of it, 0 if none
+};
+
+class FormatPlan {
+public:
+    FormatPlan() : _bPlain(true), _trailPad(0), _trailAlign(0) {}
+    explicit FormatPlan(const string &fmt) { Compile(fmt); }
+
+    // Parse a ':' separated format, exits on unknown field types
+    void Compile(const string &fmt);
+
+    // Same, but false with a message on errors
+    bool TryCompile(const string &fmt, string &err);
+
+    // Print all fields of a record. Without a format, one is guessed from
+    // the first record and used for all that follow.
+    void Print(OutBuf &out, const char *data, size_t sz);
+
+    // Turn ',' separated text, as printed, back into record bytes. Leading
+    // fields may be given alone. With bPrefix the last string is left
+    // open so that the result matches every string it starts.
+    bool Encode(const string &text, string &data, bool bPrefix) const;
+
+    // Find the bytes of field 'idx' in a record without printing it. The
+    // length of a string excludes its NUL. False if the record is short.
+    bool Locate(const char *data, size_t sz, size_t idx,
+                size_t &off, size_t &len) const;
+
+    // Format printing the bytes Locate finds for field 'idx'
+    string ValueFormat(size_t idx) const;
+
+    static const char *TypeName(FieldType type);
+
+    bool Empty() const { return _fields.empty(); }
+    bool Plain() const { return _bPlain; }
+    size_t Size() const { return _fields.size(); }
+    const FieldPlan &operator[](size_t idx) const { return _fields[idx]; }
+    const string &Format() const { return _fmt; }
+
+private:
+    string _fmt;
+    vector<FieldPlan> _fields;
+    bool _bPlain;               // No extended field
+    size_t _trailPad;           // Skipped after the last field
+    size_t _trailAlign;
+};
+
+static const bool s_bLittleEndian = (__BYTE_ORDER == __LITTLE_ENDIAN);
+
+// Digits at 'pos' of 'tok', 'pos' moves past them. False if there are none.
+static bool
+ParseCount(const string &tok, size_t &pos, size_t &count)
+{
+    size_t start = pos;
+    count = 0;
+    while (pos < tok.size() && isdigit(tok[pos])) {
+        count = count * 10 + (tok[pos++] - '0');
+        if (count > UINT32_MAX) {
+            return false;
+        }
+    }
+
+    return pos > start;
+}
+
+// Byte order suffix of a number: none, "be" or "le"
+static bool
+ParseByteOrder(const string &suffix, bool &bSwap)
+{
+    if (suffix.empty()) {
+        bSwap = false;
+    } else if ("be" == suffix) {
+        bSwap = s_bLittleEndian;
+    } else if ("le" == suffix) {
+        bSwap = !s_bLittleEndian;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Width and byte order of a length or count: "2", "4be"...
+static bool
+ParseLength(const string &spec, size_t &width, bool &bSwap)
+{
+    size_t pos = 0;
+    if (!ParseCount(spec, pos, width)) {
+        return false;
+    }
+    if (1 != width && 2 != width && 4 != width && 8 != width) {
+        return false;
+    }
+
+    return ParseByteOrder(spec.substr(pos), bSwap);
+}
+
+// One field of a format, padding aside
+static bool
+ParseField(const string &tok, FieldPlan &field)
+{
+    static const struct {
+        const char *name;
+        FieldType type;
+        size_t width;
+    } types[] = {
+        { "c",   F_CHAR, sizeof(char) },
+        { "s",   F_STR,  0 },
+        { "i32", F_I32,  sizeof(int32_t) },
+        { "u32", F_U32,  sizeof(uint32_t) },
+        { "i64", F_I64,  sizeof(int64_t) },
+        { "u64", F_U64,  sizeof(uint64_t) },
+        { "hex", F_HEX,  0 },
+    };
+
+    field.repeat = R_NONE;
+    field.count = 0;
+    field.lenWidth = 0;
+    field.bLenSwap = false;
+    field.bSwap = false;
+    field.pad = 0;
+    field.align = 0;
+
+    // Repetition after a '*'
+    size_t star = tok.find('*');
+    if (string::npos != star) {
+        string rep = tok.substr(star + 1);
+        size_t pos = 0;
+        if (rep.empty()) {
+            field.repeat = R_REST;
+        } else if ('/' == rep[0]) {
+            field.repeat = R_COUNTED;
+            if (!ParseLength(rep.substr(1), field.lenWidth,
+                             field.bLenSwap)) {
+                return false;
+            }
+        } else if (ParseCount(rep, pos, field.count) &&
+                   pos == rep.size() && field.count) {
+            field.repeat = R_FIXED;
+        } else {
+            return false;
+        }
+    }
+
+    // Length before a string or bytes
+    string base = tok.substr(0, star);
+    size_t slash = base.find('/');
+    if (string::npos != slash) {
+        if (R_NONE != field.repeat ||
+            !ParseLength(base.substr(slash + 1), field.lenWidth,
+                         field.bLenSwap)) {
+            return false;
+        }
+    }
+
+    string name = base.substr(0, slash);
+    size_t cc = 0, len = 0;
+    for (; cc < sizeof(types)/sizeof(types[0]); cc++) {
+        len = strlen(types[cc].name);
+        if (0 == name.compare(0, len, types[cc].name)) {
+            break;
+        }
+    }
+    if (cc == sizeof(types)/sizeof(types[0])) {
+        return false;
+    }
+
+    field.type = types[cc].type;
+    field.elem = types[cc].width;
+    string suffix = name.substr(len);
+    size_t pos = 0;
+    switch (field.type) {
+        case F_CHAR:
+            if (!suffix.empty()) {
+                return false;
+            }
+            break;
+        case F_STR:
+        case F_HEX:
+            if (!suffix.empty() &&
+                (!ParseCount(suffix, pos, field.elem) ||
+                 pos != suffix.size() || !field.elem ||
+                 string::npos != slash)) {
+                return false;
+            }
+            break;
+        default:
+            if (!ParseByteOrder(suffix, field.bSwap)) {
+                return false;
+            }
+            break;
+    }
+
+    // Repeated elements need a size
+    if (R_NONE != field.repeat && !field.elem) {
+        return false;
+    }
+
+    // Numbers in host order given as "u32le" are plain too
+    field.bPlain = (R_NONE == field.repeat && !field.lenWidth &&
+                    !field.bSwap && field.elem == types[cc].width);
+
+    if (R_FIXED == field.repeat) {
+        field.width = field.count * field.elem;
+    } else if (R_NONE == field.repeat && !field.lenWidth) {
+        field.width = field.elem;
+    } else {
+        field.width = 0;
+    }
+
+    return true;
+}
+
+// Length or count before an extended field
+static uint64_t
+LoadLength(const char *ptr, size_t width, bool bSwap)
+{
+    switch (width) {
+        case 1:
+            return (uint8_t)*ptr;
+        case 2: {
+            uint16_t v;
+            memcpy(&v, ptr, sizeof(v));
+            return bSwap ? bswap_16(v) : v;
+        }
+        case 4: {
+            uint32_t v;
+            memcpy(&v, ptr, sizeof(v));
+            return bSwap ? bswap_32(v) : v;
+        }
+        default: {
+            uint64_t v;
+            memcpy(&v, ptr, sizeof(v));
+            return bSwap ? bswap_64(v) : v;
+        }
+    }
+}
+
+// Append a length or count, false if it does not fit in 'width' bytes
+static bool
+StoreLength(string &data, uint64_t len, size_t width, bool bSwap)
+{
+    if (width < sizeof(len) && len >> (8 * width)) {
+        return false;
+    }
+
+    char bytes[sizeof(len)];
+    for (size_t cc = 0; cc < width; cc++) {
+        // Little endian, unless swapped on a little endian host
+        size_t shift = (s_bLittleEndian != bSwap) ? cc : width - 1 - cc;
+        bytes[cc] = (char)(len >> (8 * shift));
+    }
+    data.append(bytes, width);
+
+    return true;
+}
+
+// Bytes of an extended field read from 'pos': its value at 'off', 'len'
+// long, and the start of the next field. False if the record is short.
+static bool
+FieldSpan(const FieldPlan &field, const char *data, size_t sz, size_t pos,
+          size_t &off, size_t &len, size_t &next)
+{
+    if (field.bFixed) {
+        pos = field.offset;
+    } else {
+        pos += field.pad;
+        if (field.align) {
+            pos = (pos + field.align - 1) / field.align * field.align;
+        }
+    }
+    if (pos > sz) {
+        return false;
+    }
+
+    size_t remaining = sz - pos;
+    uint64_t prefix = 0;
+    if (field.lenWidth) {
+        if (field.lenWidth > remaining) {
+            return false;
+        }
+        prefix = LoadLength(data + pos, field.lenWidth, field.bLenSwap);
+        pos += field.lenWidth;
+        remaining -= field.lenWidth;
+    }
+
+    switch (field.repeat) {
+        case R_NONE:
+            if (field.lenWidth) {
+                if (prefix > remaining) {
+                    return false;
+                }
+                len = prefix;
+            } else {
+                len = field.elem ? field.elem : remaining;
+            }
+            break;
+        case R_FIXED:
+            len = field.width;
+            break;
+        case R_COUNTED:
+            if (prefix > remaining / field.elem) {
+                return false;
+            }
+            len = prefix * field.elem;
+            break;
+        case R_REST:
+            len = remaining - remaining % field.elem;
+            break;
+    }
+    if (len > remaining) {
+        return false;
+    }
+    off = pos;
+    next = pos + len;
+
+    // Strings end at their first NUL, which a variable one uses up
+    if (F_STR == field.type && R_NONE == field.repeat) {
+        const char *end = (const char *)memchr(data + pos, '\0', len);
+        if (end) {
+            len = end - (data + pos);
+            if (!field.elem && !field.lenWidth) {
+                next = pos + len + 1;
+            }
+        }
+    }
+
+    return true;
+}
+
+// One value or element of an extended field
+static void
+PrintElement(OutBuf &out, const FieldPlan &field, const char *ptr,
+             size_t len)
+{
+    switch (field.type) {
+        case F_CHAR:
+            PrintDataByType<char>(out, ptr, len);
+            break;
+        case F_STR:
+            PrintDataByType<char *>(out, ptr, len);
+            break;
+        case F_HEX:
+            PrintDataByType<hex_t>(out, ptr, len);
+            break;
+        case F_I32: {
+            uint32_t v;
+            memcpy(&v, ptr, sizeof(v));
+            out << (int32_t)(field.bSwap ? bswap_32(v) : v);
+            break;
+        }
+        case F_U32: {
+            uint32_t v;
+            memcpy(&v, ptr, sizeof(v));
+            out << (uint32_t)(field.bSwap ? bswap_32(v) : v);
+            break;
+        }
+        case F_I64: {
+            uint64_t v;
+            memcpy(&v, ptr, sizeof(v));
+            out << (int64_t)(field.bSwap ? bswap_64(v) : v);
+            break;
+        }
+        case F_U64: {
+            uint64_t v;
+            memcpy(&v, ptr, sizeof(v));
+            out << (uint64_t)(field.bSwap ? bswap_64(v) : v);
+            break;
+        }
+    }
+}
+
+// Print an extended field read from 'pos', returns where the next starts.
+// Fields missing from a short record print empty.
+static size_t
+PrintField(OutBuf &out, const FieldPlan &field, const char *data, size_t sz,
+           size_t pos)
+{
+    size_t off, len, next;
+    if (!FieldSpan(field, data, sz, pos, off, len, next)) {
+        return sz;
+    }
+
+    if (R_NONE == field.repeat) {
+        PrintElement(out, field, data + off, len);
+        return next;
+    }
+
+    for (size_t cc = 0; cc < len; cc += field.elem) {
+        if (cc) {
+            out << ' ';
+        }
+        PrintElement(out, field, data + off + cc, field.elem);
+    }
+
+    return next;
+}
+
+// One value of a plain type, as printed, appended to 'data'. With bOpen a
+// string is left without its NUL.
+static bool
+EncodeValue(FieldType type, const string &tok, string &data, bool bOpen)
+{
+    char *tail = NULL;
+
+    errno = 0;
+    switch (type) {
+        case F_CHAR:
+            if (1 != tok.size()) {
+                return false;
+            }
+            data += tok[0];
+            break;
+        case F_STR:
+            data += tok;
+            if (!bOpen) {
+                data += '\0';
+            }
+            break;
+        case F_I32: {
+            long long v = strtoll(tok.c_str(), &tail, 0);
+            int32_t v32 = (int32_t)v;
+            if (v != v32) {
+                return false;
+            }
+            data.append((char *)&v32, sizeof(v32));
+            break;
+        }
+        case F_U32: {
+            unsigned long long v = strtoull(tok.c_str(), &tail, 0);
+            uint32_t v32 = (uint32_t)v;
+            if (v != v32) {
+                return false;
+            }
+            data.append((char *)&v32, sizeof(v32));
+            break;
+        }
+        case F_I64: {
+            int64_t v = strtoll(tok.c_str(), &tail, 0);
+            data.append((char *)&v, sizeof(v));
+            break;
+        }
+        case F_U64: {
+            uint64_t v = strtoull(tok.c_str(), &tail, 0);
+            data.append((char *)&v, sizeof(v));
+            break;
+        }
+        case F_HEX:
+            if (tok.size() % 2) {
+                return false;
+            }
+            for (size_t cx = 0; cx < tok.size(); cx += 2) {
+                string digits = tok.substr(cx, 2);
+                char *dend = NULL;
+                long v = strtol(digits.c_str(), &dend, 16);
+                if (*dend || !isxdigit(digits[0])) {
+                    return false;
+                }
+                data += (char)v;
+            }
+            break;
+    }
+
+    // Numbers must use up the whole field
+    return !(tail && (tail == tok.c_str() || *tail || errno));
+}
+
+// One value or element of an extended field
+static bool
+EncodeElement(const FieldPlan &field, const string &tok, string &data,
+              bool bOpen)
+{
+    size_t start = data.size();
+
+    switch (field.type) {
+        case F_STR:
+            // Strings after a length have no NUL, fixed size ones are NUL
+            // padded
+            if (field.lenWidth && R_NONE == field.repeat) {
+                data += tok;
+                return true;
+            }
+            if (!field.elem) {
+                return EncodeValue(F_STR, tok, data, bOpen);
+            }
+            if (tok.size() > field.elem) {
+                return false;
+            }
+            data += tok;
+            if (!bOpen) {
+                data.append(field.elem - tok.size(), '\0');
+            }
+            return true;
+        case F_HEX: {
+            if (!EncodeValue(F_HEX, tok, data, false)) {
+                return false;
+            }
+            size_t len = data.size() - start;
+            return !field.elem || field.elem == len ||
+                (bOpen && len < field.elem);
+        }
+        default:
+            if (!EncodeValue(field.type, tok, data, false)) {
+                return false;
+            }
+            if (field.bSwap) {
+                reverse(data.begin() + start, data.end());
+            }
+            return true;
+    }
+}
+
+// Zeros up to a multiple of 'align' of the record
+static void
+AppendAlign(string &data, size_t align)
+{
+    if (align) {
+        data.append((align - data.size() % align) % align, '\0');
+    }
+}
+
+// An extended field, as printed, appended to 'data'
+static bool
+EncodeField(const FieldPlan &field, const string &tok, string &data,
+            bool bOpen)
+{
+    data.append(field.pad, '\0');
+    AppendAlign(data, field.align);
+
+    // A value after its length cannot be left open
+    string value;
+    uint64_t count = 0;
+    if (R_NONE == field.repeat) {
+        if (!EncodeElement(field, tok, value, bOpen && !field.lenWidth)) {
+            return false;
+        }
+        count = value.size();
+    } else {
+        for (size_t pos = 0; pos < tok.size(); count++) {
+            size_t end = tok.find(' ', pos);
+            if (string::npos == end) {
+                end = tok.size();
+            }
+            if (!EncodeElement(field, tok.substr(pos, end - pos), value,
+                               false)) {
+                return false;
+            }
+            pos = end + 1;
+        }
+        if (R_FIXED == field.repeat && count != field.count) {
+            return false;
+        }
+    }
+
+    if (field.lenWidth &&
+        !StoreLength(data, count, field.lenWidth, field.bLenSwap)) {
+        return false;
+    }
+    data += value;
+
+    return true;
+}
+
+const char *
+FormatPlan::TypeName(FieldType type)
+{
+    // In FieldType order
+    static const char *names[] = { "c", "s", "i32", "u32", "i64", "u64",
+                                   "hex" };
+
+    return names[type];
+}
+
+void
+FormatPlan::Compile(const string &fmt)
+{
+    string err;
+    if (!TryCompile(fmt, err)) {
+        cerr << "Error: " << err << endl;
+        usage(-1);
+    }
+
+    return;
+}
+
+bool
+FormatPlan::TryCompile(const string &fmt, string &err)
+{
+    _fmt = fmt;
+    _fields.clear();
+    _bPlain = true;
+    _trailPad = 0;
+    _trailAlign = 0;
+
+    string expanded;
+    if (!FormatRegistry::Get().Expand(fmt, expanded, err)) {
+        return false;
+    }
+
+    size_t offset = 0;
+    bool bFixed = true;
+    size_t pad = 0, align = 0;
+    size_t pos = 0;
+    while (pos < expanded.size()) {
+        size_t end = expanded.find(':', pos);
+        if (string::npos == end) {
+            end = expanded.size();
+        }
+
+        string tok = expanded.substr(pos, end - pos);
+        pos = end + 1;
+        if (tok.empty()) {
+            continue;
+        }
+
+        // Skipped bytes go with the field that follows
+        size_t cpos = 0, count = 0;
+        if (0 == tok.compare(0, 3, "pad")) {
+            cpos = 3;
+            if (ParseCount(tok, cpos, count) && cpos == tok.size() &&
+                !align) {
+                pad += count;
+                continue;
+            }
+        } else if (0 == tok.compare(0, 5, "align")) {
+            cpos = 5;
+            if (ParseCount(tok, cpos, count) && cpos == tok.size() &&
+                count && !align) {
+                align = count;
+                continue;
+            }
+        }
+
+        FieldPlan field;
+        if (cpos || !ParseField(tok, field)) {
+            _fields.clear();
+            err = "Unrecognized format \"" + tok + "\"";
+            return false;
+        }
+
+        field.pad = pad;
+        field.align = align;
+        field.bPlain = field.bPlain && !pad && !align;
+        pad = align = 0;
+
+        // Skipped bytes before a field at a known offset are known too
+        offset += field.pad;
+        if (field.align) {
+            offset = (offset + field.align - 1) / field.align * field.align;
+        }
+        field.offset = offset;
+        field.bFixed = bFixed;
+        _fields.push_back(field);
+        _bPlain = _bPlain && field.bPlain;
+
+        // Offsets past a variable length field depend on the record
+        bFixed = bFixed && field.width;
+        offset += field.width;
+    }
+
+    _trailPad = pad;
+    _trailAlign = align;
+
+    return true;
+}
+
+void
+FormatPlan::Print(OutBuf &out, const char *data, size_t sz)
+{
+    // Should happen only for Attribute Db
+    if (_fields.empty()) {
+        Compile(InferFormat(data, sz));
+    }
+
+    size_t pos = 0;
+    for (size_t cc = 0; cc < _fields.size(); cc++) {
+        const FieldPlan &field = _fields[cc];
+        if (cc) {
+            out << ',';
+        }
+
+        if (!field.bPlain) {
+            pos = PrintField(out, field, data, sz, pos);
+            continue;
+        }
+
+        if (field.bFixed) {
+            pos = min(field.offset, sz);
+        }
+
+        const char *ptr = data + pos;
+        size_t remaining = sz - pos;
+        switch (field.type) {
+            case F_CHAR:
+                pos += PrintDataByType<char>(out, ptr, remaining);
+                break;
+            case F_STR:
+                pos += PrintDataByType<char *>(out, ptr, remaining);
+                break;
+            case F_I32:
+                pos += PrintDataByType<int32_t>(out, ptr, remaining);
+                break;
+            case F_U32:
+                pos += PrintDataByType<uint32_t>(out, ptr, remaining);
+                break;
+            case F_I64:
+                pos += PrintDataByType<int64_t>(out, ptr, remaining);
+                break;
+            case F_U64:
+                pos += PrintDataByType<uint64_t>(out, ptr, remaining);
+                break;
+            case F_HEX:
+                pos += PrintDataByType<hex_t>(out, ptr, remaining);
+                break;
+        }
+    }
+
+    return;
+}
+
+bool
+FormatPlan::Encode(const string &text, string &data, bool bPrefix) const
+{
+    data.clear();
+
+    size_t pos = 0;
+    for (size_t cc = 0; cc < _fields.size(); cc++) {
+        const FieldPlan &field = _fields[cc];
+
+        // The last field takes the rest, strings may hold a ','
+        size_t end = text.find(',', pos);
+        if (string::npos == end || cc + 1 == _fields.size()) {
+            end = text.size();
+        }
+
+        string tok = text.substr(pos, end - pos);
+        bool bLast = (end == text.size());
+        bool bOpen = bPrefix && bLast;
+        if (field.bPlain ? !EncodeValue(field.type, tok, data, bOpen)
+                         : !EncodeField(field, tok, data, bOpen)) {
+            return false;
+        }
+
+        if (bLast) {
+            // Padding of a whole record
+            if (cc + 1 == _fields.size() && !bPrefix) {
+                data.append(_trailPad, '\0');
+                AppendAlign(data, _trailAlign);
+            }
+            return true;
+        }
+        pos = end + 1;
+    }
+
+    // More fields than in the format
+    return false;
+}
+
+bool
+FormatPlan::Locate(const char *data, size_t sz, size_t idx,
+                   size_t &off, size_t &len) const
+{
+    if (idx >= _fields.size()) {
+        return false;
+    }
+
+    // Walk from the closest field with a known offset
+    size_t cc = idx;
+    while (!_fields[cc].bFixed) {
+        cc--;
+    }
+
+    size_t pos = _fields[cc].offset;
+    for (; pos <= sz; cc++) {
+        const FieldPlan &field = _fields[cc];
+        const char *ptr = data + pos;
+        size_t remaining = sz - pos;
+
+        if (!field.bPlain) {
+            size_t next;
+            if (!FieldSpan(field, data, sz, pos, off, len, next)) {
+                return false;
+            }
+            if (cc == idx) {
+                return true;
+            }
+            pos = next;
+            continue;
+        }
+
+        if (field.width) {
+            len = field.width;
+            if (len > remaining) {
+                return false;
+            }
+        } else if (F_STR == field.type) {
+            const char *end = (const char *)memchr(ptr, '\0', remaining);
+            len = end ? (size_t)(end - ptr) : remaining;
+        } else {
+            len = remaining;
+        }
+
+        if (cc == idx) {
+            off = pos;
+            return true;
+        }
+
+        pos += (F_STR == field.type && len < remaining) ? len + 1 : len;
+    }
+
+    return false;
+}
+
+string
+FormatPlan::ValueFormat(size_t idx) const
+{
+    const FieldPlan &field = _fields[idx];
+    string fmt = TypeName(field.type);
+
+    if (field.bSwap) {
+        fmt += s_bLittleEndian ? "be" : "le";
+    }
+
+    if (R_NONE != field.repeat) {
+        if (F_STR == field.type || F_HEX == field.type) {
+            char size[32];
+            snprintf(size, sizeof(size), "%u", (unsigned)field.elem);
+            fmt += size;
+        }
+        fmt += '*';
+    }
+
+    return fmt;
+}
+
+//-----------------------------------------------------------------------------
+// Layout
+//  Decoder for a format fixed at compile time (up to two fields), used for
+//  the well known DB files so that their hot loop makes no indirect calls
+//-----------------------------------------------------------------------------
+template <f_PrintDataByType F1, f_PrintDataByType F2 = PrintNothing>
+class Layout {
+public:
+    explicit Layout(const string &) {}
+
+    void Print(OutBuf &out, const char *data, size_t sz) {
+        size_t used = F1(out, data, sz);
+        if (F2 != PrintNothing) {
+            out << ',';
+            F2(out, data + used, sz - used);
+        }
+    }
+};
+
+typedef Layout< PrintDataByType<char *> > LayoutStr;
+typedef Layout< PrintDataByType<hex_t> > LayoutHex;
+typedef Layout< PrintDataByType<uint64_t> > LayoutU64;
+typedef Layout< PrintDataByType<uint32_t>,
+                PrintDataByType<int32_t> > LayoutU32I32;
+
+//-----------------------------------------------------------------------------
+// Generic printer class
+//  K and V decode the key and value, a FormatPlan unless the format has a
+//  fused Layout
+//-----------------------------------------------------------------------------
+template<typename T, typename K = FormatPlan, typename V = FormatPlan>
+class PrintData {
+public:
+    // For vector types: queue and recno
+    PrintData(string &valFmt, OutBuf &out, bool bHeader = true)
+        : _out(out), _keyFmt(string()), _valFmt(valFmt) {
+        _bFirst = true;
+        _bHeader = bHeader;
+    }
+
+    // For associated types: map or multi-map
+    PrintData(string &keyFmt, string &valFmt,
+              OutBuf &out, bool bHeader = true)
+        : _out(out), _keyFmt(keyFmt), _valFmt(valFmt) {
+        _bFirst = true;
+        _bHeader = bHeader;
+    }
+
+    // Functor to enable being called from stl algorithm
+    void operator() (T &obj) {
+        Print(obj);
+
+        // Do this at the end so that all code that depends on this
+        // flag gets a chance to see the correct state
+        if (_bFirst) {
+            _bFirst = false;
+        }
+
+        return;
+    }
+
+private:
+    bool _bFirst;
+    bool _bHeader;              // Emit the "#key:value" header line
+    OutBuf &_out;
+    K _keyFmt;
+    V _valFmt;
+
+    // Vector type
+    void Print(Dbt &obj) {
+        // Print the output header
+        if (_bFirst && _bHeader) {
+            _out << "#value\n";
+        }
+
+        _valFmt.Print(_out, (const char *)obj.get_data(), obj.get_size());
+        _out << '\n';
+    }
+
+    // Associated array types: key/value pairs
+    void Print(mds_rec_t &obj) {
+        // Print the output header
+        if (_bFirst && _bHeader) {
+            _out << "#key:value\n";
+        }
+
+        _keyFmt.Print(_out, (const char *)obj.first.get_data(),
+                      obj.first.get_size());
+        _out << ':';
+        _valFmt.Print(_out, (const char *)obj.second.get_data(),
+                      obj.second.get_size());
+        _out << '\n';
+    }
+};
+
+//-----------------------------------------------------------------------------
+// is_alive: Callback function for recovery FAILCHK
+// TODO: Figure out if we need to do a DB_FAILCHK in a stand alone tool
+//-----------------------------------------------------------------------------
+static int
+is_alive(DbEnv *envp, pid_t pid, db_threadid_t tid, uint32_t flags)
+{
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// makelower
+//  Helper function used to downcase a string
+//-----------------------------------------------------------------------------
+void
+downcase(char &a)
+{
+    a = tolower(a);
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// FormatRegistry
+//-----------------------------------------------------------------------------
+FormatRegistry &
+FormatRegistry::Get()
+{
+    static FormatRegistry registry;
+    return registry;
+}
+
+FormatRegistry::FormatRegistry()
+{
+    // Built in formats of the product DB files, all keys in lower case.
+    // Others go in a schema file, dbgen.cc keeps a copy of these.
+    _files["attrname.db"] = format("s", "u32:i32");
+    _files["attrname_attrid.sdb"] = format("u32:i32", "s");
+    _files["oid.db"] = format("hex", "u64");
+    _files["oid_oidid.sdb"] = format("u64", "hex");
+    _files["oidid.db"] = format("u64", "u32:i32");
+}
+
+bool
+FormatRegistry::Load(const string &file)
+{
+    ifstream in(file.c_str());
+    if (!in) {
+        cerr << "Error: Unable to open schema \"" << file << "\"" << endl;
+        return false;
+    }
+
+    // DB file entries are checked once all layouts are known
+    vector<Entry> entries;
+
+    string line;
+    for (size_t lineno = 1; getline(in, line); lineno++) {
+        size_t hash = line.find('#');
+        if (string::npos != hash) {
+            line.erase(hash);
+        }
+
+        vector<string> words;
+        size_t pos = line.find_first_not_of(" \t\r");
+        while (string::npos != pos) {
+            size_t end = line.find_first_of(" \t\r", pos);
+            words.push_back(line.substr(pos, end - pos));
+            pos = line.find_first_not_of(" \t\r", end);
+        }
+
+        if (words.empty()) {
+            continue;
+        }
+        if (3 != words.size()) {
+            cerr << "Error: " << file << ":" << lineno
+                 << ": Expected a name and two formats" << endl;
+            return false;
+        }
+
+        if ("layout" == words[0]) {
+            if (string::npos != words[1].find_first_of(":@")) {
+                cerr << "Error: " << file << ":" << lineno
+                     << ": Invalid layout name \"" << words[1] << "\""
+                     << endl;
+                return false;
+            }
+            _layouts[words[1]] = words[2];
+            continue;
+        }
+
+        Entry entry;
+        entry.line = lineno;
+        entry.name = words[0];
+        for_each(entry.name.begin(), entry.name.end(), downcase);
+        entry.fmts = format("-" == words[1] ? string() : words[1],
+                            "-" == words[2] ? string() : words[2]);
+        entries.push_back(entry);
+    }
+
+    // Compiled once here, so that bad formats fail at startup, and stored
+    // expanded so that the fused decoders of known formats still apply
+    for (size_t cc = 0; cc < entries.size(); cc++) {
+        Entry &entry = entries[cc];
+        string *fmts[] = { &tr1::get<0>(entry.fmts),
+                           &tr1::get<1>(entry.fmts) };
+        for (size_t ii = 0; ii < 2; ii++) {
+            FormatPlan plan;
+            string err;
+            if (!plan.TryCompile(*fmts[ii], err) ||
+                !Expand(*fmts[ii], *fmts[ii], err)) {
+                cerr << "Error: " << file << ":" << entry.line << ": "
+                     << err << endl;
+                return false;
+            }
+        }
+
+        if (string::npos == entry.name.find_first_of("*?[")) {
+            _files[entry.name] = entry.fmts;
+        } else {
+            _patterns.push_back(make_pair(entry.name, entry.fmts));
+        }
+    }
+
+    // Layouts no DB file uses yet
+    for (tr1::unordered_map<string, string>::const_iterator it =
+             _layouts.begin(); it != _layouts.end(); ++it) {
+        FormatPlan plan;
+        string err;
+        if (!plan.TryCompile(it->second, err)) {
+            cerr << "Error: " << file << ": layout " << it->first << ": "
+                 << err << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+FormatRegistry::Find(const string &dbfile, string &keyfmt,
+                     string &valfmt) const
+{
+    const format *fmts = NULL;
+
+    tr1::unordered_map<string, format>::const_iterator it;
+    it = _files.find(dbfile);
+    if (_files.end() != it) {
+        fmts = &it->second;
+    }
+
+    for (size_t cc = 0; !fmts && cc < _patterns.size(); cc++) {
+        if (0 == fnmatch(_patterns[cc].first.c_str(), dbfile.c_str(), 0)) {
+            fmts = &_patterns[cc].second;
+        }
+    }
+
+    if (!fmts) {
+        return false;
+    }
+
+    keyfmt = tr1::get<0>(*fmts);
+    valfmt = tr1::get<1>(*fmts);
+
+    return true;
+}
+
+bool
+FormatRegistry::Expand(const string &fmt, string &expanded,
+                       string &err) const
+{
+    // Fast path for formats without layouts
+    if (string::npos == fmt.find('@')) {
+        expanded = fmt;
+        return true;
+    }
+
+    string result;
+    if (!Expand(fmt, 0, result, err)) {
+        return false;
+    }
+    expanded = result;
+
+    return true;
+}
+
+bool
+FormatRegistry::Expand(const string &fmt, int depth, string &expanded,
+                       string &err) const
+{
+    // Layouts may use layouts, but not themselves
+    if (depth > 16) {
+        err = "Layouts nested too deep in \"" + fmt + "\"";
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos < fmt.size()) {
+        size_t end = fmt.find(':', pos);
+        if (string::npos == end) {
+            end = fmt.size();
+        }
+
+        string tok = fmt.substr(pos, end - pos);
+        pos = end + 1;
+        if (tok.empty()) {
+            continue;
+        }
+
+        if (!expanded.empty()) {
+            expanded += ':';
+        }
+
+        if ('@' != tok[0]) {
+            expanded += tok;
+            continue;
+        }
+
+        tr1::unordered_map<string, string>::const_iterator it;
+        it = _layouts.find(tok.substr(1));
+        if (_layouts.end() == it) {
+            err = "Unknown layout \"" + tok + "\"";
+            return false;
+        }
+        if (!Expand(it->second, depth + 1, expanded, err)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// GetDefaultFormats
+//	Try to get a key/value print format, from the schema files or the
+//	built in ones
+//-----------------------------------------------------------------------------
+void
+GetDefaultFormats(string dbfile, string &keyfmt, string &valuefmt)
+{
+    for_each(dbfile.begin(), dbfile.end(), downcase);
+
+    string key, value;
+    if (!FormatRegistry::Get().Find(dbfile, key, value)) {
+        return;
+    }
+
+    if (keyfmt.empty()) {
+        keyfmt = key;
+    }
+
+    if (valuefmt.empty()) {
+        valuefmt = value;
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// RecordReader
+//  Source of key/value records for the dump loops
+//-----------------------------------------------------------------------------
+class RecordReader {
+public:
+    virtual ~RecordReader() {}
+
+    // Get the next record, false at the end or on error
+    virtual bool Next(Dbt &key, Dbt &val) = 0;
+
+    // Non zero if the walk stopped because of an error
+    virtual int Error() const = 0;
+};
+
+//-----------------------------------------------------------------------------
+// BulkReader
+//  Cursor that fetches pages of records into one large user buffer with
+//  DB_MULTIPLE_KEY and hands them out in place, instead of one c_get and
+//  a couple of allocations per record. With bPrefetch a reader thread
+//  fills the next buffer while the records of the current one are used.
+//-----------------------------------------------------------------------------
+class BulkReader : public RecordReader {
+public:
+    BulkReader(Db &dbh, size_t bufsz = BULK_BUFSZ, bool bPrefetch = false);
+    ~BulkReader();
+
+    // (Re)start at the first record with key >= 'key'
+    void Seek(const void *key, size_t sz);
+
+    // Get the next record, false at the end or on error. The key of
+    // RECNO and QUEUE records is the record number.
+    bool Next(Dbt &key, Dbt &val);
+
+    // Non zero if the walk stopped because of an error
+    int Error() const { return _ret; }
+
+private:
+    struct Ahead;
+    static void *Prefetch(void *arg);
+    int Get(vector<char> &buff, Dbt &bulk);
+    bool FetchAhead();
+    void StopAhead();
+
+    bool Fetch();
+
+    Dbc *_cur;
+    Ahead *_ahead;              // Reader thread, if prefetching
+    bool _recno;                // Record number based DB
+    bool _done;
+    int _ret;
+    uint32_t _flag;             // Positioning flag for the next fetch
+    Dbt _seek;
+    size_t _limit;              // Part of the buffer used by the next fetch
+    vector<char> _buff;
+    Dbt _bulk;
+    DbMultipleKeyDataIterator *_kit;
+    DbMultipleRecnoDataIterator *_rit;
+    db_recno_t _recnum;
+};
+
+//-----------------------------------------------------------------------------
+// BulkReader::Ahead
+//  Double buffering of a prefetching reader: the thread fills one buffer
+//  while the records of the other are handed out
+//-----------------------------------------------------------------------------
+struct BulkReader::Ahead {
+    struct Slot {
+        vector<char> buff;
+        Dbt bulk;
+        int ret;                // Of the fetch that filled it
+    };
+
+    explicit Ahead(size_t bufsz) : bRunning(false), bStop(false),
+                                   current(NULL) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&cond, NULL);
+        for (size_t cc = 0; cc < 2; cc++) {
+            slots[cc].buff.resize(bufsz);
+            free.push_back(&slots[cc]);
+        }
+    }
+
+    ~Ahead() {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&lock);
+    }
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Slot slots[2];
+    vector<Slot *> free;
+    deque<Slot *> full;
+    bool bRunning;
+    bool bStop;
+    Slot *current;              // Records being handed out
+    BulkReader *reader;
+    pthread_t thread;
+};
+
+BulkReader::BulkReader(Db &dbh, size_t bufsz, bool bPrefetch)
+    : _cur(NULL), _ahead(NULL), _recno(false), _done(false), _ret(0),
+      _flag(DB_FIRST), _limit(BULK_MINSZ), _buff(bPrefetch ? 0 : bufsz),
+      _kit(NULL), _rit(NULL), _recnum(0)
+{
+    DBTYPE type = DB_UNKNOWN;
+    if (0 == (_ret = dbh.get_type(&type))) {
+        _recno = (DB_RECNO == type || DB_QUEUE == type);
+        _ret = dbh.cursor(NULL, &_cur, 0);
+    }
+
+    // The seek key may be handed back by libdb, so let it manage memory
+    _seek.set_flags(DB_DBT_REALLOC);
+
+    _done = (0 != _ret);
+
+    // Buffers are those of the reader thread
+    if (bPrefetch && !_done) {
+        _ahead = new Ahead(bufsz);
+    }
+}
+
+BulkReader::~BulkReader()
+{
+    if (_ahead) {
+        StopAhead();
+        delete _ahead;
+    }
+
+    delete _kit;
+    delete _rit;
+    free(_seek.get_data());
+
+    if (_cur) {
+        _cur->close();
+    }
+}
+
+void
+BulkReader::Seek(const void *key, size_t sz)
+{
+    // The reader thread is done with the cursor once stopped
+    if (_ahead) {
+        StopAhead();
+    }
+
+    void *buff = realloc(_seek.get_data(), sz ? sz : 1);
+    memcpy(buff, key, sz);
+    _seek.set_data(buff);
+    _seek.set_size(sz);
+    _flag = DB_SET_RANGE;
+    _limit = BULK_MINSZ;
+
+    // Drop what is left of the previous position
+    delete _kit;
+    delete _rit;
+    _kit = NULL;
+    _rit = NULL;
+    _done = (NULL == _cur) || (0 != _ret);
+
+    return;
+}
+
+// Fill 'buff' from the cursor position, the next one is after it
+int
+BulkReader::Get(vector<char> &buff, Dbt &bulk)
+{
+    int ret;
+    bulk.set_data(&buff[0]);
+    bulk.set_ulen(min(_limit, buff.size()));
+    bulk.set_flags(DB_DBT_USERMEM);
+    while (DB_BUFFER_SMALL ==
+           (ret = _cur->get(&_seek, &bulk, _flag | DB_MULTIPLE_KEY))) {
+        // A single record does not fit, grow to a multiple of 1024
+        size_t sz = (bulk.get_size() + 1023) & ~(size_t)1023;
+        if (sz > buff.size()) {
+            buff.resize(max(sz, 2 * buff.size()));
+            bulk.set_data(&buff[0]);
+        }
+        _limit = max(_limit, sz);
+        bulk.set_ulen(min(_limit, buff.size()));
+    }
+
+    if (0 == ret) {
+        // The cursor now rests on the last record in the buffer
+        _flag = DB_NEXT;
+        _limit = min(2 * _limit, buff.size());
+    }
+
+    return ret;
+}
+
+bool
+BulkReader::Fetch()
+{
+    delete _kit;
+    delete _rit;
+    _kit = NULL;
+    _rit = NULL;
+
+    if (_ahead) {
+        return FetchAhead();
+    }
+
+    int ret = Get(_buff, _bulk);
+    if (0 != ret) {
+        _ret = (DB_NOTFOUND == ret) ? 0 : ret;
+        _done = true;
+        return false;
+    }
+
+    if (_recno) {
+        _rit = new DbMultipleRecnoDataIterator(_bulk);
+    } else {
+        _kit = new DbMultipleKeyDataIterator(_bulk);
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// BulkReader::Prefetch
+//  Thread routine: fill free buffers in cursor order until the end, an
+//  error or StopAhead()
+//-----------------------------------------------------------------------------
+void *
+BulkReader::Prefetch(void *arg)
+{
+    Ahead *ahead = (Ahead *)arg;
+    BulkReader *reader = ahead->reader;
+
+    for (;;) {
+        pthread_mutex_lock(&ahead->lock);
+        while (ahead->free.empty() && !ahead->bStop) {
+            pthread_cond_wait(&ahead->cond, &ahead->lock);
+        }
+        if (ahead->bStop) {
+            pthread_mutex_unlock(&ahead->lock);
+            break;
+        }
+        Ahead::Slot *slot = ahead->free.back();
+        ahead->free.pop_back();
+        pthread_mutex_unlock(&ahead->lock);
+
+        slot->ret = reader->Get(slot->buff, slot->bulk);
+
+        // The last slot carries the end or the error
+        pthread_mutex_lock(&ahead->lock);
+        ahead->full.push_back(slot);
+        pthread_cond_broadcast(&ahead->cond);
+        pthread_mutex_unlock(&ahead->lock);
+
+        if (0 != slot->ret) {
+            break;
+        }
+    }
+
+    return ahead;
+}
+
+bool
+BulkReader::FetchAhead()
+{
+    Ahead *ahead = _ahead;
+    if (!ahead->bRunning) {
+        ahead->reader = this;
+        ahead->bStop = false;
+        if (pthread_create(&ahead->thread, NULL, Prefetch, ahead)) {
+            // Read inline from now on
+            _buff.resize(ahead->slots[0].buff.size());
+            delete _ahead;
+            _ahead = NULL;
+            return Fetch();
+        }
+        ahead->bRunning = true;
+    }
+
+    pthread_mutex_lock(&ahead->lock);
+    if (ahead->current) {
+        ahead->free.push_back(ahead->current);
+        ahead->current = NULL;
+        pthread_cond_broadcast(&ahead->cond);
+    }
+    while (ahead->full.empty()) {
+        pthread_cond_wait(&ahead->cond, &ahead->lock);
+    }
+    Ahead::Slot *slot = ahead->full.front();
+    ahead->full.pop_front();
+    ahead->current = slot;
+    pthread_mutex_unlock(&ahead->lock);
+
+    if (0 != slot->ret) {
+        _ret = (DB_NOTFOUND == slot->ret) ? 0 : slot->ret;
+        _done = true;
+        StopAhead();
+        return false;
+    }
+
+    if (_recno) {
+        _rit = new DbMultipleRecnoDataIterator(slot->bulk);
+    } else {
+        _kit = new DbMultipleKeyDataIterator(slot->bulk);
+    }
+
+    return true;
+}
+
+// Stop the reader thread and take all buffers back
+void
+BulkReader::StopAhead()
+{
+    Ahead *ahead = _ahead;
+    if (!ahead->bRunning) {
+        return;
+    }
+
+    pthread_mutex_lock(&ahead->lock);
+    ahead->bStop = true;
+    pthread_cond_broadcast(&ahead->cond);
+    pthread_mutex_unlock(&ahead->lock);
+    pthread_join(ahead->thread, NULL);
+    ahead->bRunning = false;
+
+    ahead->free.clear();
+    ahead->full.clear();
+    ahead->current = NULL;
+    for (size_t cc = 0; cc < 2; cc++) {
+        ahead->free.push_back(&ahead->slots[cc]);
+    }
+
+    return;
+}
+
+bool
+BulkReader::Next(Dbt &key, Dbt &val)
+{
+    while (!_done) {
+        if (_kit && _kit->next(key, val)) {
+            return true;
+        }
+
+        if (_rit && _rit->next(_recnum, val)) {
+            key.set_data(&_recnum);
+            key.set_size(sizeof(_recnum));
+            return true;
+        }
+
+        if (!Fetch()) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// On disk layout of BTREE and HASH files, DB 4.x to 6.x. Fields are in the
+// byte order of the machine that wrote the file.
+//-----------------------------------------------------------------------------
+enum {
+    // Meta data, page 0
+    PG_META_MAGIC       = 12,
+    PG_META_VERSION     = 16,
+    PG_META_PAGESIZE    = 20,
+    PG_META_ENCRYPT     = 24,
+    PG_META_METAFLAGS   = 26,
+    PG_META_LASTPGNO    = 32,
+    PG_META_FLAGS       = 48,
+    PG_BTM_ROOT         = 88,
+    PG_HASH_MAXBUCKET   = 72,
+    PG_HASH_SPARES      = 96,       // First pages of 32 doublings of buckets
+    PG_HASH_NSPARES     = 32,
+
+    PG_BTREEMAGIC       = 0x053162,
+    PG_HASHMAGIC        = 0x061561,
+    PG_QAMMAGIC         = 0x042253,
+
+    PG_METAFLAG_CHKSUM  = 0x01,
+    PG_METAFLAG_PART    = 0x06,
+    PG_DUP              = 0x01,     // Same for BTREE and HASH
+    PG_BTM_RECNO        = 0x02,
+    PG_BTM_SUBDB        = 0x20,
+    PG_BTM_COMPRESS     = 0x80,
+    PG_HASH_SUBDB       = 0x02,
+
+    // Page header, followed by the 16 bit offsets of the items
+    PG_NEXTPGNO         = 16,
+    PG_ENTRIES          = 20,
+    PG_HFOFFSET         = 22,       // Bytes used on an overflow page
+    PG_TYPE             = 25,
+    PG_OVERHEAD         = 26,
+
+    PG_HASH_UNSORTED    = 2,
+    PG_IBTREE           = 3,
+    PG_IRECNO           = 4,
+    PG_LBTREE           = 5,
+    PG_LRECNO           = 6,
+    PG_OVERFLOW         = 7,
+    PG_LDUP             = 12,
+    PG_HASH             = 13,
+
+    // BTREE items: 16 bit length, type, data. Overflow and off page
+    // duplicate references hold a page number at 4 and a length at 8.
+    PG_B_KEYDATA        = 1,
+    PG_B_DUPLICATE      = 2,
+    PG_B_OVERFLOW       = 3,
+    PG_B_DELETE         = 0x80,
+
+    // HASH items: type, data. The length comes from the item offsets.
+    PG_H_KEYDATA        = 1,
+    PG_H_DUPLICATE      = 2,
+    PG_H_OFFPAGE        = 3,
+    PG_H_OFFDUP         = 4
+};
+
+static const size_t READAHEAD_SZ = 8 * 1024 * 1024;
+
+// Bounds of the cache of an environment sized for a batch of DBs
+static const size_t BATCH_CACHE_MIN = 32 * 1024 * 1024;
+static const size_t BATCH_CACHE_MAX = 1024 * 1024 * 1024;
+
+template <typename T>
+static inline T
+Load(const uint8_t *ptr)
+{
+    T v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+//-----------------------------------------------------------------------------
+// PageReader
+//  Reads the leaf pages of a BTREE or HASH file straight from a read only
+//  mapping in page order, without libdb, its cache or its locks. Records
+//  come out in page order rather than key order. In a file of sub
+//  databases, the one named is looked up in the master database and only
+//  its leaves are read, along the BTREE leaf chain or the HASH buckets.
+//  Files it does not know how to parse are refused at Open, for libdb to
+//  read instead.
+//-----------------------------------------------------------------------------
+class PageReader : public RecordReader {
+public:
+    PageReader();
+    ~PageReader();
+
+    // Map a DB file, false with a warning if its layout is not supported.
+    // 'dbname' picks the sub database of a file that holds several.
+    bool Open(const string &file, const string &dbname);
+
+    // Restart at the first page
+    void Rewind();
+
+    bool Next(Dbt &key, Dbt &val);
+    int Error() const { return _ret; }
+
+    // Keys may have duplicates
+    bool Dup() const { return _bDup; }
+
+private:
+    const uint8_t *At(uint32_t pgno) const {
+        return (0 == pgno || pgno > _last) ? NULL
+            : _map + (size_t)pgno * _pgsize;
+    }
+    const uint8_t *Page(uint32_t pgno);
+    void ReadAhead(uint32_t pgno);
+    uint32_t FirstLeaf(uint32_t root) const;
+    const uint8_t *FindSubDb(const string &dbname);
+    uint16_t Offset(const uint8_t *page, uint32_t idx) const {
+        return Load<uint16_t>(page + PG_OVERHEAD + idx * sizeof(uint16_t));
+    }
+    bool Fail(uint32_t pgno, const char *msg);
+    bool NextLeaf();
+    bool GetItem(const uint8_t *page, uint32_t idx, Dbt &obj,
+                 vector<char> &buff, uint32_t *dup);
+    bool GetHashItem(uint32_t idx, Dbt &obj, vector<char> &buff,
+                     uint32_t *dup);
+    bool GetOverflow(uint32_t pgno, uint32_t tlen, Dbt &obj,
+                     vector<char> &buff);
+    bool FirstDup(uint32_t pgno);
+    bool NextDup(Dbt &val);
+    bool NextHashDup(Dbt &val);
+
+    int _fd;
+    const uint8_t *_map;
+    size_t _size;
+    bool _bHash;
+    bool _bDup;
+    uint32_t _pgsize;
+    uint32_t _last;             // Last page to scan
+    vector<uint32_t> _heads;    // Leaf chains to walk, none for all pages
+    size_t _head;
+    uint32_t _walked;
+    size_t _ahead;              // End of the range given to readahead
+    int _ret;
+
+    uint32_t _pgno;             // Leaf page and item walked
+    const uint8_t *_page;
+    uint32_t _idx;
+    uint32_t _dupPgno;          // Off page duplicates of the current key
+    uint32_t _dupIdx;
+    const uint8_t *_hdup;       // On page HASH duplicates
+    const uint8_t *_hdupEnd;
+
+    Dbt _key;
+    vector<char> _keyBuf;       // Items assembled from overflow pages
+    vector<char> _valBuf;
+};
+
+PageReader::PageReader()
+    : _fd(-1), _map(NULL), _size(0), _bHash(false), _bDup(false),
+      _pgsize(0), _last(0)
+{
+    Rewind();
+}
+
+PageReader::~PageReader()
+{
+    if (_map) {
+        munmap((void *)_map, _size);
+    }
+    if (-1 != _fd) {
+        close(_fd);
+    }
+}
+
+bool
+PageReader::Open(const string &file, const string &dbname)
+{
+    const char *why = NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    uint32_t flags = 0;
+
+    if (-1 == (_fd = open(file.c_str(), O_RDONLY)) || fstat(_fd, &st)) {
+        why = "unable to open it";
+    } else if (st.st_size < 512) {
+        why = "too small for a DB file";
+    } else if (MAP_FAILED == (map = mmap(NULL, st.st_size, PROT_READ,
+                                         MAP_SHARED, _fd, 0))) {
+        why = "unable to map it";
+    }
+
+    if (!why) {
+        _map = (const uint8_t *)map;
+        _size = st.st_size;
+
+        uint32_t magic = Load<uint32_t>(_map + PG_META_MAGIC);
+        uint32_t version = Load<uint32_t>(_map + PG_META_VERSION);
+        flags = Load<uint32_t>(_map + PG_META_FLAGS);
+        uint8_t metaflags = _map[PG_META_METAFLAGS];
+        _pgsize = Load<uint32_t>(_map + PG_META_PAGESIZE);
+        _bHash = (PG_HASHMAGIC == magic);
+        _bDup = (flags & PG_DUP);
+
+        if (PG_BTREEMAGIC != magic && PG_HASHMAGIC != magic) {
+            why = (PG_BTREEMAGIC == bswap_32(magic) ||
+                   PG_HASHMAGIC == bswap_32(magic))
+                ? "written with the other byte order"
+                : "not a BTREE or HASH file";
+        } else if (version < 8 || version > 10) {
+            why = "unknown version";
+        } else if (_pgsize < 512 || _pgsize > 65536 ||
+                   (_pgsize & (_pgsize - 1)) || _pgsize > _size) {
+            why = "bad page size";
+        } else if (_map[PG_META_ENCRYPT]) {
+            why = "encrypted";
+        } else if (metaflags & PG_METAFLAG_CHKSUM) {
+            why = "pages have checksums";
+        } else if (metaflags & PG_METAFLAG_PART) {
+            why = "partitioned";
+        }
+    }
+
+    // The master database of sub databases is a BTREE
+    const uint8_t *meta = _map;
+    if (!why) {
+        _last = min((size_t)Load<uint32_t>(_map + PG_META_LASTPGNO),
+                    _size / _pgsize - 1);
+        _heads.clear();
+
+        if (_bHash && (flags & PG_HASH_SUBDB)) {
+            why = "holds sub databases";
+        } else if (!_bHash && (flags & PG_BTM_SUBDB)) {
+            meta = FindSubDb(dbname);
+            if (!meta) {
+                why = "sub database not found";
+            }
+        }
+    }
+
+    if (!why && meta != _map) {
+        uint32_t magic = Load<uint32_t>(meta + PG_META_MAGIC);
+        flags = Load<uint32_t>(meta + PG_META_FLAGS);
+        _bHash = (PG_HASHMAGIC == magic);
+        _bDup = (flags & PG_DUP);
+
+        if (PG_BTREEMAGIC != magic && PG_HASHMAGIC != magic) {
+            why = "bad sub database meta page";
+        } else if (Load<uint32_t>(meta + PG_META_PAGESIZE) != _pgsize) {
+            why = "bad sub database page size";
+        } else if (_bHash) {
+            // Bucket B is on page B + spares[ceil(log2(B + 1))]
+            uint32_t maxBucket = Load<uint32_t>(meta + PG_HASH_MAXBUCKET);
+            for (uint32_t bucket = 0; !why && bucket <= maxBucket; bucket++) {
+                uint32_t spare = 0;
+                while (((uint64_t)1 << spare) < (uint64_t)bucket + 1) {
+                    spare++;
+                }
+                uint32_t pgno = (spare < PG_HASH_NSPARES)
+                    ? bucket + Load<uint32_t>(meta + PG_HASH_SPARES +
+                                              spare * sizeof(uint32_t))
+                    : 0;
+                if (!At(pgno) || _heads.size() > _last) {
+                    why = "bad HASH buckets";
+                } else {
+                    _heads.push_back(pgno);
+                }
+            }
+        } else {
+            uint32_t leaf = FirstLeaf(Load<uint32_t>(meta + PG_BTM_ROOT));
+            if (!leaf) {
+                why = "bad BTREE root";
+            } else {
+                _heads.push_back(leaf);
+            }
+        }
+    }
+
+    if (!why && !_bHash) {
+        if (flags & PG_BTM_RECNO) {
+            why = "holds records";
+        } else if (flags & PG_BTM_COMPRESS) {
+            why = "compressed";
+        }
+    }
+
+    if (why) {
+        cerr << "Warning: Reading \"" << file << "\" through libdb, "
+             << why << endl;
+        return false;
+    }
+
+    // Leaf pages are read in file order, or mostly so along the chains
+    posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    madvise((void *)_map, _size, MADV_SEQUENTIAL);
+    Rewind();
+
+    return true;
+}
+
+void
+PageReader::Rewind()
+{
+    _head = 0;
+    _walked = 0;
+    _ahead = 0;
+    _ret = 0;
+    _pgno = 0;
+    _page = NULL;
+    _idx = 0;
+    _dupPgno = 0;
+    _dupIdx = 0;
+    _hdup = NULL;
+    _hdupEnd = NULL;
+}
+
+bool
+PageReader::Fail(uint32_t pgno, const char *msg)
+{
+    cerr << "Error: Page " << pgno << ": " << msg << endl;
+    _ret = -1;
+    return false;
+}
+
+const uint8_t *
+PageReader::Page(uint32_t pgno)
+{
+    const uint8_t *page = At(pgno);
+    if (!page) {
+        Fail(pgno, "reference past the end of the file");
+    }
+
+    return page;
+}
+
+//  Keep the window after a page on its way in
+void
+PageReader::ReadAhead(uint32_t pgno)
+{
+    size_t pos = (size_t)pgno * _pgsize;
+    if ((pos >= _ahead || pos + READAHEAD_SZ < _ahead) && pos < _size) {
+        _ahead = min(pos + READAHEAD_SZ, _size);
+        madvise((void *)(_map + (pos & ~(size_t)(getpagesize() - 1))),
+                READAHEAD_SZ, MADV_WILLNEED);
+    }
+}
+
+//  Leftmost leaf under a BTREE root, 0 if the tree is broken
+uint32_t
+PageReader::FirstLeaf(uint32_t root) const
+{
+    uint32_t pgno = root;
+    for (int depth = 0; depth < 64; depth++) {
+        const uint8_t *page = At(pgno);
+        if (!page) {
+            break;
+        }
+
+        uint8_t type = page[PG_TYPE];
+        if (PG_LBTREE == type) {
+            return pgno;
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        if (PG_IBTREE != type || 0 == entries ||
+            Offset(page, 0) + 8u > _pgsize) {
+            break;
+        }
+        pgno = Load<uint32_t>(page + Offset(page, 0) + 4);
+    }
+
+    return 0;
+}
+
+//  Meta page of a sub database, from the leaves of the master database:
+//  names as keys, meta page numbers as big endian values
+const uint8_t *
+PageReader::FindSubDb(const string &dbname)
+{
+    uint32_t pgno = FirstLeaf(Load<uint32_t>(_map + PG_BTM_ROOT));
+    for (uint32_t walked = 0; pgno && walked <= _last; walked++) {
+        const uint8_t *page = At(pgno);
+        if (!page || PG_LBTREE != page[PG_TYPE]) {
+            break;
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        if (PG_OVERHEAD + entries * sizeof(uint16_t) > _pgsize) {
+            break;
+        }
+
+        for (uint32_t idx = 0; idx + 1 < entries; idx += 2) {
+            uint16_t koff = Offset(page, idx);
+            uint16_t voff = Offset(page, idx + 1);
+            if (koff + 3u > _pgsize || voff + 3u > _pgsize) {
+                return NULL;
+            }
+
+            const uint8_t *key = page + koff;
+            const uint8_t *val = page + voff;
+            uint16_t klen = Load<uint16_t>(key);
+            if (PG_B_KEYDATA != key[2] || PG_B_KEYDATA != val[2] ||
+                koff + 3u + klen > _pgsize || dbname.size() != klen ||
+                0 != memcmp(key + 3, dbname.data(), klen)) {
+                continue;
+            }
+
+            if (sizeof(uint32_t) != Load<uint16_t>(val) ||
+                voff + 3u + sizeof(uint32_t) > _pgsize) {
+                return NULL;
+            }
+            return At(be32toh(Load<uint32_t>(val + 3)));
+        }
+
+        pgno = Load<uint32_t>(page + PG_NEXTPGNO);
+    }
+
+    return NULL;
+}
+
+bool
+PageReader::NextLeaf()
+{
+    const uint8_t *prev = _page;
+    _page = NULL;
+    while (0 == _ret && !_heads.empty()) {
+        // Along the chain, or on to the next one
+        uint32_t pgno = prev ? Load<uint32_t>(prev + PG_NEXTPGNO) : 0;
+        if (!pgno) {
+            if (_head >= _heads.size()) {
+                return false;
+            }
+            pgno = _heads[_head++];
+        }
+
+        const uint8_t *page = Page(pgno);
+        if (!page) {
+            return false;
+        }
+        ReadAhead(pgno);
+        if (++_walked > _last) {
+            return Fail(pgno, "loop in the leaf pages");
+        }
+
+        uint8_t type = page[PG_TYPE];
+        if (_bHash ? (PG_HASH != type && PG_HASH_UNSORTED != type)
+            : (PG_LBTREE != type)) {
+            return Fail(pgno, "not a leaf page");
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        if (PG_OVERHEAD + entries * sizeof(uint16_t) > _pgsize) {
+            return Fail(pgno, "bad number of items");
+        }
+
+        _pgno = pgno;
+        _page = page;
+        _idx = 0;
+        return true;
+    }
+
+    while (0 == _ret && _pgno < _last) {
+        _pgno++;
+        ReadAhead(_pgno);
+
+        const uint8_t *page = _map + (size_t)_pgno * _pgsize;
+        uint8_t type = page[PG_TYPE];
+        if (_bHash ? (PG_HASH != type && PG_HASH_UNSORTED != type)
+            : (PG_LBTREE != type)) {
+            continue;
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        if (PG_OVERHEAD + entries * sizeof(uint16_t) > _pgsize) {
+            return Fail(_pgno, "bad number of items");
+        }
+
+        _page = page;
+        _idx = 0;
+        return true;
+    }
+
+    return false;
+}
+
+//  BTREE style item, of a leaf or an off page duplicate page. The root of
+//  off page duplicates goes to 'dup' if allowed.
+bool
+PageReader::GetItem(const uint8_t *page, uint32_t idx, Dbt &obj,
+                    vector<char> &buff, uint32_t *dup)
+{
+    uint32_t pgno = Load<uint32_t>(page + 8);
+    uint16_t off = Offset(page, idx);
+    if (off + 3u > _pgsize) {
+        return Fail(pgno, "item past the end of the page");
+    }
+
+    const uint8_t *item = page + off;
+    uint16_t len = Load<uint16_t>(item);
+    uint8_t type = item[2] & ~PG_B_DELETE;
+    if (off + ((PG_B_KEYDATA == type) ? 3u + len : 12u) > _pgsize) {
+        return Fail(pgno, "item past the end of the page");
+    }
+
+    switch (type) {
+        case PG_B_KEYDATA:
+            obj.set_data((void *)(item + 3));
+            obj.set_size(len);
+            return true;
+        case PG_B_OVERFLOW:
+            return GetOverflow(Load<uint32_t>(item + 4),
+                               Load<uint32_t>(item + 8), obj, buff);
+        case PG_B_DUPLICATE:
+            if (dup) {
+                *dup = Load<uint32_t>(item + 4);
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return Fail(pgno, "unsupported item type");
+}
+
+//  Item of the current HASH page
+bool
+PageReader::GetHashItem(uint32_t idx, Dbt &obj, vector<char> &buff,
+                        uint32_t *dup)
+{
+    uint16_t off = Offset(_page, idx);
+    uint32_t end = idx ? Offset(_page, idx - 1) : _pgsize;
+    if (off >= end || end > _pgsize) {
+        return Fail(_pgno, "bad item offset");
+    }
+
+    const uint8_t *item = _page + off;
+    switch (item[0]) {
+        case PG_H_KEYDATA:
+            obj.set_data((void *)(item + 1));
+            obj.set_size(end - off - 1);
+            return true;
+        case PG_H_OFFPAGE:
+            if (off + 12u > end) {
+                break;
+            }
+            return GetOverflow(Load<uint32_t>(item + 4),
+                               Load<uint32_t>(item + 8), obj, buff);
+        case PG_H_DUPLICATE:
+            if (!dup) {
+                break;
+            }
+            _hdup = item + 1;
+            _hdupEnd = _page + end;
+            return true;
+        case PG_H_OFFDUP:
+            if (!dup || off + 8u > end) {
+                break;
+            }
+            *dup = Load<uint32_t>(item + 4);
+            return true;
+        default:
+            break;
+    }
+
+    return Fail(_pgno, "unsupported item type");
+}
+
+//  Assemble an item from its chain of overflow pages
+bool
+PageReader::GetOverflow(uint32_t pgno, uint32_t tlen, Dbt &obj,
+                        vector<char> &buff)
+{
+    buff.resize(tlen);
+
+    size_t pos = 0;
+    while (pos < tlen) {
+        const uint8_t *page = Page(pgno);
+        if (!page) {
+            return false;
+        }
+
+        uint16_t len = Load<uint16_t>(page + PG_HFOFFSET);
+        if (PG_OVERFLOW != page[PG_TYPE] || len > _pgsize - PG_OVERHEAD ||
+            len > tlen - pos) {
+            return Fail(pgno, "bad overflow page");
+        }
+
+        memcpy(&buff[pos], page + PG_OVERHEAD, len);
+        pos += len;
+        if (0 == (pgno = Load<uint32_t>(page + PG_NEXTPGNO)) && pos < tlen) {
+            return Fail(pgno, "overflow item cut short");
+        }
+    }
+
+    obj.set_data(tlen ? &buff[0] : NULL);
+    obj.set_size(tlen);
+
+    return true;
+}
+
+//  Go down an off page duplicate tree to its first leaf
+bool
+PageReader::FirstDup(uint32_t pgno)
+{
+    for (int depth = 0; depth < 64; depth++) {
+        const uint8_t *page = Page(pgno);
+        if (!page) {
+            return false;
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        uint8_t type = page[PG_TYPE];
+        // Leaves are sorted or, for unsorted duplicates, RECNO pages
+        if (PG_LDUP == type || PG_LRECNO == type) {
+            _dupPgno = pgno;
+            _dupIdx = 0;
+            return true;
+        }
+
+        if (0 == entries || Offset(page, 0) + 8u > _pgsize) {
+            break;
+        }
+
+        // Leftmost child, at 4 in a BTREE internal item, 0 in a RECNO one
+        const uint8_t *item = page + Offset(page, 0);
+        if (PG_IBTREE == type) {
+            pgno = Load<uint32_t>(item + 4);
+        } else if (PG_IRECNO == type) {
+            pgno = Load<uint32_t>(item);
+        } else {
+            break;
+        }
+    }
+
+    return Fail(pgno, "bad duplicate tree");
+}
+
+bool
+PageReader::NextDup(Dbt &val)
+{
+    while (_dupPgno) {
+        const uint8_t *page = Page(_dupPgno);
+        if (!page) {
+            break;
+        }
+
+        uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+        if (_dupIdx >= entries ||
+            PG_OVERHEAD + entries * sizeof(uint16_t) > _pgsize) {
+            _dupPgno = Load<uint32_t>(page + PG_NEXTPGNO);
+            _dupIdx = 0;
+            continue;
+        }
+
+        uint32_t idx = _dupIdx++;
+        uint16_t off = Offset(page, idx);
+        if (off + 3u <= _pgsize && (page[off + 2] & PG_B_DELETE)) {
+            continue;
+        }
+
+        return GetItem(page, idx, val, _valBuf, NULL);
+    }
+
+    _dupPgno = 0;
+    return false;
+}
+
+//  Entries of an on page HASH duplicate set are framed by their length
+bool
+PageReader::NextHashDup(Dbt &val)
+{
+    if (_hdup + sizeof(uint16_t) > _hdupEnd) {
+        _hdup = NULL;
+        return false;
+    }
+
+    uint16_t len = Load<uint16_t>(_hdup);
+    if (_hdup + len + 2 * sizeof(uint16_t) > _hdupEnd) {
+        _hdup = NULL;
+        return Fail(_pgno, "bad duplicate set");
+    }
+
+    val.set_data((void *)(_hdup + sizeof(uint16_t)));
+    val.set_size(len);
+    _hdup += len + 2 * sizeof(uint16_t);
+
+    return true;
+}
+
+bool
+PageReader::Next(Dbt &key, Dbt &val)
+{
+    while (0 == _ret) {
+        // Rest of the duplicates of the current key
+        if ((_hdup && NextHashDup(val)) || (_dupPgno && NextDup(val))) {
+            key.set_data(_key.get_data());
+            key.set_size(_key.get_size());
+            return true;
+        }
+        if (0 != _ret) {
+            break;
+        }
+
+        if (!_page || _idx + 1 >= Load<uint16_t>(_page + PG_ENTRIES)) {
+            if (!NextLeaf()) {
+                break;
+            }
+            continue;
+        }
+
+        // Items come in key/value pairs
+        uint32_t idx = _idx;
+        _idx += 2;
+
+        uint32_t dup = 0;
+        if (_bHash) {
+            if (!GetHashItem(idx, _key, _keyBuf, NULL) ||
+                !GetHashItem(idx + 1, val, _valBuf, &dup)) {
+                break;
+            }
+        } else {
+            // Deleted but not yet removed from the page
+            uint16_t off = Offset(_page, idx + 1);
+            if (off + 3u <= _pgsize && (_page[off + 2] & PG_B_DELETE)) {
+                continue;
+            }
+
+            if (!GetItem(_page, idx, _key, _keyBuf, NULL) ||
+                !GetItem(_page, idx + 1, val, _valBuf, &dup)) {
+                break;
+            }
+        }
+
+        if (dup) {
+            if (!FirstDup(dup)) {
+                break;
+            }
+            continue;
+        }
+        if (_hdup) {
+            continue;
+        }
+
+        key.set_data(_key.get_data());
+        key.set_size(_key.get_size());
+        return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// CompareKeys
+//  Same ordering as the default BTREE comparison: bytewise, then by length
+//-----------------------------------------------------------------------------
+static int
+CompareKeys(const void *a, size_t alen, const void *b, size_t blen)
+{
+    int ret = memcmp(a, b, min(alen, blen));
+    if (0 == ret) {
+        ret = (alen < blen) ? -1 : ((alen > blen) ? 1 : 0);
+    }
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// KeyRange
+//  Interval of BTREE keys starting at 'from'. The end 'to' is either
+//  exclusive, or inclusive along with every key that it is a prefix of.
+//-----------------------------------------------------------------------------
+struct KeyRange {
+    KeyRange() : bFrom(false), bTo(false), bToPrefix(false) {}
+
+    // The key lies beyond the end of the range
+    bool Past(const void *key, size_t sz) const {
+        if (!bTo) {
+            return false;
+        }
+
+        int ret = CompareKeys(key, sz, to.data(), to.size());
+        if (!bToPrefix) {
+            return (0 <= ret);
+        }
+
+        return (0 < ret) &&
+            !(sz >= to.size() && 0 == memcmp(key, to.data(), to.size()));
+    }
+
+    string from;
+    bool bFrom;
+    string to;
+    bool bTo;
+    bool bToPrefix;
+};
+
+//-----------------------------------------------------------------------------
+// Filter
+//  Predicate on decoded key/value fields, such as
+//      v.1 > 1000 && (k.0 == "foo" || k.0 ~ "bar")
+//  'k.N'/'v.N' is field N of the key/value format. Numbers compare as
+//  numbers, strings, chars and hex (given as "0a1b") compare bytewise and
+//  '~' tests for a substring. It runs on the raw record bytes, so records
+//  that do not match are never formatted.
+//-----------------------------------------------------------------------------
+class Filter {
+public:
+    Filter(const string &keyfmt, const string &valfmt)
+        : _keyPlan(keyfmt), _valPlan(valfmt) {}
+
+    // Parse an expression, false with a message on errors
+    bool Compile(const string &expr);
+
+    bool Match(const Dbt &key, const Dbt &val) const {
+        return Eval(0, key, val);
+    }
+
+private:
+    enum Op { OP_OR, OP_AND, OP_NOT, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT,
+              OP_GE, OP_HAS };
+
+    struct Node {
+        Op op;
+        size_t left;            // Operand nodes of OR, AND and NOT
+        size_t right;
+        bool bKey;              // Comparison on a key field
+        size_t field;
+        FieldType type;
+        bool bSwap;             // Number not in host order
+        int64_t ival;           // Literal for signed fields
+        uint64_t uval;          // Literal for unsigned fields
+        string bytes;           // Literal for byte fields
+
+        Node() : op(OP_OR), left(0), right(0), bKey(false), field(0),
+                 type(F_CHAR), bSwap(false), ival(0), uval(0) {}
+    };
+
+    bool Eval(size_t idx, const Dbt &key, const Dbt &val) const;
+    bool Compare(const Node &node, const char *data, size_t sz) const;
+
+    // Recursive descent, each returns the index of the node built
+    bool ParseOr(size_t &idx);
+    bool ParseAnd(size_t &idx);
+    bool ParseNot(size_t &idx);
+    bool ParseCmp(size_t &idx);
+    bool ParseLiteral(Node &node);
+    void SkipSpace();
+    bool Accept(const char *tok);
+    bool Fail(const char *msg);
+
+    FormatPlan _keyPlan;
+    FormatPlan _valPlan;
+    vector<Node> _nodes;
+    string _expr;
+    size_t _pos;
+};
+
+bool
+Filter::Compile(const string &expr)
+{
+    _expr = expr;
+    _pos = 0;
+    _nodes.clear();
+
+    // The root is always node 0
+    _nodes.resize(1);
+    size_t root;
+    if (!ParseOr(root)) {
+        return false;
+    }
+
+    SkipSpace();
+    if (_pos != _expr.size()) {
+        return Fail("unexpected text");
+    }
+
+    // Move the root in place
+    _nodes[0] = _nodes[root];
+
+    return true;
+}
+
+void
+Filter::SkipSpace()
+{
+    while (_pos < _expr.size() && isspace(_expr[_pos])) {
+        _pos++;
+    }
+}
+
+bool
+Filter::Accept(const char *tok)
+{
+    SkipSpace();
+    size_t len = strlen(tok);
+    if (0 == _expr.compare(_pos, len, tok)) {
+        _pos += len;
+        return true;
+    }
+
+    return false;
+}
+
+bool
+Filter::Fail(const char *msg)
+{
+    cerr << "Error: Invalid filter, " << msg << " at \""
+         << _expr.substr(min(_pos, _expr.size())) << "\"" << endl;
+    return false;
+}
+
+bool
+Filter::ParseOr(size_t &idx)
+{
+    if (!ParseAnd(idx)) {
+        return false;
+    }
+
+    while (Accept("||")) {
+        Node node;
+        node.op = OP_OR;
+        node.left = idx;
+        if (!ParseAnd(node.right)) {
+            return false;
+        }
+        idx = _nodes.size();
+        _nodes.push_back(node);
+    }
+
+    return true;
+}
+
+bool
+Filter::ParseAnd(size_t &idx)
+{
+    if (!ParseNot(idx)) {
+        return false;
+    }
+
+    while (Accept("&&")) {
+        Node node;
+        node.op = OP_AND;
+        node.left = idx;
+        if (!ParseNot(node.right)) {
+            return false;
+        }
+        idx = _nodes.size();
+        _nodes.push_back(node);
+    }
+
+    return true;
+}
+
+bool
+Filter::ParseNot(size_t &idx)
+{
+    if (Accept("!")) {
+        Node node;
+        node.op = OP_NOT;
+        if (!ParseNot(node.left)) {
+            return false;
+        }
+        idx = _nodes.size();
+        _nodes.push_back(node);
+        return true;
+    }
+
+    if (Accept("(")) {
+        if (!ParseOr(idx)) {
+            return false;
+        }
+        return Accept(")") || Fail("missing ')'");
+    }
+
+    return ParseCmp(idx);
+}
+
+bool
+Filter::ParseCmp(size_t &idx)
+{
+    static const struct {
+        const char *tok;
+        Op op;
+    } ops[] = {
+        // Longest first
+        { "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+        { "<", OP_LT }, { ">", OP_GT }, { "~", OP_HAS },
+    };
+
+    Node node;
+    SkipSpace();
+    if (Accept("k.")) {
+        node.bKey = true;
+    } else if (Accept("v.")) {
+        node.bKey = false;
+    } else {
+        return Fail("expected k.N or v.N");
+    }
+
+    const char *start = _expr.c_str() + _pos;
+    char *end = NULL;
+    node.field = strtoul(start, &end, 10);
+    if (end == start) {
+        return Fail("expected a field number");
+    }
+    _pos += end - start;
+
+    const FormatPlan &plan = node.bKey ? _keyPlan : _valPlan;
+    if (plan.Empty()) {
+        return Fail("field needs a format, use -k/-v");
+    }
+    if (node.field >= plan.Size()) {
+        return Fail("no such field in the format");
+    }
+    if (R_NONE != plan[node.field].repeat) {
+        return Fail("repeated fields do not compare");
+    }
+    node.type = plan[node.field].type;
+    node.bSwap = plan[node.field].bSwap;
+
+    size_t cc = 0;
+    while (cc < sizeof(ops)/sizeof(ops[0]) && !Accept(ops[cc].tok)) {
+        cc++;
+    }
+    if (cc == sizeof(ops)/sizeof(ops[0])) {
+        return Fail("expected a comparison");
+    }
+    node.op = ops[cc].op;
+
+    if (!ParseLiteral(node)) {
+        return false;
+    }
+
+    idx = _nodes.size();
+    _nodes.push_back(node);
+
+    return true;
+}
+
+bool
+Filter::ParseLiteral(Node &node)
+{
+    SkipSpace();
+
+    bool bNumber = (F_I32 == node.type || F_U32 == node.type ||
+                    F_I64 == node.type || F_U64 == node.type);
+    if (bNumber) {
+        if (OP_HAS == node.op) {
+            return Fail("'~' needs a string field");
+        }
+
+        const char *start = _expr.c_str() + _pos;
+        char *end = NULL;
+        errno = 0;
+        if (F_I32 == node.type || F_I64 == node.type) {
+            node.ival = strtoll(start, &end, 0);
+        } else if ('-' == *start) {
+            // strtoull() would wrap it around
+            return Fail("unsigned field compared with a negative number");
+        } else {
+            node.uval = strtoull(start, &end, 0);
+        }
+        if (end == start || errno) {
+            return Fail("expected a number");
+        }
+        _pos += end - start;
+
+        return true;
+    }
+
+    if (!Accept("\"")) {
+        return Fail("expected a quoted string");
+    }
+
+    string text;
+    while (_pos < _expr.size() && '"' != _expr[_pos]) {
+        if ('\\' == _expr[_pos] && _pos + 1 < _expr.size()) {
+            _pos++;
+        }
+        text += _expr[_pos++];
+    }
+    if (!Accept("\"")) {
+        return Fail("unterminated string");
+    }
+
+    node.bytes = text;
+    if (F_HEX == node.type) {
+        FormatPlan plan("hex");
+        if (!plan.Encode(text, node.bytes, false)) {
+            return Fail("expected hex digits");
+        }
+    }
+
+    return true;
+}
+
+bool
+Filter::Eval(size_t idx, const Dbt &key, const Dbt &val) const
+{
+    const Node &node = _nodes[idx];
+
+    switch (node.op) {
+        case OP_OR:
+            return Eval(node.left, key, val) || Eval(node.right, key, val);
+        case OP_AND:
+            return Eval(node.left, key, val) && Eval(node.right, key, val);
+        case OP_NOT:
+            return !Eval(node.left, key, val);
+        default:
+            break;
+    }
+
+    const Dbt &obj = node.bKey ? key : val;
+    return Compare(node, (const char *)obj.get_data(), obj.get_size());
+}
+
+// Turn a three way comparison result into the operator outcome
+static inline bool
+CompareResult(int ret, int op, int eq, int ne, int lt, int le, int gt)
+{
+    if (op == eq) return 0 == ret;
+    if (op == ne) return 0 != ret;
+    if (op == lt) return ret < 0;
+    if (op == le) return ret <= 0;
+    if (op == gt) return ret > 0;
+    return ret >= 0;
+}
+
+bool
+Filter::Compare(const Node &node, const char *data, size_t sz) const
+{
+    const FormatPlan &plan = node.bKey ? _keyPlan : _valPlan;
+    size_t off, len;
+
+    // A record too short for the field never matches
+    if (!plan.Locate(data, sz, node.field, off, len)) {
+        return false;
+    }
+
+    const char *ptr = data + off;
+    int ret = 0;
+    switch (node.type) {
+        case F_I32: {
+            uint32_t u;
+            memcpy(&u, ptr, sizeof(u));
+            int32_t v = node.bSwap ? bswap_32(u) : u;
+            ret = (v < node.ival) ? -1 : (v > node.ival);
+            break;
+        }
+        case F_I64: {
+            uint64_t u;
+            memcpy(&u, ptr, sizeof(u));
+            int64_t v = node.bSwap ? bswap_64(u) : u;
+            ret = (v < node.ival) ? -1 : (v > node.ival);
+            break;
+        }
+        case F_U32: {
+            uint32_t v;
+            memcpy(&v, ptr, sizeof(v));
+            if (node.bSwap) {
+                v = bswap_32(v);
+            }
+            ret = (v < node.uval) ? -1 : (v > node.uval);
+            break;
+        }
+        case F_U64: {
+            uint64_t v;
+            memcpy(&v, ptr, sizeof(v));
+            if (node.bSwap) {
+                v = bswap_64(v);
+            }
+            ret = (v < node.uval) ? -1 : (v > node.uval);
+            break;
+        }
+        default:
+            if (OP_HAS == node.op) {
+                // memmem scans with vectorized first byte matching
+                return node.bytes.empty() ||
+                    NULL != memmem(ptr, len, node.bytes.data(),
+                                   node.bytes.size());
+            }
+
+            // Length first: equality on bytes rarely needs the memcmp
+            if (OP_EQ == node.op || OP_NE == node.op) {
+                bool bEq = (len == node.bytes.size()) &&
+                    0 == memcmp(ptr, node.bytes.data(), len);
+                return (OP_EQ == node.op) == bEq;
+            }
+
+            ret = CompareKeys(ptr, len, node.bytes.data(), node.bytes.size());
+            break;
+    }
+
+    return CompareResult(ret, node.op, OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT);
+}
+
+//-----------------------------------------------------------------------------
+// Hash64
+//  MurmurHash64A, for the sketches of Stats
+//-----------------------------------------------------------------------------
+static uint64_t
+Hash64(const void *data, size_t len, uint64_t seed = 0x9747b28c)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *ptr = (const unsigned char *)data;
+    const unsigned char *end = ptr + (len & ~(size_t)7);
+    uint64_t h = seed ^ (len * m);
+
+    for (; ptr != end; ptr += 8) {
+        uint64_t k;
+        memcpy(&k, ptr, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= (uint64_t)ptr[6] << 48;
+                // fall through
+        case 6: h ^= (uint64_t)ptr[5] << 40;
+                // fall through
+        case 5: h ^= (uint64_t)ptr[4] << 32;
+                // fall through
+        case 4: h ^= (uint64_t)ptr[3] << 24;
+                // fall through
+        case 3: h ^= (uint64_t)ptr[2] << 16;
+                // fall through
+        case 2: h ^= (uint64_t)ptr[1] << 8;
+                // fall through
+        case 1: h ^= (uint64_t)ptr[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+//-----------------------------------------------------------------------------
+// SizeHistogram
+//  Power of two buckets, bucket N counts sizes in [2^(N-1), 2^N)
+//-----------------------------------------------------------------------------
+struct SizeHistogram {
+    SizeHistogram() : count(0), total(0), min(~(uint64_t)0), max(0) {
+        memset(buckets, 0, sizeof(buckets));
+    }
+
+    void Add(uint64_t sz) {
+        int idx = 0;
+        for (uint64_t v = sz; v; v >>= 1) {
+            idx++;
+        }
+        buckets[idx]++;
+        count++;
+        total += sz;
+        if (sz < min) min = sz;
+        if (sz > max) max = sz;
+    }
+
+    void Report(OutBuf &out, const char *name) const;
+
+    uint64_t buckets[65];
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+void
+SizeHistogram::Report(OutBuf &out, const char *name) const
+{
+    if (0 == count) {
+        out << name << ": none\n";
+        return;
+    }
+
+    out << name << ": count " << count << " min " << min << " max " << max
+        << " avg " << total / count << " total " << total << "\n";
+    for (int cc = 0; cc < 65; cc++) {
+        if (!buckets[cc]) {
+            continue;
+        }
+        uint64_t lo = cc ? (uint64_t)1 << (cc - 1) : 0;
+        out << "    " << lo << "-" << (cc ? 2 * lo - 1 : 0) << "\t"
+            << buckets[cc] << "\t" << (unsigned)(100 * buckets[cc] / count)
+            << "%\n";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// HyperLogLog
+//  Distinct count estimate in 2^14 one byte registers, about 0.8% off
+//-----------------------------------------------------------------------------
+class HyperLogLog {
+public:
+    HyperLogLog() : _regs(1 << BITS, 0) {}
+
+    void Add(uint64_t hash) {
+        size_t idx = hash >> (64 - BITS);
+        uint64_t rest = (hash << BITS) | ((uint64_t)1 << (BITS - 1));
+        uint8_t rank = __builtin_clzll(rest) + 1;
+        if (rank > _regs[idx]) {
+            _regs[idx] = rank;
+        }
+    }
+
+    uint64_t Estimate() const;
+
+private:
+    enum { BITS = 14 };
+    vector<uint8_t> _regs;
+};
+
+uint64_t
+HyperLogLog::Estimate() const
+{
+    double m = _regs.size();
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t cc = 0; cc < _regs.size(); cc++) {
+        sum += 1.0 / ((uint64_t)1 << _regs[cc]);
+        zeros += (0 == _regs[cc]);
+    }
+
+    double est = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+
+    // Linear counting is closer while many registers are unused
+    if (est <= 2.5 * m && zeros) {
+        est = m * log(m / zeros);
+    }
+
+    return (uint64_t)(est + 0.5);
+}
+
+//-----------------------------------------------------------------------------
+// HeavyHitters
+//  Space-Saving top-K: a fixed set of counters where a new value takes
+//  over the smallest one. Counts are upper bounds, off by at most 'error'.
+//  Values are kept up to HH_MAXLEN bytes, but told apart by a full hash,
+//  and remember their full length.
+//-----------------------------------------------------------------------------
+static const size_t HH_COUNTERS = 32;
+static const size_t HH_MAXLEN = 64;
+
+class HeavyHitters {
+public:
+    struct Counter {
+        uint64_t hash;
+        uint64_t count;
+        uint64_t error;
+        string value;
+        size_t len;             // Of the whole value
+    };
+
+    HeavyHitters() : _min(0) { _counters.reserve(HH_COUNTERS); }
+
+    void Add(uint64_t hash, const char *data, size_t len);
+
+    // Counters by decreasing count
+    void Top(vector<Counter> &top) const;
+
+private:
+    vector<Counter> _counters;
+    size_t _min;                // Index of the smallest counter when full
+};
+
+void
+HeavyHitters::Add(uint64_t hash, const char *data, size_t len)
+{
+    for (size_t cc = 0; cc < _counters.size(); cc++) {
+        if (hash == _counters[cc].hash) {
+            _counters[cc].count++;
+            if (cc == _min && _counters.size() == HH_COUNTERS) {
+                for (size_t ii = 0; ii < _counters.size(); ii++) {
+                    if (_counters[ii].count < _counters[_min].count) {
+                        _min = ii;
+                    }
+                }
+            }
+            return;
+        }
+    }
+
+    Counter *counter;
+    if (_counters.size() < HH_COUNTERS) {
+        _counters.push_back(Counter());
+        counter = &_counters.back();
+        counter->count = 0;
+    } else {
+        counter = &_counters[_min];
+    }
+
+    counter->hash = hash;
+    counter->error = counter->count;
+    counter->count++;
+    counter->value.assign(data, min(len, HH_MAXLEN));
+    counter->len = len;
+
+    if (_counters.size() == HH_COUNTERS) {
+        _min = 0;
+        for (size_t ii = 1; ii < _counters.size(); ii++) {
+            if (_counters[ii].count < _counters[_min].count) {
+                _min = ii;
+            }
+        }
+    }
+}
+
+static bool
+CompareCounters(const HeavyHitters::Counter &a,
+                const HeavyHitters::Counter &b)
+{
+    return a.count > b.count;
+}
+
+void
+HeavyHitters::Top(vector<Counter> &top) const
+{
+    top = _counters;
+    sort(top.begin(), top.end(), CompareCounters);
+}
+
+//-----------------------------------------------------------------------------
+// Stats
+//  Single pass summary of a DB instead of its dump: key and value sizes,
+//  duplicate chains, and per format field a distinct count and the most
+//  frequent values. Fields are found with the same plans used to print.
+//-----------------------------------------------------------------------------
+class Stats {
+public:
+    Stats(const string &keyfmt, const string &valfmt, bool bDup,
+          size_t topk = 10);
+
+    void Add(const Dbt &key, const Dbt &val);
+
+    void Report(OutBuf &out);
+
+private:
+    struct FieldStats {
+        const FormatPlan *plan;
+        size_t idx;
+        string name;            // k.N or v.N
+        HyperLogLog distinct;
+        HeavyHitters top;
+    };
+
+    void AddFields(const FormatPlan &plan, size_t first, const Dbt &obj);
+    void EndChain();
+
+    FormatPlan _keyPlan;
+    FormatPlan _valPlan;
+    bool _bDup;
+    size_t _topk;
+    uint64_t _records;
+    SizeHistogram _keySizes;
+    SizeHistogram _valSizes;
+    SizeHistogram _chains;      // Records per key of DB_DUP DBs
+    string _chainKey;
+    uint64_t _chainLen;
+    vector<FieldStats> _fields;
+};
+
+Stats::Stats(const string &keyfmt, const string &valfmt, bool bDup,
+             size_t topk)
+    : _keyPlan(keyfmt), _valPlan(valfmt), _bDup(bDup), _topk(topk),
+      _records(0), _chainLen(0)
+{
+    _fields.resize(_keyPlan.Size() + _valPlan.Size());
+    for (size_t cc = 0; cc < _fields.size(); cc++) {
+        bool bKey = cc < _keyPlan.Size();
+        FieldStats &field = _fields[cc];
+        field.plan = bKey ? &_keyPlan : &_valPlan;
+        field.idx = bKey ? cc : cc - _keyPlan.Size();
+
+        char name[32];
+        snprintf(name, sizeof(name), "%c.%u", bKey ? 'k' : 'v',
+                 (unsigned)field.idx);
+        field.name = name;
+    }
+}
+
+void
+Stats::AddFields(const FormatPlan &plan, size_t first, const Dbt &obj)
+{
+    const char *data = (const char *)obj.get_data();
+    size_t sz = obj.get_size();
+    size_t off, len;
+
+    for (size_t cc = 0; cc < plan.Size(); cc++) {
+        if (!plan.Locate(data, sz, cc, off, len)) {
+            break;
+        }
+
+        FieldStats &field = _fields[first + cc];
+        uint64_t hash = Hash64(data + off, len);
+        field.distinct.Add(hash);
+        field.top.Add(hash, data + off, len);
+    }
+}
+
+void
+Stats::EndChain()
+{
+    if (_chainLen) {
+        _chains.Add(_chainLen);
+    }
+    _chainLen = 0;
+}
+
+void
+Stats::Add(const Dbt &key, const Dbt &val)
+{
+    _records++;
+    _keySizes.Add(key.get_size());
+    _valSizes.Add(val.get_size());
+
+    // Duplicates of a key come back to back
+    if (_bDup) {
+        if (!_chainLen || key.get_size() != _chainKey.size() ||
+            memcmp(key.get_data(), _chainKey.data(), key.get_size())) {
+            EndChain();
+            _chainKey.assign((const char *)key.get_data(), key.get_size());
+        }
+        _chainLen++;
+    }
+
+    AddFields(_keyPlan, 0, key);
+    AddFields(_valPlan, _keyPlan.Size(), val);
+}
+
+void
+Stats::Report(OutBuf &out)
+{
+    EndChain();
+
+    out << "#stats\n";
+    out << "records: " << _records << "\n";
+    _keySizes.Report(out, "key size");
+    _valSizes.Report(out, "value size");
+    if (_bDup) {
+        _chains.Report(out, "duplicate chain");
+    }
+
+    for (size_t cc = 0; cc < _fields.size(); cc++) {
+        FieldStats &field = _fields[cc];
+        string type = field.plan->ValueFormat(field.idx);
+        out << "field " << field.name << " (" << type << "): distinct ~"
+            << field.distinct.Estimate() << "\n";
+
+        // Heavy hitters print like the field in a dump, cut ones followed
+        // by "..." and their length. Values not surely seen twice are
+        // noise from the counters being recycled.
+        FormatPlan plan(type);
+        vector<HeavyHitters::Counter> top;
+        field.top.Top(top);
+        for (size_t ii = 0; ii < top.size() && ii < _topk; ii++) {
+            if (top[ii].count - top[ii].error < 2) {
+                continue;
+            }
+            out << "    " << top[ii].count;
+            if (top[ii].error) {
+                out << " (+-" << top[ii].error << ")";
+            }
+            out << "\t";
+            plan.Print(out, top[ii].value.data(), top[ii].value.size());
+            if (top[ii].len > top[ii].value.size()) {
+                out << "... (" << top[ii].len << " bytes)";
+            }
+            out << "\n";
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// StatsLoop
+//  Feed the records matching 'filter' to 'stats' until the end of the
+//  reader or the first key past 'range'. Returns the number of records.
+//-----------------------------------------------------------------------------
+static size_t
+StatsLoop(RecordReader &reader, Stats &stats, const KeyRange *range,
+          const Filter *filter)
+{
+    size_t records = 0;
+    Dbt key, val;
+    while (reader.Next(key, val)) {
+        if (range && range->Past(key.get_data(), key.get_size())) {
+            break;
+        }
+
+        if (filter && !filter->Match(key, val)) {
+            continue;
+        }
+
+        stats.Add(key, val);
+        records++;
+    }
+
+    return records;
+}
+
+//-----------------------------------------------------------------------------
+// DumpLoop
+//  Print key/value records matching 'filter' from a reader until its end
+//  or, if given, the first key past the end of 'range'. Returns the number
+//  of records printed.
+//-----------------------------------------------------------------------------
+template <typename K, typename V>
+size_t
+DumpLoop(RecordReader &reader, string &keyfmt, string &valfmt, OutBuf &out,
+         bool bHeader, const KeyRange *range, const Filter *filter)
+{
+    PrintData<mds_rec_t, K, V> p(keyfmt, valfmt, out, bHeader);
+    size_t records = 0;
+
+    Dbt key, val;
+    while (reader.Next(key, val)) {
+        if (range && range->Past(key.get_data(), key.get_size())) {
+            break;
+        }
+
+        if (filter && !filter->Match(key, val)) {
+            continue;
+        }
+
+        mds_rec_t rec(key, val);
+        p(rec);
+        records++;
+    }
+
+    return records;
+}
+
+//-----------------------------------------------------------------------------
+// BenchLoop
+//  Time printing 'count' records, cycling over the given ones
+//-----------------------------------------------------------------------------
+template <typename K, typename V>
+double
+BenchLoop(vector<mds_rec_t> &recs, size_t count, string &keyfmt,
+          string &valfmt, OutBuf &out)
+{
+    PrintData<mds_rec_t, K, V> p(keyfmt, valfmt, out, false);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t cc = 0; cc < count; cc++) {
+        p(recs[cc % recs.size()]);
+    }
+    out.Flush();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Fused decoders for the formats of GetDefaultFormats
+// ATTN: KEEP IN SYNC WITH GetDefaultFormats
+typedef size_t (*f_DumpLoop)(RecordReader &, string &, string &, OutBuf &,
+                             bool, const KeyRange *, const Filter *);
+typedef double (*f_BenchLoop)(vector<mds_rec_t> &, size_t, string &,
+                              string &, OutBuf &);
+
+static const struct {
+    const char *keyfmt;
+    const char *valfmt;
+    f_DumpLoop loop;
+    f_BenchLoop bench;
+} s_fused[] = {
+    { "s", "u32:i32",
+      DumpLoop<LayoutStr, LayoutU32I32>, BenchLoop<LayoutStr, LayoutU32I32> },
+    { "u32:i32", "s",
+      DumpLoop<LayoutU32I32, LayoutStr>, BenchLoop<LayoutU32I32, LayoutStr> },
+    { "hex", "u64",
+      DumpLoop<LayoutHex, LayoutU64>, BenchLoop<LayoutHex, LayoutU64> },
+    { "u64", "hex",
+      DumpLoop<LayoutU64, LayoutHex>, BenchLoop<LayoutU64, LayoutHex> },
+    { "u64", "u32:i32",
+      DumpLoop<LayoutU64, LayoutU32I32>, BenchLoop<LayoutU64, LayoutU32I32> },
+};
+
+//-----------------------------------------------------------------------------
+// FindFused
+//  Index of the fused decoder for a key/value format, -1 if there is none
+//-----------------------------------------------------------------------------
+static int
+FindFused(const string &keyfmt, const string &valfmt)
+{
+    for (size_t cc = 0; cc < sizeof(s_fused)/sizeof(s_fused[0]); cc++) {
+        if (keyfmt == s_fused[cc].keyfmt && valfmt == s_fused[cc].valfmt) {
+            return cc;
+        }
+    }
+
+    return -1;
+}
+
+//-----------------------------------------------------------------------------
+// DumpRecords
+//  Pick the decoder for the formats once and run the record loop with it
+//-----------------------------------------------------------------------------
+static size_t
+DumpRecords(RecordReader &reader, string &keyfmt, string &valfmt, OutBuf &out,
+            bool bHeader = true, const KeyRange *range = NULL,
+            const Filter *filter = NULL)
+{
+    int idx = FindFused(keyfmt, valfmt);
+    if (-1 != idx) {
+        return s_fused[idx].loop(reader, keyfmt, valfmt, out, bHeader, range,
+                                 filter);
+    }
+
+    return DumpLoop<FormatPlan, FormatPlan>(reader, keyfmt, valfmt, out,
+                                            bHeader, range, filter);
+}
+
+//-----------------------------------------------------------------------------
+// IndirectPlan
+//  Decoder making one call through a function pointer per field, as the
+//  format used to be interpreted. Only kept as the benchmark baseline.
+//-----------------------------------------------------------------------------
+class IndirectPlan {
+public:
+    explicit IndirectPlan(const string &fmt) {
+        FormatPlan plan(fmt);
+        for (size_t cc = 0; cc < plan.Size(); cc++) {
+            switch (plan[cc].type) {
+                case F_CHAR:
+                    _funcs.push_back(PrintDataByType<char>);
+                    break;
+                case F_STR:
+                    _funcs.push_back(PrintDataByType<char *>);
+                    break;
+                case F_I32:
+                    _funcs.push_back(PrintDataByType<int32_t>);
+                    break;
+                case F_U32:
+                    _funcs.push_back(PrintDataByType<uint32_t>);
+                    break;
+                case F_I64:
+                    _funcs.push_back(PrintDataByType<int64_t>);
+                    break;
+                case F_U64:
+                    _funcs.push_back(PrintDataByType<uint64_t>);
+                    break;
+                case F_HEX:
+                    _funcs.push_back(PrintDataByType<hex_t>);
+                    break;
+            }
+        }
+    }
+
+    void Print(OutBuf &out, const char *data, size_t sz) {
+        for (size_t cc = 0; cc < _funcs.size(); cc++) {
+            if (cc) {
+                out << ',';
+            }
+
+            size_t written = _funcs[cc](out, data, sz);
+            data += written;
+            sz -= written;
+        }
+    }
+
+private:
+    vector<f_PrintDataByType> _funcs;
+};
+
+//-----------------------------------------------------------------------------
+// MakeSyntheticData
+//  Random bytes laid out as per a format
+//-----------------------------------------------------------------------------
+static string
+MakeSyntheticData(const FormatPlan &plan)
+{
+    string data;
+
+    for (size_t cc = 0; cc < plan.Size(); cc++) {
+        const FieldPlan &field = plan[cc];
+
+        // Extended fields get random elements of their type, encoded
+        if (!field.bPlain) {
+            string text;
+            size_t count = (R_FIXED == field.repeat) ? field.count :
+                (R_NONE == field.repeat) ? 1 : rand() % 8;
+            for (size_t ii = 0; ii < count; ii++) {
+                char elem[32];
+                if (ii) {
+                    text += ' ';
+                }
+                if (F_CHAR == field.type || F_STR == field.type) {
+                    size_t len = (F_CHAR == field.type) ? 1 :
+                        field.elem ? field.elem : 8 + rand() % 16;
+                    for (; len; len--) {
+                        text += (char)('a' + rand() % 26);
+                    }
+                    continue;
+                }
+                if (F_HEX == field.type) {
+                    for (size_t len = field.elem ? field.elem : 16; len;
+                         len--) {
+                        snprintf(elem, sizeof(elem), "%02x", rand() & 0xff);
+                        text += elem;
+                    }
+                    continue;
+                }
+                snprintf(elem, sizeof(elem), "%d", rand() % 100000);
+                text += elem;
+            }
+            EncodeField(field, text, data, false);
+            continue;
+        }
+
+        switch (field.type) {
+            case F_CHAR:
+                data += (char)('a' + rand() % 26);
+                break;
+            case F_STR:
+                for (int len = 8 + rand() % 16; len; len--) {
+                    data += (char)('a' + rand() % 26);
+                }
+                data += '\0';
+                break;
+            case F_HEX:
+                for (size_t len = 16; len; len--) {
+                    data += (char)rand();
+                }
+                break;
+            default:
+                for (size_t len = plan[cc].width; len; len--) {
+                    data += (char)rand();
+                }
+                break;
+        }
+    }
+
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+// BenchDecoders
+//  Microbenchmark of the record decoders for a key/value format: print
+//  'count' synthetic records to /dev/null with per field indirect calls,
+//  with the compiled plan and, if there is one, with the fused decoder
+//-----------------------------------------------------------------------------
+static int
+BenchDecoders(size_t count, string &keyfmt, string &valfmt, OutBuf &report)
+{
+    if (keyfmt.empty() || valfmt.empty()) {
+        cerr << "Error: Benchmark needs both key and value formats" << endl;
+        return -1;
+    }
+
+    int fd = open("/dev/null", O_WRONLY);
+    if (-1 == fd) {
+        cerr << "Error: Unable to open /dev/null" << endl;
+        return -1;
+    }
+
+    // A working set of distinct records, larger than the caches
+    FormatPlan keyPlan(keyfmt), valPlan(valfmt);
+    vector<string> data;
+    vector<mds_rec_t> recs;
+
+    srand(1);
+    for (size_t cc = 0; cc < 64 * 1024; cc++) {
+        data.push_back(MakeSyntheticData(keyPlan));
+        data.push_back(MakeSyntheticData(valPlan));
+    }
+    for (size_t cc = 0; cc < data.size(); cc += 2) {
+        recs.push_back(mds_rec_t(Dbt((void *)data[cc].data(),
+                                     data[cc].size()),
+                                 Dbt((void *)data[cc + 1].data(),
+                                     data[cc + 1].size())));
+    }
+
+    struct {
+        const char *name;
+        f_BenchLoop bench;
+    } runs[] = {
+        { "indirect", BenchLoop<IndirectPlan, IndirectPlan> },
+        { "plan", BenchLoop<FormatPlan, FormatPlan> },
+        { "fused", NULL },
+    };
+
+    int idx = FindFused(keyfmt, valfmt);
+    if (-1 != idx) {
+        runs[2].bench = s_fused[idx].bench;
+    }
+
+    // The baseline only knows the plain types
+    if (!keyPlan.Plain() || !valPlan.Plain()) {
+        runs[0].bench = NULL;
+    }
+
+    OutBuf out(fd);
+    for (size_t cc = 0; cc < sizeof(runs)/sizeof(runs[0]); cc++) {
+        if (NULL == runs[cc].bench) {
+            continue;
+        }
+
+        double secs = runs[cc].bench(recs, count, keyfmt, valfmt, out);
+        report << runs[cc].name << ": "
+               << (unsigned long long)(count / secs) << " records/s\n";
+    }
+
+    out.Flush();
+    close(fd);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// GetEdgeRecord
+//  Fetch the first or last record (DB_FIRST/DB_LAST) of a DB, or with
+//  DB_SET_RANGE the first one at or after 'key'
+//-----------------------------------------------------------------------------
+static bool
+GetEdgeRecord(Db &dbh, uint32_t flag, string &key, string &val)
+{
+    Dbc *cur = NULL;
+    if (dbh.cursor(NULL, &cur, 0)) {
+        return false;
+    }
+
+    // Handles may be opened with DB_THREAD, let libdb allocate
+    Dbt dkey, dval;
+    dkey.set_flags(DB_DBT_REALLOC);
+    dval.set_flags(DB_DBT_REALLOC);
+
+    if (DB_SET_RANGE == flag) {
+        void *buff = malloc(key.size() ? key.size() : 1);
+        memcpy(buff, key.data(), key.size());
+        dkey.set_data(buff);
+        dkey.set_size(key.size());
+    }
+
+    bool found = (0 == cur->get(&dkey, &dval, flag));
+    if (found) {
+        key.assign((char *)dkey.get_data(), dkey.get_size());
+        val.assign((char *)dval.get_data(), dval.get_size());
+    }
+
+    free(dkey.get_data());
+    free(dval.get_data());
+    cur->close();
+
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+// KeyToOrdinal, OrdinalToKey
+//  Map the 8 bytes following a common prefix to an ordered integer and back
+//-----------------------------------------------------------------------------
+static uint64_t
+KeyToOrdinal(const string &key, size_t plen)
+{
+    uint64_t ord = 0;
+    for (size_t cc = 0; cc < sizeof(ord); cc++) {
+        size_t pos = plen + cc;
+        ord = (ord << 8) | ((pos < key.size()) ? (uint8_t)key[pos] : 0);
+    }
+
+    return ord;
+}
+
+static string
+OrdinalToKey(uint64_t ord)
+{
+    string key(sizeof(ord), '\0');
+    for (size_t cc = sizeof(ord); cc > 0; cc--) {
+        key[cc - 1] = (char)(ord & 0xff);
+        ord >>= 8;
+    }
+
+    return key;
+}
+
+//-----------------------------------------------------------------------------
+// KeyFraction
+//  Estimated fraction of the records with keys before 'key'
+//-----------------------------------------------------------------------------
+static bool
+KeyFraction(Db &dbh, const string &key, double &less)
+{
+    Dbt dkey((void *)key.data(), key.size());
+    DB_KEY_RANGE range;
+
+    if (dbh.key_range(NULL, &dkey, &range, 0)) {
+        return false;
+    }
+
+    less = range.less;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// GetPrefixLast
+//  Last key starting with 'prefix', which sorts after the prefix itself,
+//  and 'end', the smallest key past all those, or "" if there is none
+//-----------------------------------------------------------------------------
+static bool
+GetPrefixLast(Db &dbh, const string &prefix, string &key, string &end)
+{
+    end = prefix;
+    while (!end.empty() && '\xff' == end[end.size() - 1]) {
+        end.erase(end.size() - 1);
+    }
+    if (!end.empty()) {
+        end[end.size() - 1] = (char)((unsigned char)end[end.size() - 1] + 1);
+    }
+
+    Dbc *cur = NULL;
+    if (dbh.cursor(NULL, &cur, 0)) {
+        return false;
+    }
+
+    // Handles may be opened with DB_THREAD, let libdb allocate
+    Dbt dkey, dval;
+    dkey.set_flags(DB_DBT_REALLOC);
+    dval.set_flags(DB_DBT_REALLOC);
+
+    // The record before 'end', or the last one if nothing is past it
+    int ret = DB_NOTFOUND;
+    if (!end.empty()) {
+        void *buff = malloc(end.size());
+        memcpy(buff, end.data(), end.size());
+        dkey.set_data(buff);
+        dkey.set_size(end.size());
+        ret = cur->get(&dkey, &dval, DB_SET_RANGE);
+    }
+    if (0 == ret) {
+        ret = cur->get(&dkey, &dval, DB_PREV);
+    } else if (DB_NOTFOUND == ret) {
+        ret = cur->get(&dkey, &dval, DB_LAST);
+    }
+
+    bool found = (0 == ret && dkey.get_size() >= prefix.size() &&
+                  0 == memcmp(dkey.get_data(), prefix.data(), prefix.size()));
+    if (found) {
+        key.assign((char *)dkey.get_data(), dkey.get_size());
+    }
+
+    free(dkey.get_data());
+    free(dval.get_data());
+    cur->close();
+
+    return found;
+}
+
+//-----------------------------------------------------------------------------
+// GetRangeSplits
+//  Find up to njobs-1 split keys that cut a BTREE key range into parts of
+//  roughly equal record counts. Synthetic keys between the first and last
+//  key are bisected using DB->key_range, which costs a few page lookups
+//  per probe instead of a scan.
+//-----------------------------------------------------------------------------
+static void
+GetRangeSplits(Db &dbh, int njobs, const KeyRange &range,
+               vector<string> &splits)
+{
+    string first, last, end, unused;
+
+    first = range.from;
+    if (!GetEdgeRecord(dbh, range.bFrom ? DB_SET_RANGE : DB_FIRST,
+                       first, unused)) {
+        return;
+    }
+
+    // A prefix sorts before the keys under it, they end at the last one
+    bool bEnd = range.bTo;
+    if (range.bToPrefix) {
+        if (!GetPrefixLast(dbh, range.to, last, end)) {
+            return;
+        }
+        bEnd = !end.empty();
+    } else if (range.bTo) {
+        last = end = range.to;
+    } else if (!GetEdgeRecord(dbh, DB_LAST, last, unused)) {
+        return;
+    }
+
+    double lofrac = 0.0, hifrac = 1.0;
+    if (!KeyFraction(dbh, first, lofrac) ||
+        (bEnd && !KeyFraction(dbh, end, hifrac))) {
+        return;
+    }
+
+    // Only the bytes after the shared prefix discriminate between keys
+    size_t plen = 0;
+    while (plen < first.size() && plen < last.size() &&
+           first[plen] == last[plen]) {
+        plen++;
+    }
+
+    string prefix = first.substr(0, plen);
+    uint64_t lo = KeyToOrdinal(first, plen);
+    uint64_t hi = KeyToOrdinal(last, plen);
+
+    for (int cc = 1; cc < njobs && lo < hi; cc++) {
+        double target = lofrac + (hifrac - lofrac) * cc / njobs;
+        uint64_t l = lo, h = hi;
+
+        while (l < h) {
+            uint64_t mid = l + (h - l) / 2;
+            double less;
+
+            if (!KeyFraction(dbh, prefix + OrdinalToKey(mid), less)) {
+                splits.clear();
+                return;
+            }
+
+            if (less < target) {
+                l = mid + 1;
+            } else {
+                h = mid;
+            }
+        }
+
+        // Splits must be strictly increasing and past the first key
+        string split = prefix + OrdinalToKey(l);
+        const string &prev = splits.empty() ? first : splits.back();
+        if (0 < CompareKeys(split.data(), split.size(),
+                            prev.data(), prev.size())) {
+            splits.push_back(split);
+        }
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// CreateSpillFile
+//  Open an anonymous temporary file, it is gone once the fd is closed
+//-----------------------------------------------------------------------------
+static int
+CreateSpillFile()
+{
+    const char *tmpdir = getenv("TMPDIR");
+    if (NULL == tmpdir) {
+        tmpdir = "/tmp";
+    }
+
+    string tmpl = string(tmpdir) + "/" + progname + ".XXXXXX";
+    vector<char> path(tmpl.begin(), tmpl.end());
+    path.push_back('\0');
+
+    int fd = mkstemp(&path[0]);
+    if (-1 == fd) {
+        cerr << "Error: Unable to create a temporary file in \""
+             << tmpdir << "\"" << endl;
+    } else {
+        unlink(&path[0]);
+    }
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// CopySpillFile
+//  Append the whole content of a spill file to the output buffer
+//-----------------------------------------------------------------------------
+static bool
+CopySpillFile(int fd, OutBuf &out)
+{
+    static const size_t CHUNK = 64 * 1024;
+
+    if (-1 == lseek(fd, 0, SEEK_SET)) {
+        return false;
+    }
+
+    while (true) {
+        char *pos = out.Reserve(CHUNK);
+        ssize_t cnt = read(fd, pos, CHUNK);
+        if (cnt < 0 && EINTR == errno) {
+            continue;
+        }
+        if (cnt <= 0) {
+            return (0 == cnt);
+        }
+        out.Commit(pos + cnt);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// RangeJob
+//  One key range of a partitioned dump
+//-----------------------------------------------------------------------------
+struct RangeJob {
+    Db *dbh;
+    KeyRange range;
+    string keyfmt;
+    string valfmt;
+    const Filter *filter;
+    int fd;                     // Spill file holding the formatted range
+    size_t records;
+    int ret;
+    pthread_t thread;
+};
+
+//-----------------------------------------------------------------------------
+// DumpRange
+//  Thread routine: walk one key range with a private bulk cursor
+//-----------------------------------------------------------------------------
+static void *
+DumpRange(void *arg)
+{
+    RangeJob *job = (RangeJob *)arg;
+    OutBuf out(job->fd);
+    BulkReader reader(*job->dbh);
+    if (job->range.bFrom) {
+        reader.Seek(job->range.from.data(), job->range.from.size());
+    }
+
+    job->records = DumpRecords(reader, job->keyfmt, job->valfmt, out,
+                               false, &job->range, job->filter);
+
+    job->ret = reader.Error();
+    if (!out.Flush()) {
+        job->ret = -1;
+    }
+
+    return job;
+}
+
+//-----------------------------------------------------------------------------
+// ParallelDump
+//  Dump a BTREE key range using njobs threads, each owning a part of it.
+//  Parts are spilled to temporary files and copied out in key order, so
+//  the output is identical to the serial dump. Formats must be resolved.
+//-----------------------------------------------------------------------------
+static int
+ParallelDump(Db &dbh, int njobs, const KeyRange &range, const string &keyfmt,
+             const string &valfmt, const Filter *filter, OutBuf &out,
+             bool bHeader, size_t &records)
+{
+    records = 0;
+
+    vector<string> splits;
+    GetRangeSplits(dbh, njobs, range, splits);
+
+    vector<RangeJob> jobs(splits.size() + 1);
+    for (size_t cc = 0; cc < jobs.size(); cc++) {
+        RangeJob &job = jobs[cc];
+        job.dbh = &dbh;
+        job.range = range;
+        if (0 != cc) {
+            job.range.from = splits[cc - 1];
+            job.range.bFrom = true;
+        }
+        if (cc != splits.size()) {
+            job.range.to = splits[cc];
+            job.range.bTo = true;
+            job.range.bToPrefix = false;
+        }
+        job.keyfmt = keyfmt;
+        job.valfmt = valfmt;
+        job.filter = filter;
+        job.records = 0;
+        job.ret = 0;
+
+        if (-1 == (job.fd = CreateSpillFile())) {
+            continue;
+        }
+
+        if (pthread_create(&job.thread, NULL, DumpRange, &job)) {
+            cerr << "Error: Unable to create worker thread" << endl;
+            close(job.fd);
+            job.fd = -1;
+        }
+    }
+
+    // Stitch the parts back in order as they complete
+    int status = 0;
+    for (size_t cc = 0; cc < jobs.size(); cc++) {
+        RangeJob &job = jobs[cc];
+        if (-1 == job.fd) {
+            status = -1;
+            continue;
+        }
+
+        pthread_join(job.thread, NULL);
+        if (0 != job.ret) {
+            cerr << "Error: Failed to dump key range " << cc
+                 << " with error " << job.ret << endl;
+            status = -1;
+        } else if (0 == status && job.records) {
+            if (bHeader && 0 == records) {
+                out << "#key:value\n";
+            }
+            records += job.records;
+
+            if (!CopySpillFile(job.fd, out)) {
+                cerr << "Error: Failed to read back key range " << cc
+                     << endl;
+                status = -1;
+            }
+        }
+
+        close(job.fd);
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// ResolveFormats
+//  Replace missing formats by the ones guessed from the first record at or
+//  after 'from', so that dumps split into pieces all agree on them
+//-----------------------------------------------------------------------------
+static void
+ResolveFormats(Db &dbh, const KeyRange &range, string &keyfmt, string &valfmt)
+{
+    if (!keyfmt.empty() && !valfmt.empty()) {
+        return;
+    }
+
+    string key = range.from, val;
+    if (!GetEdgeRecord(dbh, range.bFrom ? DB_SET_RANGE : DB_FIRST, key, val)) {
+        return;
+    }
+
+    if (keyfmt.empty()) {
+        keyfmt = InferFormat(key.data(), key.size());
+    }
+    if (valfmt.empty()) {
+        valfmt = InferFormat(val.data(), val.size());
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// DumpKeyRanges
+//  Dump a BTREE or HASH, or just the given key ranges of a BTREE, in order.
+//  Only records matching the filter expression are printed, if given. With
+//  'bStats' the records are summed up in a report instead.
+//-----------------------------------------------------------------------------
+static int
+DumpKeyRanges(Db &dbh, int njobs, vector<KeyRange> ranges, string keyfmt,
+              string valfmt, const string &expr, bool bStats, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    ResolveFormats(dbh, ranges[0], keyfmt, valfmt);
+
+    // Field numbers refer to the resolved formats
+    Filter filter(keyfmt, valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+    const Filter *pFilter = expr.empty() ? NULL : &filter;
+
+    uint32_t flags = 0;
+    dbh.get_flags(&flags);
+    Stats stats(keyfmt, valfmt, 0 != (flags & DB_DUP));
+
+    int status = 0;
+    bool bHeader = true;
+
+    if (njobs > 1 && !bStats) {
+        for (size_t cc = 0; 0 == status && cc < ranges.size(); cc++) {
+            size_t records = 0;
+            status = ParallelDump(dbh, njobs, ranges[cc], keyfmt, valfmt,
+                                  pFilter, out, bHeader, records);
+            bHeader = bHeader && !records;
+        }
+
+        return status;
+    }
+
+    // One cursor re-positioned for every range. With a pipelined output
+    // it reads ahead too, so that reads, formatting and writes overlap.
+    BulkReader reader(dbh, BULK_BUFSZ, out.Pipelined());
+    for (size_t cc = 0; cc < ranges.size(); cc++) {
+        const KeyRange &range = ranges[cc];
+        if (range.bFrom) {
+            reader.Seek(range.from.data(), range.from.size());
+        }
+
+        // Duplicates come back as consecutive pairs with the same key
+        size_t records = bStats
+            ? StatsLoop(reader, stats, &range, pFilter)
+            : DumpRecords(reader, keyfmt, valfmt, out, bHeader, &range,
+                          pFilter);
+        bHeader = bHeader && !records;
+
+        if (0 != (status = reader.Error())) {
+            cerr << "Error: Failed to read DB with error "
+                 << status << endl;
+            break;
+        }
+    }
+
+    if (bStats && 0 == status) {
+        stats.Report(out);
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// DumpPages
+//  Dump a file mapped by a PageReader, in page order. Missing formats are
+//  guessed from the first record.
+//-----------------------------------------------------------------------------
+static int
+DumpPages(PageReader &pages, string keyfmt, string valfmt,
+          const string &expr, bool bStats, OutBuf &out)
+{
+    Dbt key, val;
+    if ((keyfmt.empty() || valfmt.empty()) && pages.Next(key, val)) {
+        if (keyfmt.empty()) {
+            keyfmt = InferFormat((const char *)key.get_data(),
+                                 key.get_size());
+        }
+        if (valfmt.empty()) {
+            valfmt = InferFormat((const char *)val.get_data(),
+                                 val.get_size());
+        }
+    }
+    pages.Rewind();
+
+    Filter filter(keyfmt, valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+
+    if (bStats) {
+        Stats stats(keyfmt, valfmt, pages.Dup());
+        StatsLoop(pages, stats, NULL, expr.empty() ? NULL : &filter);
+        if (0 == pages.Error()) {
+            stats.Report(out);
+        }
+    } else {
+        DumpRecords(pages, keyfmt, valfmt, out, true, NULL,
+                    expr.empty() ? NULL : &filter);
+    }
+
+    return pages.Error();
+}
+
+//-----------------------------------------------------------------------------
+// Now
+//  Monotonic clock in seconds
+//-----------------------------------------------------------------------------
+static double
+Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+// Throttle
+//  Keeps a walk under a record rate and a read bandwidth, 0 for no limit,
+//  by sleeping before the reads that would go over budget
+//-----------------------------------------------------------------------------
+class Throttle {
+public:
+    Throttle(double rate, double mbps)
+        : _rate(rate), _bps(mbps * 1048576), _start(Now()) {}
+
+    // Wait until 'records' and 'bytes' read since the start are in budget
+    void Wait(size_t records, size_t bytes) const {
+        double due = max(_rate > 0 ? records / _rate : 0.0,
+                         _bps > 0 ? bytes / _bps : 0.0);
+        double ahead = due - (Now() - _start);
+        if (ahead > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)ahead;
+            ts.tv_nsec = (long)((ahead - ts.tv_sec) * 1e9);
+            nanosleep(&ts, NULL);
+        }
+    }
+
+private:
+    double _rate;               // Records per second
+    double _bps;                // Bytes per second
+    double _start;
+};
+
+//-----------------------------------------------------------------------------
+// LiveReader
+//  BTREE walk for an environment in use. Reads are bulk reads of at most
+//  BULK_MINSZ, paced by a Throttle. By default each one runs in its own
+//  read committed transaction and the cursor is closed after it, so no
+//  lock outlives a read: the next one seeks back to the last key and skips
+//  the records of it already returned. With bSnapshot the whole walk is
+//  one snapshot transaction instead, which takes no read locks on DBs the
+//  writers opened with DB_MULTIVERSION.
+//-----------------------------------------------------------------------------
+class LiveReader : public RecordReader {
+public:
+    LiveReader(DbEnv &env, Db &dbh, bool bSnapshot, const Throttle &throttle);
+    ~LiveReader();
+
+    // (Re)start at the first record with key >= 'key'
+    void Seek(const void *key, size_t sz);
+
+    bool Next(Dbt &key, Dbt &val);
+
+    int Error() const { return _ret; }
+
+    size_t Records() const { return _records; }
+    size_t Bytes() const { return _bytes; }
+    double ReadTime() const { return _readTime; }
+    double MaxRead() const { return _maxRead; }
+
+private:
+    bool Fetch();
+    bool SkipBuffer();
+    void Release(bool bTxn);
+
+    DbEnv &_env;
+    Db &_dbh;
+    bool _bSnapshot;
+    const Throttle &_throttle;
+    DbTxn *_txn;
+    Dbc *_cur;
+    bool _done;
+    int _ret;
+
+    bool _bSeek;                // Next read starts at _last
+    string _last;               // Last key returned
+    size_t _nLast;              // Records of it returned
+    size_t _skip;               // Of these, still to skip after a seek
+
+    vector<char> _buff;
+    Dbt _bulk;
+    DbMultipleKeyDataIterator *_kit;
+
+    size_t _records;
+    size_t _bytes;
+    double _readTime;           // In cursor reads, lock waits included
+    double _maxRead;
+};
+
+LiveReader::LiveReader(DbEnv &env, Db &dbh, bool bSnapshot,
+                       const Throttle &throttle)
+    : _env(env), _dbh(dbh), _bSnapshot(bSnapshot), _throttle(throttle),
+      _txn(NULL), _cur(NULL), _done(false), _ret(0), _bSeek(false),
+      _nLast(0), _skip(0), _buff(BULK_MINSZ), _kit(NULL), _records(0),
+      _bytes(0), _readTime(0), _maxRead(0)
+{
+    _bulk.set_data(&_buff[0]);
+    _bulk.set_ulen(_buff.size());
+    _bulk.set_flags(DB_DBT_USERMEM);
+}
+
+LiveReader::~LiveReader()
+{
+    delete _kit;
+    Release(true);
+}
+
+void
+LiveReader::Release(bool bTxn)
+{
+    if (_cur) {
+        _cur->close();
+        _cur = NULL;
+    }
+
+    // Reads only, nothing to lose either way
+    if (bTxn && _txn) {
+        _txn->commit(0);
+        _txn = NULL;
+    }
+
+    return;
+}
+
+void
+LiveReader::Seek(const void *key, size_t sz)
+{
+    delete _kit;
+    _kit = NULL;
+    Release(false);
+
+    _last.assign((const char *)key, sz);
+    _bSeek = true;
+    _nLast = 0;
+    _skip = 0;
+    _done = (0 != _ret);
+
+    return;
+}
+
+bool
+LiveReader::Fetch()
+{
+    delete _kit;
+    _kit = NULL;
+
+    // Pace the walk while no cursor is open
+    _throttle.Wait(_records, _bytes);
+
+    double start = Now();
+    uint32_t flag = DB_NEXT;
+    Dbt seek;
+    if (NULL == _cur) {
+        if (NULL == _txn &&
+            0 != (_ret = _env.txn_begin(NULL, &_txn, _bSnapshot
+                                        ? DB_TXN_SNAPSHOT
+                                        : DB_READ_COMMITTED))) {
+            _done = true;
+            return false;
+        }
+        if (0 != (_ret = _dbh.cursor(_txn, &_cur, 0))) {
+            _done = true;
+            return false;
+        }
+
+        // Back to the last key, past its records already returned
+        flag = _bSeek ? DB_SET_RANGE : DB_FIRST;
+        seek.set_data((void *)_last.data());
+        seek.set_size(_last.size());
+        _skip = _nLast;
+    }
+
+    int ret;
+    do {
+        _bulk.set_ulen(_buff.size());
+        while (DB_BUFFER_SMALL ==
+               (ret = _cur->get(&seek, &_bulk, flag | DB_MULTIPLE_KEY))) {
+            // A single record does not fit, grow to a multiple of 1024
+            _buff.resize((_bulk.get_size() + 1023) & ~(size_t)1023);
+            _bulk.set_data(&_buff[0]);
+            _bulk.set_ulen(_buff.size());
+        }
+        flag = DB_NEXT;
+    } while (0 == ret && SkipBuffer());
+
+    if (!_bSnapshot) {
+        Release(true);
+    }
+
+    double elapsed = Now() - start;
+    _readTime += elapsed;
+    _maxRead = max(_maxRead, elapsed);
+
+    if (0 != ret) {
+        _ret = (DB_NOTFOUND == ret) ? 0 : ret;
+        _done = true;
+        return false;
+    }
+
+    _kit = new DbMultipleKeyDataIterator(_bulk);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// LiveReader::SkipBuffer
+//  True if the buffer holds nothing but records to skip, then taken off the
+//  count. Such a buffer tells neither where the last key ends nor where the
+//  DB does, so the cursor has to read on before it is let go.
+//-----------------------------------------------------------------------------
+bool
+LiveReader::SkipBuffer()
+{
+    DbMultipleKeyDataIterator it(_bulk);
+    Dbt key, val;
+    size_t records = 0;
+    while (it.next(key, val)) {
+        if (++records > _skip ||
+            0 != CompareKeys(_last.data(), _last.size(),
+                             key.get_data(), key.get_size())) {
+            return false;
+        }
+    }
+
+    _skip -= records;
+    return true;
+}
+
+bool
+LiveReader::Next(Dbt &key, Dbt &val)
+{
+    while (!_done) {
+        if (!_kit || !_kit->next(key, val)) {
+            Fetch();
+            continue;
+        }
+
+        bool bLast = _bSeek && 0 == CompareKeys(_last.data(), _last.size(),
+                                                key.get_data(),
+                                                key.get_size());
+        if (bLast && _skip) {
+            _skip--;
+            continue;
+        }
+        _skip = 0;
+
+        if (bLast) {
+            _nLast++;
+        } else {
+            _last.assign((const char *)key.get_data(), key.get_size());
+            _nLast = 1;
+            _bSeek = true;
+        }
+
+        _records++;
+        _bytes += key.get_size() + val.get_size();
+        return true;
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// DumpLive
+//  Dump a BTREE, or key ranges of it, through a LiveReader, then report the
+//  achieved rates and the time spent waiting on libdb
+//-----------------------------------------------------------------------------
+static int
+DumpLive(DbEnv &env, Db &dbh, vector<KeyRange> ranges, string keyfmt,
+         string valfmt, const string &expr, bool bStats, bool bSnapshot,
+         const Throttle &throttle, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    ResolveFormats(dbh, ranges[0], keyfmt, valfmt);
+
+    Filter filter(keyfmt, valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+    const Filter *pFilter = expr.empty() ? NULL : &filter;
+
+    uint32_t flags = 0;
+    dbh.get_flags(&flags);
+    Stats stats(keyfmt, valfmt, 0 != (flags & DB_DUP));
+
+    // Lock waits of the whole environment, writers waiting on us included
+    DB_LOCK_STAT *lockStat = NULL;
+    uint32_t waits = 0;
+    if (0 == env.lock_stat(&lockStat, 0)) {
+        waits = lockStat->st_lock_wait;
+        free(lockStat);
+    }
+
+    double start = Now();
+    int status = 0;
+    bool bHeader = true;
+    LiveReader reader(env, dbh, bSnapshot, throttle);
+    for (size_t cc = 0; cc < ranges.size(); cc++) {
+        const KeyRange &range = ranges[cc];
+        if (range.bFrom) {
+            reader.Seek(range.from.data(), range.from.size());
+        }
+
+        size_t records = bStats
+            ? StatsLoop(reader, stats, &range, pFilter)
+            : DumpRecords(reader, keyfmt, valfmt, out, bHeader, &range,
+                          pFilter);
+        bHeader = bHeader && !records;
+
+        if (0 != (status = reader.Error())) {
+            cerr << "Error: Failed to read DB with error "
+                 << status << endl;
+            break;
+        }
+    }
+
+    if (bStats && 0 == status) {
+        stats.Report(out);
+    }
+
+    double secs = max(Now() - start, 1e-6);
+    if (0 == env.lock_stat(&lockStat, 0)) {
+        waits = lockStat->st_lock_wait - waits;
+        free(lockStat);
+    }
+
+    cerr << fixed << setprecision(2)
+         << "Read " << reader.Records() << " records, "
+         << reader.Bytes() / 1048576.0 << " MB in " << secs << " s: "
+         << reader.Records() / secs << " records/s, "
+         << reader.Bytes() / 1048576.0 / secs << " MB/s" << endl
+         << "Spent " << reader.ReadTime() << " s in DB reads, longest "
+         << reader.MaxRead() * 1000 << " ms, " << waits
+         << " lock waits in the environment" << endl;
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// NextInRange
+//  Next record of a reader matching 'filter', false past the end of 'range'
+//-----------------------------------------------------------------------------
+static bool
+NextInRange(RecordReader &reader, const KeyRange &range, const Filter *filter,
+            Dbt &key, Dbt &val)
+{
+    while (reader.Next(key, val)) {
+        if (range.Past(key.get_data(), key.get_size())) {
+            return false;
+        }
+        if (!filter || filter->Match(key, val)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// DiffDbs
+//  Merge join two BTREEs in key order and print the records only in 'a'
+//  with '-', only in 'b' with '+', and the two versions of a changed one as
+//  a '-' and '+' pair. Duplicates are matched as key/value pairs, which
+//  assumes sorted duplicates. Formats must be resolved.
+//-----------------------------------------------------------------------------
+static int
+DiffDbs(Db &dbA, Db &dbB, vector<KeyRange> ranges, string &keyfmt,
+        string &valfmt, const Filter *filter, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    uint32_t flagsA = 0, flagsB = 0;
+    dbA.get_flags(&flagsA);
+    dbB.get_flags(&flagsB);
+    bool bDup = (0 != ((flagsA | flagsB) & DB_DUP));
+
+    PrintData<mds_rec_t> p(keyfmt, valfmt, out, false);
+    bool bHeader = true;
+
+    BulkReader readerA(dbA), readerB(dbB);
+    for (size_t cc = 0; cc < ranges.size(); cc++) {
+        const KeyRange &range = ranges[cc];
+        if (range.bFrom) {
+            readerA.Seek(range.from.data(), range.from.size());
+            readerB.Seek(range.from.data(), range.from.size());
+        }
+
+        Dbt keyA, valA, keyB, valB;
+        bool bA = NextInRange(readerA, range, filter, keyA, valA);
+        bool bB = NextInRange(readerB, range, filter, keyB, valB);
+        while (bA || bB) {
+            int ret = !bA ? 1 : !bB ? -1
+                : CompareKeys(keyA.get_data(), keyA.get_size(),
+                              keyB.get_data(), keyB.get_size());
+            bool bSame = (0 == ret) &&
+                0 == CompareKeys(valA.get_data(), valA.get_size(),
+                                 valB.get_data(), valB.get_size());
+            if (0 == ret && bDup && !bSame) {
+                ret = CompareKeys(valA.get_data(), valA.get_size(),
+                                  valB.get_data(), valB.get_size());
+            }
+
+            if (!bSame && bHeader) {
+                out << "#key:value\n";
+                bHeader = false;
+            }
+
+            if (ret <= 0) {
+                if (!bSame) {
+                    mds_rec_t rec(keyA, valA);
+                    out << '-';
+                    p(rec);
+                }
+                bA = NextInRange(readerA, range, filter, keyA, valA);
+            }
+            if (ret >= 0) {
+                if (!bSame) {
+                    mds_rec_t rec(keyB, valB);
+                    out << '+';
+                    p(rec);
+                }
+                bB = NextInRange(readerB, range, filter, keyB, valB);
+            }
+        }
+
+        int status = readerA.Error() ? readerA.Error() : readerB.Error();
+        if (0 != status) {
+            cerr << "Error: Failed to read DB with error " << status << endl;
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Log records, DB 5.x layouts. Every record starts with its type, the
+// transaction id and the LSN of the previous record of the transaction.
+//-----------------------------------------------------------------------------
+enum {
+    LOG_DBREG_REGISTER  = 2,
+    LOG_TXN_REGOP       = 10,
+    LOG_TXN_CHILD       = 12,
+    LOG_DB_ADDREM       = 41,
+    LOG_BAM_CDEL        = 57,
+    LOG_BAM_REPL        = 58,
+
+    LOG_DEBUG_FLAG      = 0x80000000,
+    LOG_HEADER          = 16,
+
+    LOG_TXN_COMMIT      = 1,
+    LOG_ADD_DUP         = 1,    // __db_addrem mode, above the page type
+    LOG_REM_DUP         = 2,
+    LOG_OP_MODE_SHIFT   = 8
+};
+
+//-----------------------------------------------------------------------------
+// LogRecord
+//  Bounds checked reader of the fields of a log record
+//-----------------------------------------------------------------------------
+class LogRecord {
+public:
+    LogRecord(const Dbt &rec)
+        : _pos((const uint8_t *)rec.get_data()),
+          _end(_pos + rec.get_size()) {}
+
+    bool U32(uint32_t &v) {
+        if (_pos + sizeof(v) > _end) {
+            return false;
+        }
+        memcpy(&v, _pos, sizeof(v));
+        _pos += sizeof(v);
+        return true;
+    }
+
+    // DBT fields are a length and the bytes
+    bool Bytes(const uint8_t *&data, uint32_t &len) {
+        if (!U32(len) || len > (size_t)(_end - _pos)) {
+            return false;
+        }
+        data = _pos;
+        _pos += len;
+        return true;
+    }
+
+    bool Skip(size_t len) {
+        if (len > (size_t)(_end - _pos)) {
+            return false;
+        }
+        _pos += len;
+        return true;
+    }
+
+private:
+    const uint8_t *_pos;
+    const uint8_t *_end;
+};
+
+//-----------------------------------------------------------------------------
+// LogTail
+//  Change data capture from the transaction log of the environment. The
+//  log is read from where the previous run stopped, and the keys of the DB
+//  touched by committed transactions are collected: from the log record
+//  when it holds the key item, otherwise from the leaf page it names, read
+//  through the shared cache. Their current records are then printed, so
+//  the output can be applied downstream in any order and more than once.
+//
+//  Keys of in place updates are read from the page as it is now, and only
+//  if no later record changed it; other changes, like removals of values,
+//  are counted but not tied to a key, as are changes in off page
+//  duplicate trees.
+//-----------------------------------------------------------------------------
+class LogTail {
+public:
+    LogTail(DbEnv &env, Db &dbh, const string &dbfile);
+    ~LogTail();
+
+    // Position and file ids saved by the previous run, false if none
+    bool LoadState(const string &state);
+    bool SaveState(const string &state) const;
+
+    // Walk the log to its end. Without a saved position it only learns the
+    // file ids and stops at the end, for the next run to start from.
+    int Scan();
+
+    // Print '+' and the records of changed keys, or '-' and gone keys
+    int Print(const string &keyfmt, const string &valfmt, OutBuf &out);
+
+private:
+    struct Txn {
+        DbLsn first;            // Where the transaction began in the log
+        set<string> keys;
+    };
+
+    void Record(const DbLsn &lsn, const Dbt &rec);
+    void Change(uint32_t txnid, const DbLsn &lsn, const string &key);
+    bool PageKey(uint32_t fileid, uint32_t pgno, uint32_t idx,
+                 const DbLsn &lsn, string &key);
+    bool Ours(uint32_t fileid) const;
+
+    DbEnv &_env;
+    Db &_dbh;
+    string _dbfile;             // File name of the DB, as registered
+    uint32_t _pgsize;
+    bool _bSaved;
+    DbLsn _lsn;                 // Resume point
+    bool _bInclusive;           // Resume point not processed yet
+    map<uint32_t, string> _files;
+    map<uint32_t, DbMpoolFile *> _mpfs;
+    map<uint32_t, Txn> _txns;   // Open transactions
+    set<string> _changed;
+    set<pair<uint32_t, uint32_t> > _deletes;    // Keys of deletes to come
+    pair<uint32_t, uint32_t> _added;            // Key of the last addition
+    size_t _unresolved;
+};
+
+LogTail::LogTail(DbEnv &env, Db &dbh, const string &dbfile)
+    : _env(env), _dbh(dbh), _pgsize(0), _bSaved(false), _bInclusive(false),
+      _added(0, 1), _unresolved(0)
+{
+    size_t pos = dbfile.find_last_of("/");
+    _dbfile = (string::npos == pos) ? dbfile : dbfile.substr(pos + 1);
+    _dbh.get_pagesize(&_pgsize);
+}
+
+LogTail::~LogTail()
+{
+    for (map<uint32_t, DbMpoolFile *>::iterator it = _mpfs.begin();
+         it != _mpfs.end(); ++it) {
+        if (it->second) {
+            it->second->close(0);
+        }
+    }
+}
+
+bool
+LogTail::LoadState(const string &state)
+{
+    ifstream in(state.c_str());
+    if (!in) {
+        return false;
+    }
+
+    for (string line; getline(in, line); ) {
+        char name[4096];
+        unsigned a, b, c;
+        if (3 == sscanf(line.c_str(), "lsn %u %u %u", &a, &b, &c)) {
+            _lsn.file = a;
+            _lsn.offset = b;
+            _bInclusive = (0 != c);
+            _bSaved = true;
+        } else if (2 == sscanf(line.c_str(), "fileid %u %4095s", &a, name)) {
+            _files[a] = name;
+        }
+    }
+
+    return _bSaved;
+}
+
+bool
+LogTail::SaveState(const string &state) const
+{
+    // Replace the old state only once the new one is complete
+    string tmp = state + ".tmp";
+    {
+        ofstream out(tmp.c_str());
+        out << "lsn " << _lsn.file << " " << _lsn.offset << " "
+            << (_bInclusive ? 1 : 0) << "\n";
+        for (map<uint32_t, string>::const_iterator it = _files.begin();
+             it != _files.end(); ++it) {
+            out << "fileid " << it->first << " " << it->second << "\n";
+        }
+        if (!out.flush()) {
+            return false;
+        }
+    }
+
+    return 0 == rename(tmp.c_str(), state.c_str());
+}
+
+bool
+LogTail::Ours(uint32_t fileid) const
+{
+    map<uint32_t, string>::const_iterator it = _files.find(fileid);
+    if (it == _files.end()) {
+        return false;
+    }
+
+    size_t pos = it->second.find_last_of("/");
+    return _dbfile == ((string::npos == pos)
+                       ? it->second : it->second.substr(pos + 1));
+}
+
+//  Key of the pair holding item 'idx' of a BTREE leaf page, only while the
+//  page is as the record at 'lsn' left it: after later changes the item
+//  may hold another key, or none
+bool
+LogTail::PageKey(uint32_t fileid, uint32_t pgno, uint32_t idx,
+                 const DbLsn &lsn, string &key)
+{
+    DbMpoolFile *&mpf = _mpfs[fileid];
+    if (!mpf) {
+        if (_env.memp_fcreate(&mpf, 0)) {
+            mpf = NULL;
+            return false;
+        }
+        if (mpf->open(_files[fileid].c_str(), DB_RDONLY, 0, _pgsize)) {
+            mpf->close(0);
+            mpf = NULL;
+            return false;
+        }
+    }
+
+    uint8_t *page = NULL;
+    if (mpf->get(&pgno, NULL, 0, &page)) {
+        return false;
+    }
+
+    bool bFound = false;
+    idx &= ~1u;
+    uint16_t entries = Load<uint16_t>(page + PG_ENTRIES);
+    if (Load<uint32_t>(page) == lsn.file &&
+        Load<uint32_t>(page + 4) == lsn.offset &&
+        PG_LBTREE == page[PG_TYPE] && idx < entries &&
+        PG_OVERHEAD + entries * sizeof(uint16_t) <= _pgsize) {
+        uint16_t off = Load<uint16_t>(page + PG_OVERHEAD +
+                                      idx * sizeof(uint16_t));
+        const uint8_t *item = page + off;
+        uint16_t len = Load<uint16_t>(item);
+        uint8_t type = item[2] & ~PG_B_DELETE;
+        if (PG_B_KEYDATA == type && off + 3u + len <= _pgsize) {
+            key.assign((const char *)item + 3, len);
+            bFound = true;
+        } else if (PG_B_OVERFLOW == type && off + 12u <= _pgsize) {
+            // Gather the chain of overflow pages
+            uint32_t next = Load<uint32_t>(item + 4);
+            uint32_t tlen = Load<uint32_t>(item + 8);
+            key.clear();
+            while (next && key.size() < tlen) {
+                uint8_t *ovfl = NULL;
+                if (mpf->get(&next, NULL, 0, &ovfl)) {
+                    break;
+                }
+                uint16_t used = Load<uint16_t>(ovfl + PG_HFOFFSET);
+                key.append((const char *)ovfl + PG_OVERHEAD,
+                           min((size_t)used, (size_t)_pgsize - PG_OVERHEAD));
+                next = Load<uint32_t>(ovfl + PG_NEXTPGNO);
+                mpf->put(ovfl, DB_PRIORITY_UNCHANGED, 0);
+            }
+            bFound = (key.size() == tlen);
+        }
+    }
+
+    mpf->put(page, DB_PRIORITY_UNCHANGED, 0);
+
+    return bFound;
+}
+
+void
+LogTail::Change(uint32_t txnid, const DbLsn &lsn, const string &key)
+{
+    // Outside of transactions changes are final right away
+    if (0 == txnid) {
+        _changed.insert(key);
+        return;
+    }
+
+    map<uint32_t, Txn>::iterator it = _txns.find(txnid);
+    if (it == _txns.end()) {
+        it = _txns.insert(make_pair(txnid, Txn())).first;
+        it->second.first = lsn;
+    }
+    it->second.keys.insert(key);
+}
+
+void
+LogTail::Record(const DbLsn &lsn, const Dbt &rec)
+{
+    LogRecord log(rec);
+    uint32_t type, txnid;
+    if (!log.U32(type) || !log.U32(txnid) || !log.Skip(sizeof(DB_LSN))) {
+        return;
+    }
+
+    uint32_t opcode, fileid, pgno, idx;
+    switch (type & ~LOG_DEBUG_FLAG) {
+        case LOG_DBREG_REGISTER: {
+            const uint8_t *name, *uid;
+            uint32_t len, uidlen;
+            if (log.U32(opcode) && log.Bytes(name, len) &&
+                log.Bytes(uid, uidlen) && log.U32(fileid) && len) {
+                _files[fileid] = string((const char *)name,
+                                        strnlen((const char *)name, len));
+            }
+            break;
+        }
+        case LOG_TXN_REGOP: {
+            map<uint32_t, Txn>::iterator it = _txns.find(txnid);
+            if (it == _txns.end() || !log.U32(opcode)) {
+                break;
+            }
+            if (LOG_TXN_COMMIT == opcode) {
+                _changed.insert(it->second.keys.begin(),
+                                it->second.keys.end());
+            }
+            _txns.erase(it);
+            break;
+        }
+        case LOG_TXN_CHILD: {
+            // A committed child hands its changes to the parent
+            uint32_t child;
+            map<uint32_t, Txn>::iterator it;
+            if (!log.U32(child) || (it = _txns.find(child)) == _txns.end()) {
+                break;
+            }
+            for (set<string>::iterator key = it->second.keys.begin();
+                 key != it->second.keys.end(); ++key) {
+                Change(txnid, it->second.first, *key);
+            }
+            _txns.erase(it);
+            break;
+        }
+        case LOG_DB_ADDREM: {
+            const uint8_t *hdr, *data;
+            uint32_t hdrlen, datalen, nbytes;
+            if (!log.U32(opcode) || !log.U32(fileid) || !Ours(fileid) ||
+                !log.U32(pgno) || !log.U32(idx) || !log.U32(nbytes) ||
+                !log.Bytes(hdr, hdrlen) || !log.Bytes(data, datalen)) {
+                break;
+            }
+
+            uint32_t mode = opcode >> LOG_OP_MODE_SHIFT;
+            if (PG_LBTREE != (opcode & 0xff) ||
+                (LOG_ADD_DUP != mode && LOG_REM_DUP != mode)) {
+                _unresolved++;
+                break;
+            }
+
+            // Key items carry the key. An addition logs the bytes, with
+            // no header unless the item is not plain data, and a removal
+            // the whole item as the header. Removing a pair takes the key
+            // then, at the same index, its value flagged deleted by the
+            // cursor delete logged before, which settles both. A value
+            // added right after its key is settled too. The key of any
+            // other value is on the page, unless the value is gone.
+            string key;
+            pair<uint32_t, uint32_t> added = _added;
+            _added = make_pair(0u, 1u);
+            bool bKeyData = hdrlen >= 3 &&
+                PG_B_KEYDATA == (hdr[2] & ~PG_B_DELETE);
+            bool bDeleted = hdrlen >= 3 && (hdr[2] & PG_B_DELETE);
+            if ((LOG_REM_DUP == mode && bDeleted) ||
+                (LOG_ADD_DUP == mode && added == make_pair(pgno, idx - 1))) {
+                break;
+            } else if (0 == (idx & 1) && LOG_ADD_DUP == mode &&
+                       (0 == hdrlen || bKeyData)) {
+                key.assign((const char *)data, datalen);
+                _added = make_pair(pgno, idx);
+            } else if (0 == (idx & 1) && LOG_REM_DUP == mode && bKeyData &&
+                       3u + Load<uint16_t>(hdr) <= hdrlen) {
+                key.assign((const char *)hdr + 3, Load<uint16_t>(hdr));
+                _deletes.erase(make_pair(pgno, idx));
+            } else if (LOG_REM_DUP == mode ||
+                       !PageKey(fileid, pgno, idx, lsn, key)) {
+                _unresolved++;
+                break;
+            }
+            Change(txnid, lsn, key);
+            break;
+        }
+        case LOG_BAM_CDEL:
+        case LOG_BAM_REPL: {
+            string key;
+            if (!log.U32(fileid) || !Ours(fileid) || !log.U32(pgno) ||
+                !log.Skip(sizeof(DB_LSN)) || !log.U32(idx)) {
+                break;
+            }
+            if (PageKey(fileid, pgno, idx, lsn, key)) {
+                Change(txnid, lsn, key);
+            } else if (LOG_BAM_CDEL == (type & ~LOG_DEBUG_FLAG)) {
+                // Usually followed by the removal of the key
+                _deletes.insert(make_pair(pgno, idx & ~1u));
+            } else {
+                _unresolved++;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int
+LogTail::Scan()
+{
+    DbLogc *logc = NULL;
+    int ret = _env.log_cursor(&logc, 0);
+    if (0 != ret) {
+        cerr << "Error: Failed to open log cursor with error " << ret
+             << endl;
+        return ret;
+    }
+
+    DbLsn lsn = _lsn;
+    DbLsn last = lsn;
+    Dbt rec;
+    if (_bSaved) {
+        ret = logc->get(&lsn, &rec, DB_SET);
+        if (0 != ret) {
+            cerr << "Error: Saved LSN " << lsn.file << "/" << lsn.offset
+                 << " is no longer in the log, a full dump is needed"
+                 << endl;
+            logc->close(0);
+            return ret;
+        }
+        if (_bInclusive) {
+            Record(lsn, rec);
+        }
+
+        // The saved record is done either way
+        last = lsn;
+        ret = logc->get(&lsn, &rec, DB_NEXT);
+    } else {
+        ret = logc->get(&lsn, &rec, DB_FIRST);
+    }
+
+    for (; 0 == ret; ret = logc->get(&lsn, &rec, DB_NEXT)) {
+        if (_bSaved) {
+            Record(lsn, rec);
+        } else {
+            // First run: learn the file ids, no changes yet
+            uint32_t type = 0;
+            memcpy(&type, rec.get_data(), min((size_t)rec.get_size(),
+                                              sizeof(type)));
+            if (LOG_DBREG_REGISTER == (type & ~LOG_DEBUG_FLAG)) {
+                Record(lsn, rec);
+            }
+        }
+        last = lsn;
+    }
+    logc->close(0);
+
+    if (DB_NOTFOUND != ret) {
+        cerr << "Error: Failed to read the log with error " << ret << endl;
+        return ret;
+    }
+
+    // Transactions still open are read again by the next run
+    _lsn = last;
+    _bInclusive = false;
+    for (map<uint32_t, Txn>::iterator it = _txns.begin(); it != _txns.end();
+         ++it) {
+        const DbLsn &first = it->second.first;
+        if (!_bInclusive || first.file < _lsn.file ||
+            (first.file == _lsn.file && first.offset < _lsn.offset)) {
+            _lsn = first;
+            _bInclusive = true;
+        }
+    }
+
+    _unresolved += _deletes.size();
+    _deletes.clear();
+    if (_unresolved) {
+        cerr << "Warning: " << _unresolved << " changes could not be tied"
+             << " to a key" << endl;
+    }
+
+    return 0;
+}
+
+int
+LogTail::Print(const string &keyfmt, const string &valfmt, OutBuf &out)
+{
+    Dbc *cur = NULL;
+    int ret = _dbh.cursor(NULL, &cur, 0);
+    if (0 != ret) {
+        return ret;
+    }
+
+    FormatPlan keyPlan(keyfmt);
+    string kf = keyfmt, vf = valfmt;
+    PrintData<mds_rec_t> p(kf, vf, out, false);
+
+    if (!_changed.empty()) {
+        out << "#key:value\n";
+    }
+
+    for (set<string>::iterator it = _changed.begin();
+         0 == ret && it != _changed.end(); ++it) {
+        Dbt key((void *)it->data(), it->size()), val;
+        ret = cur->get(&key, &val, DB_SET);
+        if (DB_NOTFOUND == ret) {
+            out << '-';
+            keyPlan.Print(out, it->data(), it->size());
+            out << '\n';
+            ret = 0;
+            continue;
+        }
+
+        // Every duplicate of the key
+        for (; 0 == ret; ret = cur->get(&key, &val, DB_NEXT_DUP)) {
+            mds_rec_t rec(key, val);
+            out << '+';
+            p(rec);
+        }
+        if (DB_NOTFOUND == ret) {
+            ret = 0;
+        }
+    }
+
+    cur->close();
+    if (0 != ret) {
+        cerr << "Error: Failed to read DB with error " << ret << endl;
+    }
+
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// KeyRangeLess
+//  Orders key ranges by their start, open starts first
+//-----------------------------------------------------------------------------
+static bool
+KeyRangeLess(const KeyRange &a, const KeyRange &b)
+{
+    if (!a.bFrom || !b.bFrom) {
+        return !a.bFrom && b.bFrom;
+    }
+
+    return CompareKeys(a.from.data(), a.from.size(),
+                       b.from.data(), b.from.size()) < 0;
+}
+
+//-----------------------------------------------------------------------------
+// ParseKeyRanges
+//  Build the key ranges of --from/--to and --prefix, sorted by start with
+//  overlapping ones merged, so that no key is dumped twice
+//-----------------------------------------------------------------------------
+static bool
+ParseKeyRanges(const string &keyfmt, const string *from, const string *to,
+               const vector<string> &prefixes, vector<KeyRange> &ranges)
+{
+    FormatPlan plan(keyfmt);
+    vector<KeyRange> all;
+
+    if (from || to) {
+        KeyRange range;
+        if (from) {
+            range.bFrom = plan.Encode(*from, range.from, false);
+            if (!range.bFrom) {
+                cerr << "Error: Invalid key \"" << *from << "\"" << endl;
+                return false;
+            }
+        }
+        if (to) {
+            range.bTo = plan.Encode(*to, range.to, false);
+            range.bToPrefix = true;
+            if (!range.bTo) {
+                cerr << "Error: Invalid key \"" << *to << "\"" << endl;
+                return false;
+            }
+        }
+        all.push_back(range);
+    }
+
+    for (size_t cc = 0; cc < prefixes.size(); cc++) {
+        KeyRange range;
+        if (!plan.Encode(prefixes[cc], range.from, true)) {
+            cerr << "Error: Invalid key prefix \"" << prefixes[cc] << "\""
+                 << endl;
+            return false;
+        }
+        range.to = range.from;
+        range.bFrom = range.bTo = range.bToPrefix = true;
+        all.push_back(range);
+    }
+
+    // Every end includes the keys it prefixes, so a range that starts
+    // before the end of the previous one overlaps it, and the merge ends
+    // at whichever end reaches further
+    stable_sort(all.begin(), all.end(), KeyRangeLess);
+    for (size_t cc = 0; cc < all.size(); cc++) {
+        KeyRange &last = ranges.empty() ? all[cc] : ranges.back();
+        if (ranges.empty() ||
+            last.Past(all[cc].from.data(), all[cc].from.size())) {
+            ranges.push_back(all[cc]);
+        } else if (!all[cc].bTo) {
+            last.bTo = false;
+        } else if (last.Past(all[cc].to.data(), all[cc].to.size())) {
+            last.to = all[cc].to;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// SplitDbPath
+//  Folder, file name and table name of a DB file. The table is named after
+//  the file, with '_' in place of the extension dot.
+//-----------------------------------------------------------------------------
+static void
+SplitDbPath(const string &dbfile, string &dbdir, string &dbfilebase,
+            string &dbname)
+{
+    size_t pos = dbfile.find_last_of("/");
+    if (string::npos == pos) {
+        dbfilebase = dbfile;
+        dbdir = "./";
+    } else {
+        dbfilebase = dbfile.substr(pos + 1);
+        dbdir = dbfile.substr(0, pos);
+    }
+
+    dbname = dbfilebase;
+    pos = dbfilebase.find_last_of(".");
+    if (string::npos != pos) {
+        dbname[pos] = '_';
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// OpenName
+//  Table name to open a DB file with. QUEUEs are one per file and have none.
+//-----------------------------------------------------------------------------
+static const char *
+OpenName(const string &dbfile, const string &dbname)
+{
+    uint8_t meta[PG_META_MAGIC + sizeof(uint32_t)];
+    int fd = open(dbfile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return dbname.c_str();
+    }
+    ssize_t got = pread(fd, meta, sizeof(meta), 0);
+    close(fd);
+    if ((ssize_t)sizeof(meta) != got) {
+        return dbname.c_str();
+    }
+
+    uint32_t magic = Load<uint32_t>(meta + PG_META_MAGIC);
+    return (PG_QAMMAGIC == magic || PG_QAMMAGIC == bswap_32(magic))
+        ? NULL : dbname.c_str();
+}
+
+//-----------------------------------------------------------------------------
+// JoinTable
+//  Multimap of byte strings for the hash join. Entries are packed back to
+//  back in one buffer as [klen][vlen][key][val] and found through an open
+//  addressing table of their offsets, tagged with the high bits of the hash.
+//-----------------------------------------------------------------------------
+class JoinTable {
+public:
+    JoinTable() : _count(0), _mask(0) {}
+
+    void Insert(const void *key, size_t klen, const void *val, size_t vlen);
+
+    // Next value of 'key', 'probe' starts at 0 and is kept between calls
+    bool Find(const void *key, size_t klen, size_t &probe,
+              const char *&val, size_t &vlen) const;
+
+    size_t Size() const { return _count; }
+
+private:
+    static const int TAG_SHIFT = 40;    // Room for offsets up to 1TB
+    static const uint64_t OFF_MASK = (1ULL << TAG_SHIFT) - 1;
+
+    void Grow();
+    void Place(uint64_t hash, uint64_t slot);
+
+    vector<char> _arena;
+    vector<uint64_t> _slots;    // 0 when empty, else tag | (offset + 1)
+    size_t _count;
+    uint64_t _mask;
+};
+
+void
+JoinTable::Insert(const void *key, size_t klen, const void *val, size_t vlen)
+{
+    // At most half full, probes stay short
+    if (2 * (_count + 1) > _slots.size()) {
+        Grow();
+    }
+
+    uint64_t off = _arena.size();
+    uint32_t lens[2] = { (uint32_t)klen, (uint32_t)vlen };
+    _arena.insert(_arena.end(), (const char *)lens, (const char *)(lens + 2));
+    _arena.insert(_arena.end(), (const char *)key, (const char *)key + klen);
+    _arena.insert(_arena.end(), (const char *)val, (const char *)val + vlen);
+
+    Place(Hash64(key, klen), off + 1);
+    _count++;
+}
+
+void
+JoinTable::Place(uint64_t hash, uint64_t slot)
+{
+    uint64_t idx = hash & _mask;
+    while (_slots[idx]) {
+        idx = (idx + 1) & _mask;
+    }
+    _slots[idx] = (hash & ~OFF_MASK) | slot;
+}
+
+void
+JoinTable::Grow()
+{
+    vector<uint64_t> old;
+    old.swap(_slots);
+    _slots.assign(old.empty() ? 1024 : 2 * old.size(), 0);
+    _mask = _slots.size() - 1;
+
+    // The keys are still in the arena
+    for (size_t cc = 0; cc < old.size(); cc++) {
+        if (old[cc]) {
+            uint64_t slot = old[cc] & OFF_MASK;
+            const uint8_t *entry = (const uint8_t *)&_arena[slot - 1];
+            Place(Hash64(entry + 8, Load<uint32_t>(entry)), slot);
+        }
+    }
+}
+
+bool
+JoinTable::Find(const void *key, size_t klen, size_t &probe,
+                const char *&val, size_t &vlen) const
+{
+    if (_slots.empty()) {
+        return false;
+    }
+
+    uint64_t hash = Hash64(key, klen);
+    for (uint64_t idx = (hash + probe) & _mask; _slots[idx];
+         idx = (idx + 1) & _mask) {
+        probe++;
+        if ((_slots[idx] & ~OFF_MASK) != (hash & ~OFF_MASK)) {
+            continue;
+        }
+
+        const uint8_t *entry =
+            (const uint8_t *)&_arena[(_slots[idx] & OFF_MASK) - 1];
+        if (Load<uint32_t>(entry) == klen &&
+            0 == memcmp(entry + 8, key, klen)) {
+            val = (const char *)entry + 8 + klen;
+            vlen = Load<uint32_t>(entry + 4);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Join
+//  Resolve a field of the dumped records through the keys of another DB,
+//  given as file[:k|:v][.N]: the whole key by default, the value, or field
+//  N of either. A join on the key of two BTREEs walks both in key order,
+//  any other looks the field up in a hash table loaded with the other DB.
+//-----------------------------------------------------------------------------
+typedef pair<const char *, size_t> JoinMatch;
+
+class Join {
+public:
+    explicit Join(DbEnv *envp)
+        : _dbh(envp, DB_CXX_NO_EXCEPTIONS), _type(DB_UNKNOWN), _bKey(true),
+          _field(-1), _keyPlan(NULL), _valPlan(NULL), _bMerge(false),
+          _reader(NULL), _bMore(false), _bCached(false) {}
+    ~Join() { delete _reader; _dbh.close(0); }
+
+    // Parse the spec, open its DB and settle its formats
+    bool Open(const string &spec);
+
+    // True if records walked in key order of a 'type' DB can be merged
+    bool CanMerge(DBTYPE type) const {
+        return DB_BTREE == type && DB_BTREE == _type && _bKey && _field < 0;
+    }
+
+    // Get ready for the records of a 'type' DB in these formats, loading
+    // the hash table unless 'bLoad' is false
+    int Prepare(DBTYPE type, const FormatPlan &keyPlan,
+                const FormatPlan &valPlan, bool bLoad = true);
+
+    // Bytes of the joined field of a record, false if the record is short
+    bool Field(const Dbt &key, const Dbt &val,
+               const char *&data, size_t &len) const;
+
+    // Values matching a record, valid until the next call
+    const vector<JoinMatch> &Lookup(const Dbt &key, const Dbt &val);
+
+    Db &Handle() { return _dbh; }
+    const string &File() const { return _file; }
+    FormatPlan &ValPlan() { return _valFmt; }
+
+private:
+    Db _dbh;
+    DBTYPE _type;
+    string _file;
+    bool _bKey;                 // Join on the key, else on the value
+    int _field;                 // Field of it, -1 for all of it
+    const FormatPlan *_keyPlan; // Formats of the records joined
+    const FormatPlan *_valPlan;
+    FormatPlan _valFmt;         // Format of the values of this DB
+
+    bool _bMerge;
+    BulkReader *_reader;        // Merge: next record of this DB
+    bool _bMore;
+    Dbt _key, _val;
+    bool _bCached;              // Merge: values of the last key looked up
+    string _lastKey;
+    vector<string> _values;
+
+    JoinTable _table;           // Hash: all records of this DB
+    vector<JoinMatch> _matches;
+};
+
+bool
+Join::Open(const string &spec)
+{
+    // The suffix is optional, file names may hold ':'
+    _file = spec;
+    size_t pos = spec.find_last_of(":");
+    if (string::npos != pos && pos + 1 < spec.size() &&
+        ('k' == spec[pos + 1] || 'v' == spec[pos + 1])) {
+        string suffix = spec.substr(pos + 2);
+        char *end = NULL;
+        long field = suffix.empty() ? -1
+            : ('.' == suffix[0] && suffix.size() > 1)
+                ? strtol(suffix.c_str() + 1, &end, 10) : -2;
+        if (field >= -1 && (NULL == end || '\0' == *end)) {
+            _file = spec.substr(0, pos);
+            _bKey = ('k' == spec[pos + 1]);
+            _field = (int)field;
+        }
+    }
+
+    string dbdir, dbfilebase, dbname;
+    SplitDbPath(_file, dbdir, dbfilebase, dbname);
+
+    if (_dbh.open(NULL, _file.c_str(), dbname.c_str(), DB_UNKNOWN,
+                  DB_RDONLY, 0) || _dbh.get_type(&_type)) {
+        cerr << "Error: Failed to open DB \"" << _file << "\"" << endl;
+        return false;
+    }
+
+    if (DB_BTREE != _type && DB_HASH != _type) {
+        cerr << "Error: --join needs a BTREE or HASH DB, not \""
+             << _file << "\"" << endl;
+        return false;
+    }
+
+    string keyfmt, valfmt;
+    GetDefaultFormats(dbfilebase, keyfmt, valfmt);
+    ResolveFormats(_dbh, KeyRange(), keyfmt, valfmt);
+    _valFmt.Compile(valfmt);
+
+    return true;
+}
+
+int
+Join::Prepare(DBTYPE type, const FormatPlan &keyPlan,
+              const FormatPlan &valPlan, bool bLoad)
+{
+    _keyPlan = &keyPlan;
+    _valPlan = &valPlan;
+
+    if (_field >= (int)(_bKey ? keyPlan : valPlan).Size()) {
+        cerr << "Error: --join field " << (_bKey ? "k." : "v.") << _field
+             << " is not in the format" << endl;
+        return -1;
+    }
+
+    _bMerge = CanMerge(type);
+    if (_bMerge) {
+        _reader = new BulkReader(_dbh);
+        _bMore = _reader->Next(_key, _val);
+        return _reader->Error();
+    }
+
+    if (!bLoad) {
+        return 0;
+    }
+
+    BulkReader reader(_dbh);
+    Dbt key, val;
+    while (reader.Next(key, val)) {
+        _table.Insert(key.get_data(), key.get_size(),
+                      val.get_data(), val.get_size());
+    }
+
+    if (0 != reader.Error()) {
+        cerr << "Error: Failed to read DB \"" << _file << "\" with error "
+             << reader.Error() << endl;
+    }
+
+    return reader.Error();
+}
+
+bool
+Join::Field(const Dbt &key, const Dbt &val,
+            const char *&data, size_t &len) const
+{
+    const Dbt &rec = _bKey ? key : val;
+    data = (const char *)rec.get_data();
+    len = rec.get_size();
+    if (_field < 0) {
+        return true;
+    }
+
+    const FormatPlan &plan = _bKey ? *_keyPlan : *_valPlan;
+    size_t off = 0;
+    if (!plan.Locate(data, len, _field, off, len)) {
+        return false;
+    }
+
+    // Keys hold their strings with the NUL, unless of a fixed size or
+    // after a length
+    const FieldPlan &field = plan[_field];
+    if (F_STR == field.type && !field.elem && !field.lenWidth &&
+        off + len < rec.get_size()) {
+        len++;
+    }
+    data += off;
+
+    return true;
+}
+
+const vector<JoinMatch> &
+Join::Lookup(const Dbt &key, const Dbt &val)
+{
+    _matches.clear();
+
+    const char *data = NULL;
+    size_t len = 0;
+    if (!Field(key, val, data, len)) {
+        return _matches;
+    }
+
+    if (!_bMerge) {
+        size_t probe = 0;
+        JoinMatch match;
+        while (_table.Find(data, len, probe, match.first, match.second)) {
+            _matches.push_back(match);
+        }
+        return _matches;
+    }
+
+    // Keys come in order, skip ahead to this one once
+    if (!_bCached || 0 != CompareKeys(_lastKey.data(), _lastKey.size(),
+                                      data, len)) {
+        _values.clear();
+        while (_bMore && CompareKeys(_key.get_data(), _key.get_size(),
+                                     data, len) < 0) {
+            _bMore = _reader->Next(_key, _val);
+        }
+        while (_bMore && 0 == CompareKeys(_key.get_data(), _key.get_size(),
+                                          data, len)) {
+            _values.push_back(string((const char *)_val.get_data(),
+                                     _val.get_size()));
+            _bMore = _reader->Next(_key, _val);
+        }
+
+        _lastKey.assign(data, len);
+        _bCached = true;
+    }
+
+    for (size_t cc = 0; cc < _values.size(); cc++) {
+        _matches.push_back(JoinMatch(_values[cc].data(), _values[cc].size()));
+    }
+
+    return _matches;
+}
+
+//-----------------------------------------------------------------------------
+// PrintJoined
+//  Print a record followed by one value per join, a row for every
+//  combination of the matches
+//-----------------------------------------------------------------------------
+static void
+PrintJoined(OutBuf &out, FormatPlan &keyPlan, FormatPlan &valPlan,
+            const Dbt &key, const Dbt &val, vector<Join *> &joins,
+            const vector<const vector<JoinMatch> *> &matches)
+{
+    vector<size_t> idx(joins.size(), 0);
+    for (;;) {
+        keyPlan.Print(out, (const char *)key.get_data(), key.get_size());
+        out << ':';
+        valPlan.Print(out, (const char *)val.get_data(), val.get_size());
+        for (size_t jj = 0; jj < joins.size(); jj++) {
+            const JoinMatch &match = (*matches[jj])[idx[jj]];
+            out << ':';
+            joins[jj]->ValPlan().Print(out, match.first, match.second);
+        }
+        out << '\n';
+
+        // Last join moves fastest
+        size_t cc = joins.size();
+        while (cc > 0 && ++idx[cc - 1] == matches[cc - 1]->size()) {
+            idx[--cc] = 0;
+        }
+        if (0 == cc) {
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// JoinDbs
+//  Dump the records of a BTREE or HASH with the values they resolve to in
+//  the joined DBs. Records without a match in every join are left out.
+//  A single hash join loads the smaller side: when the dumped DB is the
+//  smaller one, it is loaded instead and the joined DB is walked, so rows
+//  come in the order of the joined DB. Formats must be resolved.
+//-----------------------------------------------------------------------------
+static int
+JoinDbs(Db &dbh, const string &dbfile, vector<KeyRange> ranges,
+        vector<Join *> &joins, string &keyfmt, string &valfmt,
+        const Filter *filter, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    DBTYPE type = DB_UNKNOWN;
+    dbh.get_type(&type);
+
+    FormatPlan keyPlan(keyfmt), valPlan(valfmt);
+
+    struct stat st, jst;
+    bool bSwap = (1 == joins.size() && !joins[0]->CanMerge(type) &&
+                  0 == stat(dbfile.c_str(), &st) &&
+                  0 == stat(joins[0]->File().c_str(), &jst) &&
+                  st.st_size < jst.st_size);
+
+    int status = 0;
+    for (size_t cc = 0; 0 == status && cc < joins.size(); cc++) {
+        status = joins[cc]->Prepare(type, keyPlan, valPlan, !bSwap);
+    }
+    if (0 != status) {
+        return status;
+    }
+
+    out << "#key:value";
+    for (size_t cc = 0; cc < joins.size(); cc++) {
+        out << ':' << joins[cc]->File();
+    }
+    out << '\n';
+
+    BulkReader reader(dbh);
+    Dbt key, val;
+
+    if (bSwap) {
+        // Records packed as [klen][key][val], by the joined field
+        Join &join = *joins[0];
+        JoinTable table;
+        string rec;
+        for (size_t cc = 0; cc < ranges.size(); cc++) {
+            if (ranges[cc].bFrom) {
+                reader.Seek(ranges[cc].from.data(), ranges[cc].from.size());
+            }
+
+            const char *data = NULL;
+            size_t len = 0;
+            while (NextInRange(reader, ranges[cc], filter, key, val)) {
+                if (!join.Field(key, val, data, len)) {
+                    continue;
+                }
+                uint32_t klen = key.get_size();
+                rec.assign((const char *)&klen, sizeof(klen));
+                rec.append((const char *)key.get_data(), key.get_size());
+                rec.append((const char *)val.get_data(), val.get_size());
+                table.Insert(data, len, rec.data(), rec.size());
+            }
+        }
+
+        if (0 == (status = reader.Error())) {
+            BulkReader other(join.Handle());
+            Dbt okey, oval;
+            vector<JoinMatch> matches(1);
+            vector<const vector<JoinMatch> *> pmatches(1, &matches);
+            while (other.Next(okey, oval)) {
+                matches[0] = JoinMatch((const char *)oval.get_data(),
+                                       oval.get_size());
+
+                size_t probe = 0, sz = 0;
+                const char *ptr = NULL;
+                while (table.Find(okey.get_data(), okey.get_size(), probe,
+                                  ptr, sz)) {
+                    uint32_t klen = Load<uint32_t>((const uint8_t *)ptr);
+                    key.set_data((void *)(ptr + 4));
+                    key.set_size(klen);
+                    val.set_data((void *)(ptr + 4 + klen));
+                    val.set_size(sz - 4 - klen);
+                    PrintJoined(out, keyPlan, valPlan, key, val, joins,
+                                pmatches);
+                }
+            }
+            status = other.Error();
+        }
+    } else {
+        vector<const vector<JoinMatch> *> matches(joins.size());
+        for (size_t cc = 0; cc < ranges.size(); cc++) {
+            if (ranges[cc].bFrom) {
+                reader.Seek(ranges[cc].from.data(), ranges[cc].from.size());
+            }
+
+            while (NextInRange(reader, ranges[cc], filter, key, val)) {
+                bool bMatch = true;
+                for (size_t jj = 0; bMatch && jj < joins.size(); jj++) {
+                    matches[jj] = &joins[jj]->Lookup(key, val);
+                    bMatch = !matches[jj]->empty();
+                }
+                if (bMatch) {
+                    PrintJoined(out, keyPlan, valPlan, key, val, joins,
+                                matches);
+                }
+            }
+        }
+        status = reader.Error();
+    }
+
+    if (0 != status) {
+        cerr << "Error: Failed to read DB with error " << status << endl;
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// DumpValues
+//  Dump the values of a RECNO or QUEUE DB, or their stats
+//-----------------------------------------------------------------------------
+static int
+DumpValues(Db &dbh, string valfmt, const string &expr, bool bStats,
+           OutBuf &out)
+{
+    // Record numbers are not part of the value format
+    Filter filter("", valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+    const Filter *pFilter = expr.empty() ? NULL : &filter;
+
+    BulkReader reader(dbh, BULK_BUFSZ, out.Pipelined());
+    if (bStats) {
+        Stats stats("", valfmt, false);
+        StatsLoop(reader, stats, NULL, pFilter);
+        if (0 == reader.Error()) {
+            stats.Report(out);
+        }
+    } else {
+        PrintData<Dbt> p(valfmt, out);
+
+        Dbt key, val;
+        while (reader.Next(key, val)) {
+            if (!pFilter || pFilter->Match(key, val)) {
+                p(val);
+            }
+        }
+    }
+
+    int status = reader.Error();
+    if (0 != status) {
+        cerr << "Error: Failed to read DB with error " << status << endl;
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// Batch
+//  Many DBs dumped by a pool of threads sharing one environment, each to
+//  its own file in the output folder
+//-----------------------------------------------------------------------------
+struct Batch {
+    DbEnv *envp;
+    vector<string> files;
+    vector<int> status;
+    string outdir;
+    string keyfmt;              // Empty to use the defaults of each file
+    string valfmt;
+    string filter;
+    bool bStats;
+    bool bMmap;
+    bool bPipeline;             // Write with a writer thread
+    bool bCompress;
+    volatile size_t next;       // Next file to hand out
+};
+
+//-----------------------------------------------------------------------------
+// DumpFile
+//  Dump one DB of a batch to its output file
+//-----------------------------------------------------------------------------
+static int
+DumpFile(const Batch &batch, const string &dbfile)
+{
+    string dbdir, dbfilebase, dbname;
+    SplitDbPath(dbfile, dbdir, dbfilebase, dbname);
+
+    string keyfmt = batch.keyfmt, valfmt = batch.valfmt;
+    if (keyfmt.empty() || valfmt.empty()) {
+        GetDefaultFormats(dbfilebase, keyfmt, valfmt);
+    }
+
+    string outfile = batch.outdir + "/" + dbfilebase +
+        (batch.bCompress ? ".dump.z" : ".dump");
+    int fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (-1 == fd) {
+        cerr << "Error: Unable to create \"" << outfile << "\"" << endl;
+        return -1;
+    }
+
+    int status = -1;
+    OutBuf out(fd);
+    PageReader pages;
+    if (batch.bPipeline && !out.Pipeline(batch.bCompress)) {
+        cerr << "Error: Unable to write \"" << outfile << "\"" << endl;
+    } else if (batch.bMmap && pages.Open(dbfile, dbname)) {
+        status = DumpPages(pages, keyfmt, valfmt, batch.filter,
+                           batch.bStats, out);
+    } else {
+        Db dbh(batch.envp, DB_CXX_NO_EXCEPTIONS);
+        DBTYPE type = DB_UNKNOWN;
+        if (dbh.open(NULL, dbfile.c_str(), OpenName(dbfile, dbname),
+                     DB_UNKNOWN, DB_RDONLY, 0) || dbh.get_type(&type)) {
+            cerr << "Error: Failed to open DB \"" << dbfile << "\"" << endl;
+        } else if (DB_BTREE == type || DB_HASH == type) {
+            status = DumpKeyRanges(dbh, 1, vector<KeyRange>(), keyfmt,
+                                   valfmt, batch.filter, batch.bStats, out);
+        } else if (DB_RECNO == type || DB_QUEUE == type) {
+            status = DumpValues(dbh, valfmt, batch.filter, batch.bStats,
+                                out);
+        } else {
+            cerr << "Error: Unrecognized DB type " << type << " of \""
+                 << dbfile << "\"" << endl;
+        }
+    }
+
+    if (!out.Flush() && 0 == status) {
+        cerr << "Error: Failed to write \"" << outfile << "\"" << endl;
+        status = -1;
+    }
+    close(fd);
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// BatchWorker
+//  Thread routine: dump files of the batch until none is left
+//-----------------------------------------------------------------------------
+static void *
+BatchWorker(void *arg)
+{
+    Batch *batch = (Batch *)arg;
+
+    size_t idx;
+    while ((idx = __sync_fetch_and_add(&batch->next, 1)) <
+           batch->files.size()) {
+        batch->status[idx] = DumpFile(*batch, batch->files[idx]);
+    }
+
+    return batch;
+}
+
+//-----------------------------------------------------------------------------
+// RunBatch
+//  Dump all files of a batch with 'njobs' threads
+//-----------------------------------------------------------------------------
+static int
+RunBatch(Batch &batch, int njobs)
+{
+    batch.next = 0;
+    batch.status.assign(batch.files.size(), -1);
+
+    vector<pthread_t> threads;
+    for (int cc = 0; cc < njobs && (size_t)cc < batch.files.size(); cc++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, BatchWorker, &batch)) {
+            cerr << "Error: Unable to create worker thread" << endl;
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    // Without any thread, work inline
+    if (threads.empty()) {
+        BatchWorker(&batch);
+    }
+    for (size_t cc = 0; cc < threads.size(); cc++) {
+        pthread_join(threads[cc], NULL);
+    }
+
+    int status = 0;
+    for (size_t cc = 0; cc < batch.files.size(); cc++) {
+        if (0 != batch.status[cc]) {
+            cerr << "Error: Failed to dump \"" << batch.files[cc] << "\""
+                 << endl;
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// AddDbFiles
+//  Add a DB file or the '.db' and '.sdb' files of a folder, in name order
+//-----------------------------------------------------------------------------
+static bool
+AddDbFiles(const string &path, vector<string> &files)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) || !S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return false;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        cerr << "Error: Unable to read folder \"" << path << "\"" << endl;
+        return true;
+    }
+
+    vector<string> names;
+    for (struct dirent *ent; NULL != (ent = readdir(dir)); ) {
+        string name = ent->d_name;
+        size_t pos = name.find_last_of(".");
+        if (string::npos != pos && 0 != pos &&
+            (".db" == name.substr(pos) || ".sdb" == name.substr(pos))) {
+            names.push_back(path + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    sort(names.begin(), names.end());
+    files.insert(files.end(), names.begin(), names.end());
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// DumpBinary
+//  Dump records for --load as a "#binary" line followed by
+//  [klen][key][vlen][val], lengths as 32 bit numbers in host order. Keys of
+//  RECNO and QUEUE are the record numbers.
+//-----------------------------------------------------------------------------
+static int
+DumpBinary(Db &dbh, vector<KeyRange> ranges, string keyfmt, string valfmt,
+           const string &expr, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    DBTYPE type = DB_UNKNOWN;
+    dbh.get_type(&type);
+    bool bKeys = (DB_BTREE == type || DB_HASH == type);
+
+    // Formats only matter to the filter
+    if (!expr.empty() && bKeys) {
+        ResolveFormats(dbh, ranges[0], keyfmt, valfmt);
+    }
+    Filter filter(bKeys ? keyfmt : "", valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+    const Filter *pFilter = expr.empty() ? NULL : &filter;
+
+    out << "#binary\n";
+
+    BulkReader reader(dbh, BULK_BUFSZ, out.Pipelined());
+    for (size_t cc = 0; cc < ranges.size(); cc++) {
+        const KeyRange &range = ranges[cc];
+        if (range.bFrom) {
+            reader.Seek(range.from.data(), range.from.size());
+        }
+
+        Dbt key, val;
+        while (NextInRange(reader, range, pFilter, key, val)) {
+            uint32_t len = key.get_size();
+            out.Write((const char *)&len, sizeof(len));
+            out.Write((const char *)key.get_data(), len);
+            len = val.get_size();
+            out.Write((const char *)&len, sizeof(len));
+            out.Write((const char *)val.get_data(), len);
+        }
+
+        if (0 != reader.Error()) {
+            cerr << "Error: Failed to read DB with error "
+                 << reader.Error() << endl;
+            return reader.Error();
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// ColumnWriter
+//  Columnar export: every field of the key and value formats becomes a
+//  typed column, written in row groups of a fixed number of rows, so that
+//  readers can mmap the file and scan only the columns they need. Numbers
+//  are in host order and every part starts on a multiple of 8 bytes.
+//
+//  Header:     "DBCOLS01", u32 columns, u32 rows per group, then for each
+//              column u32 length and name ("k.0", "v.1"...), u32 length
+//              and type ("u32", "s"...)
+//  Row group:  u64 bytes of the group after this field, u32 rows, u32
+//              columns, then for each column u64 chunk bytes, u32 length
+//              and min value, u32 length and max value; then the chunks
+//  Chunk:      c, i32, u32, i64 and u64 are the values back to back. s and
+//              hex are u32 offsets of the rows + 1 into the bytes that
+//              follow, strings without their NUL. Numbers of another byte
+//              order are swapped, repeated fields keep their elements as
+//              they are, typed like "u32be*", laid out like hex.
+//  End:        a u64 0 in place of a row group
+//
+//  Header, row group header and chunks are each padded to 8 bytes. Fields
+//  missing from short records are zero, or empty.
+//-----------------------------------------------------------------------------
+class ColumnWriter {
+public:
+    ColumnWriter(const string &keyfmt, const string &valfmt,
+                 size_t groupRows, OutBuf &out);
+
+    void Add(const Dbt &key, const Dbt &val);
+
+    // Write the last row group and the end mark
+    void Finish();
+
+private:
+    struct Column {
+        string name;
+        string typeName;
+        FieldType type;         // F_HEX for repeated fields
+        bool bSwap;             // Swapped to host order
+        size_t width;           // 0 for variable length
+        const FormatPlan *plan;
+        size_t idx;             // Field in the plan
+        string data;            // Values of the group
+        vector<uint32_t> offsets;
+        string min;
+        string max;
+    };
+
+    void AddColumns(const FormatPlan &plan, char side);
+    void AddField(Column &col, const char *data, size_t sz);
+    void Flush();
+    void Put32(uint32_t v) { _out.Write((const char *)&v, sizeof(v)); }
+    void Put64(uint64_t v) { _out.Write((const char *)&v, sizeof(v)); }
+    void Pad(size_t len);
+
+    FormatPlan _keyPlan;
+    FormatPlan _valPlan;
+    vector<Column> _columns;
+    size_t _groupRows;
+    size_t _rows;               // In the current group
+    OutBuf &_out;
+};
+
+// Bytes to add to 'len' to reach a multiple of 8
+static inline size_t
+Pad8(size_t len)
+{
+    return (8 - (len & 7)) & 7;
+}
+
+//  Order of two values of a column
+static int
+CompareField(FieldType type, const char *a, size_t alen,
+             const char *b, size_t blen)
+{
+    switch (type) {
+        case F_I32: {
+            int32_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            return (x < y) ? -1 : (x > y);
+        }
+        case F_I64: {
+            int64_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            return (x < y) ? -1 : (x > y);
+        }
+        case F_U32: {
+            uint32_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            return (x < y) ? -1 : (x > y);
+        }
+        case F_U64: {
+            uint64_t x, y;
+            memcpy(&x, a, sizeof(x));
+            memcpy(&y, b, sizeof(y));
+            return (x < y) ? -1 : (x > y);
+        }
+        default:
+            return CompareKeys(a, alen, b, blen);
+    }
+}
+
+ColumnWriter::ColumnWriter(const string &keyfmt, const string &valfmt,
+                           size_t groupRows, OutBuf &out)
+    : _keyPlan(keyfmt), _valPlan(valfmt), _groupRows(groupRows), _rows(0),
+      _out(out)
+{
+    AddColumns(_keyPlan, 'k');
+    AddColumns(_valPlan, 'v');
+
+    size_t len = 16;
+    _out.Write("DBCOLS01", 8);
+    Put32(_columns.size());
+    Put32(_groupRows);
+    for (size_t cc = 0; cc < _columns.size(); cc++) {
+        const Column &col = _columns[cc];
+        Put32(col.name.size());
+        _out.Write(col.name.data(), col.name.size());
+        Put32(col.typeName.size());
+        _out.Write(col.typeName.data(), col.typeName.size());
+        len += 8 + col.name.size() + col.typeName.size();
+    }
+    Pad(Pad8(len));
+}
+
+void
+ColumnWriter::AddColumns(const FormatPlan &plan, char side)
+{
+    for (size_t cc = 0; cc < plan.Size(); cc++) {
+        Column col;
+        char name[32];
+        snprintf(name, sizeof(name), "%c.%u", side, (unsigned)cc);
+        col.name = name;
+        col.type = plan[cc].type;
+        col.bSwap = plan[cc].bSwap;
+        col.typeName = FormatPlan::TypeName(col.type);
+        if (R_NONE != plan[cc].repeat) {
+            col.type = F_HEX;
+            col.bSwap = false;
+            col.typeName = plan.ValueFormat(cc);
+        }
+        col.width = (F_STR == col.type || F_HEX == col.type)
+            ? 0 : plan[cc].width;
+        col.plan = &plan;
+        col.idx = cc;
+        col.offsets.push_back(0);
+        _columns.push_back(col);
+    }
+}
+
+void
+ColumnWriter::Add(const Dbt &key, const Dbt &val)
+{
+    for (size_t cc = 0; cc < _columns.size(); cc++) {
+        Column &col = _columns[cc];
+        const Dbt &rec = (col.plan == &_keyPlan) ? key : val;
+        AddField(col, (const char *)rec.get_data(), rec.get_size());
+    }
+
+    if (++_rows == _groupRows) {
+        Flush();
+    }
+}
+
+void
+ColumnWriter::AddField(Column &col, const char *data, size_t sz)
+{
+    size_t off = 0, len = 0;
+    bool bFound = col.plan->Locate(data, sz, col.idx, off, len);
+
+    const char *ptr = data + off;
+    char swapped[sizeof(uint64_t)];
+    if (col.width) {
+        static const char zeros[sizeof(uint64_t)] = { 0 };
+        len = col.width;
+        if (!bFound) {
+            ptr = zeros;
+        } else if (col.bSwap) {
+            reverse_copy(ptr, ptr + len, swapped);
+            ptr = swapped;
+        }
+        col.data.append(ptr, len);
+    } else {
+        if (!bFound) {
+            len = 0;
+        }
+        col.data.append(ptr, len);
+        col.offsets.push_back(col.data.size());
+    }
+
+    if (0 == _rows ||
+        CompareField(col.type, ptr, len, col.min.data(), col.min.size()) < 0) {
+        col.min.assign(ptr, len);
+    }
+    if (0 == _rows ||
+        CompareField(col.type, ptr, len, col.max.data(), col.max.size()) > 0) {
+        col.max.assign(ptr, len);
+    }
+}
+
+void
+ColumnWriter::Flush()
+{
+    if (0 == _rows) {
+        return;
+    }
+
+    // Sizes first, the group starts with its length
+    size_t header = 8;
+    size_t chunks = 0;
+    vector<size_t> sizes(_columns.size());
+    for (size_t cc = 0; cc < _columns.size(); cc++) {
+        const Column &col = _columns[cc];
+        header += 16 + col.min.size() + col.max.size();
+        sizes[cc] = col.data.size() +
+            (col.width ? 0 : col.offsets.size() * sizeof(uint32_t));
+        chunks += sizes[cc] + Pad8(sizes[cc]);
+    }
+
+    Put64(header + Pad8(header) + chunks);
+    Put32(_rows);
+    Put32(_columns.size());
+    for (size_t cc = 0; cc < _columns.size(); cc++) {
+        const Column &col = _columns[cc];
+        Put64(sizes[cc]);
+        Put32(col.min.size());
+        _out.Write(col.min.data(), col.min.size());
+        Put32(col.max.size());
+        _out.Write(col.max.data(), col.max.size());
+    }
+    Pad(Pad8(header));
+
+    for (size_t cc = 0; cc < _columns.size(); cc++) {
+        Column &col = _columns[cc];
+        if (!col.width) {
+            _out.Write((const char *)&col.offsets[0],
+                       col.offsets.size() * sizeof(uint32_t));
+        }
+        _out.Write(col.data.data(), col.data.size());
+        Pad(Pad8(sizes[cc]));
+
+        col.data.clear();
+        col.offsets.assign(1, 0);
+    }
+
+    _rows = 0;
+}
+
+void
+ColumnWriter::Finish()
+{
+    Flush();
+    Put64(0);
+}
+
+void
+ColumnWriter::Pad(size_t len)
+{
+    static const char zeros[8] = { 0 };
+    _out.Write(zeros, len);
+}
+
+//-----------------------------------------------------------------------------
+// DumpColumns
+//  Export a DB, or key ranges of a BTREE, through a ColumnWriter. Missing
+//  formats are guessed from the first record, the key of RECNO and QUEUE
+//  is the record number.
+//-----------------------------------------------------------------------------
+static int
+DumpColumns(Db &dbh, vector<KeyRange> ranges, string keyfmt, string valfmt,
+            const string &expr, size_t groupRows, OutBuf &out)
+{
+    if (ranges.empty()) {
+        ranges.push_back(KeyRange());
+    }
+
+    DBTYPE type = DB_UNKNOWN;
+    dbh.get_type(&type);
+    if (DB_RECNO == type || DB_QUEUE == type) {
+        keyfmt = "u32";
+    }
+    ResolveFormats(dbh, ranges[0], keyfmt, valfmt);
+
+    Filter filter(keyfmt, valfmt);
+    if (!expr.empty() && !filter.Compile(expr)) {
+        return -1;
+    }
+    const Filter *pFilter = expr.empty() ? NULL : &filter;
+
+    ColumnWriter writer(keyfmt, valfmt, groupRows, out);
+    BulkReader reader(dbh, BULK_BUFSZ, out.Pipelined());
+    for (size_t cc = 0; cc < ranges.size(); cc++) {
+        const KeyRange &range = ranges[cc];
+        if (range.bFrom) {
+            reader.Seek(range.from.data(), range.from.size());
+        }
+
+        Dbt key, val;
+        while (NextInRange(reader, range, pFilter, key, val)) {
+            writer.Add(key, val);
+        }
+
+        if (0 != reader.Error()) {
+            cerr << "Error: Failed to read DB with error "
+                 << reader.Error() << endl;
+            return reader.Error();
+        }
+    }
+    writer.Finish();
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// ReadFull
+//  Read exactly 'len' bytes unless the input ends first
+//-----------------------------------------------------------------------------
+static size_t
+ReadFull(int fd, void *buff, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t cnt = read(fd, (char *)buff + done, len - done);
+        if (cnt < 0 && EINTR == errno) {
+            continue;
+        }
+        if (cnt <= 0) {
+            break;
+        }
+        done += cnt;
+    }
+
+    return done;
+}
+
+//-----------------------------------------------------------------------------
+// ExpandBlocks
+//  Expand the blocks of a --compress output that follow its header line
+//  into 'plain'. False if they are truncated or corrupt.
+//-----------------------------------------------------------------------------
+static bool
+ExpandBlocks(const char *data, size_t size, vector<char> &plain)
+{
+    plain.clear();
+    for (size_t pos = 0; pos < size; ) {
+        uint32_t len, zlen;
+        if (size - pos < 8) {
+            return false;
+        }
+        memcpy(&len, data + pos, sizeof(len));
+        memcpy(&zlen, data + pos + 4, sizeof(zlen));
+        pos += 8;
+        if (zlen > size - pos) {
+            return false;
+        }
+
+        size_t off = plain.size();
+        plain.resize(off + len);
+        if (zlen == len) {
+            memcpy(&plain[off], data + pos, len);
+        } else if (!DecompressBlock(data + pos, zlen, &plain[off], len)) {
+            return false;
+        }
+        pos += zlen;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Decompress
+//  Print the text of a --compress output, block by block
+//-----------------------------------------------------------------------------
+static int
+Decompress(const string &input, OutBuf &out)
+{
+    int fd = ("-" == input) ? STDIN_FILENO : open(input.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error: Unable to open \"" << input << "\"" << endl;
+        return -1;
+    }
+
+    int status = 0;
+    size_t hlen = sizeof(COMPRESS_HEADER) - 1;
+    vector<char> zbuff(hlen), buff;
+    if (ReadFull(fd, &zbuff[0], hlen) != hlen ||
+        0 != memcmp(&zbuff[0], COMPRESS_HEADER, hlen)) {
+        cerr << "Error: \"" << input << "\" is not a compressed dump"
+             << endl;
+        status = -1;
+    }
+
+    for (uint64_t pos = hlen; 0 == status; ) {
+        uint32_t lengths[2];
+        size_t cnt = ReadFull(fd, lengths, sizeof(lengths));
+        if (0 == cnt) {
+            break;
+        }
+
+        // A partial header leaves the lengths unset
+        bool bHeader = (cnt == sizeof(lengths));
+        if (bHeader) {
+            zbuff.resize(max((size_t)lengths[1], (size_t)1));
+            buff.resize(max((size_t)lengths[0], (size_t)1));
+            cnt = ReadFull(fd, &zbuff[0], lengths[1]);
+        }
+        if (!bHeader || cnt != lengths[1] ||
+            (lengths[1] != lengths[0] &&
+             !DecompressBlock(&zbuff[0], lengths[1], &buff[0], lengths[0]))) {
+            cerr << "Error: Corrupt block at offset " << pos << " of \""
+                 << input << "\"" << endl;
+            status = -1;
+            break;
+        }
+
+        out.Write(lengths[1] == lengths[0] ? &zbuff[0] : &buff[0],
+                  lengths[0]);
+        pos += sizeof(lengths) + lengths[1];
+    }
+
+    if (STDIN_FILENO != fd) {
+        close(fd);
+    }
+
+    return status;
+}
+
+//-----------------------------------------------------------------------------
+// LoadRecord
+//  A record to load, laid out as in the binary dump: [klen][key][vlen][val]
+//-----------------------------------------------------------------------------
+struct LoadRecord {
+    explicit LoadRecord(const char *rec) {
+        klen = Load<uint32_t>((const uint8_t *)rec);
+        key = rec + sizeof(uint32_t);
+        vlen = Load<uint32_t>((const uint8_t *)key + klen);
+        val = key + klen + sizeof(uint32_t);
+    }
+
+    const char *key;
+    uint32_t klen;
+    const char *val;
+    uint32_t vlen;
+};
+
+// Key order of two records, for the presort of a BTREE load
+static bool
+LoadKeyLess(const char *a, const char *b)
+{
+    LoadRecord ra(a), rb(b);
+    return CompareKeys(ra.key, ra.klen, rb.key, rb.klen) < 0;
+}
+
+//-----------------------------------------------------------------------------
+// LoadJob
+//  Text lines of a dump parsed into records by one thread
+//-----------------------------------------------------------------------------
+struct LoadJob {
+    const char *begin;          // Whole lines
+    const char *end;
+    const FormatPlan *keyPlan;  // NULL for "#value" dumps
+    const FormatPlan *valPlan;
+    bool bSplitLast;            // The last ':' separates key and value
+    vector<char> arena;         // Records back to back
+    vector<size_t> offsets;     // Of each record in the arena
+    string error;               // First line that does not parse
+};
+
+static void *
+ParseLines(void *arg)
+{
+    LoadJob &job = *(LoadJob *)arg;
+
+    string key, val;
+    const char *line = job.begin;
+    while (line < job.end) {
+        const char *eol = (const char *)memchr(line, '\n', job.end - line);
+        if (NULL == eol) {
+            eol = job.end;
+        }
+        string text(line, eol);
+        line = eol + 1;
+
+        if (text.empty() || '#' == text[0]) {
+            continue;
+        }
+
+        bool bOk = true;
+        if (job.keyPlan) {
+            size_t sep = job.bSplitLast ? text.rfind(':') : text.find(':');
+            bOk = (string::npos != sep) &&
+                job.keyPlan->Encode(text.substr(0, sep), key, false) &&
+                job.valPlan->Encode(text.substr(sep + 1), val, false);
+        } else {
+            key.clear();
+            bOk = job.valPlan->Encode(text, val, false);
+        }
+
+        if (!bOk) {
+            job.error = text;
+            break;
+        }
+
+        uint32_t klen = key.size(), vlen = val.size();
+        job.offsets.push_back(job.arena.size());
+        job.arena.insert(job.arena.end(), (const char *)&klen,
+                         (const char *)(&klen + 1));
+        job.arena.insert(job.arena.end(), key.begin(), key.end());
+        job.arena.insert(job.arena.end(), (const char *)&vlen,
+                         (const char *)(&vlen + 1));
+        job.arena.insert(job.arena.end(), val.begin(), val.end());
+    }
+
+    return NULL;
+}
+
+// True if the format has a string field
+static bool
+HasString(const FormatPlan &plan)
+{
+    for (size_t cc = 0; cc < plan.Size(); cc++) {
+        if (F_STR == plan[cc].type) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// FillBulk
+//  Append records from 'next' on to a bulk buffer, returns how many fit.
+//  Record numbers of values without one follow their position.
+//-----------------------------------------------------------------------------
+static size_t
+FillBulk(Dbt &bulk, const vector<const char *> &recs, size_t next,
+         bool bRecno)
+{
+    size_t cc = next;
+    if (bRecno) {
+        DbMultipleRecnoDataBuilder builder(bulk);
+        for (; cc < recs.size(); cc++) {
+            LoadRecord rec(recs[cc]);
+            db_recno_t recno = (sizeof(recno) == rec.klen)
+                ? Load<db_recno_t>((const uint8_t *)rec.key) : cc + 1;
+            if (!builder.append(recno, (void *)rec.val, rec.vlen)) {
+                break;
+            }
+        }
+    } else {
+        DbMultipleKeyDataBuilder builder(bulk);
+        for (; cc < recs.size(); cc++) {
+            LoadRecord rec(recs[cc]);
+            if (!builder.append((void *)rec.key, rec.klen,
+                                (void *)rec.val, rec.vlen)) {
+                break;
+            }
+        }
+    }
+
+    return cc - next;
+}
+
+//-----------------------------------------------------------------------------
+// LoadDb
+//  Create a DB from a dump, the text of dbdump in the given formats or its
+//  --binary output. Text is parsed by 'njobs' threads, BTREE records are
+//  sorted by key first, and all go in with bulk puts, in transactions of
+//  LOAD_TXN_SZ when in an environment. The DB gets duplicates when the
+//  dump has repeated keys, sorted ones when their values are in order.
+//-----------------------------------------------------------------------------
+static int
+LoadDb(DbEnv *envp, const string &dbfile, const string &dbname,
+       const string &input, const string &typeName, const string &keyfmt,
+       const string &valfmt, int njobs)
+{
+    // The whole dump in memory, mapped when it is a file
+    int fd = ("-" == input) ? STDIN_FILENO : open(input.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error: Unable to open \"" << input << "\"" << endl;
+        return -1;
+    }
+
+    struct Mapping {
+        Mapping() : addr(MAP_FAILED), size(0) {}
+        ~Mapping() {
+            if (MAP_FAILED != addr) {
+                munmap(addr, size);
+            }
+        }
+        void *addr;
+        size_t size;
+    } map;
+
+    struct stat st;
+    const char *data = NULL;
+    size_t size = 0;
+    vector<char> buff;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        map.addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED != map.addr) {
+            map.size = size;
+            madvise(map.addr, size, MADV_SEQUENTIAL);
+            data = (const char *)map.addr;
+        }
+    }
+    if (NULL == data) {
+        size = 0;
+        buff.resize(OUT_BUFSZ);
+        for (ssize_t cnt; ; size += cnt) {
+            if (size == buff.size()) {
+                buff.resize(2 * buff.size());
+            }
+            cnt = read(fd, &buff[size], buff.size() - size);
+            if (cnt < 0 && EINTR == errno) {
+                cnt = 0;
+                continue;
+            }
+            if (cnt <= 0) {
+                break;
+            }
+        }
+        data = &buff[0];
+    }
+    if (STDIN_FILENO != fd) {
+        close(fd);
+    }
+
+    // A compressed dump is expanded in memory first
+    vector<char> plain;
+    size_t hlen = sizeof(COMPRESS_HEADER) - 1;
+    if (size >= hlen && 0 == memcmp(data, COMPRESS_HEADER, hlen)) {
+        if (!ExpandBlocks(data + hlen, size - hlen, plain)) {
+            cerr << "Error: \"" << input << "\" is a corrupt compressed"
+                 << " dump" << endl;
+            return -1;
+        }
+        data = plain.empty() ? "" : &plain[0];
+        size = plain.size();
+    }
+
+    // The header line tells what follows. An empty DB dumps to nothing at
+    // all, not even a header, and loads back empty.
+    const char *end = data + size;
+    const char *body = (const char *)memchr(data, '\n', size);
+    body = body ? body + 1 : end;
+    string header(data, body - data);
+    bool bEmpty = (0 == size);
+    bool bBinary = ("#binary\n" == header);
+    bool bValues = ("#value\n" == header);
+    if (!bEmpty && !bBinary && !bValues && "#key:value\n" != header) {
+        cerr << "Error: \"" << input << "\" is not a dump, it starts with"
+             << " no \"#key:value\", \"#value\" or \"#binary\" line" << endl;
+        return -1;
+    }
+
+    DBTYPE type = bValues ? DB_RECNO : DB_BTREE;
+    if (!typeName.empty()) {
+        type = ("btree" == typeName) ? DB_BTREE
+            : ("hash" == typeName) ? DB_HASH
+            : ("recno" == typeName) ? DB_RECNO
+            : ("queue" == typeName) ? DB_QUEUE : DB_UNKNOWN;
+    }
+    bool bRecno = (DB_RECNO == type || DB_QUEUE == type);
+    if (DB_UNKNOWN == type || (bValues && !bRecno)) {
+        cerr << "Error: Cannot load this dump as a \"" << typeName << "\""
+             << endl;
+        return -1;
+    }
+
+    double start = Now();
+    vector<const char *> recs;
+    vector<LoadJob> jobs;
+
+    if (bBinary) {
+        // Records are used in place
+        for (const char *rec = body; rec < end; ) {
+            uint32_t klen = 0, vlen = 0;
+            if (end - rec < 8 ||
+                (klen = Load<uint32_t>((const uint8_t *)rec)) >
+                (size_t)(end - rec) - 8 ||
+                (vlen = Load<uint32_t>((const uint8_t *)rec + 4 + klen)) >
+                (size_t)(end - rec) - 8 - klen) {
+                cerr << "Error: Truncated record at offset " << rec - data
+                     << " of \"" << input << "\"" << endl;
+                return -1;
+            }
+            recs.push_back(rec);
+            rec += 8 + klen + vlen;
+        }
+    } else if (!bEmpty) {
+        if (valfmt.empty() || (!bValues && keyfmt.empty())) {
+            cerr << "Error: Loading text needs its formats, use -k/-v"
+                 << endl;
+            return -1;
+        }
+        FormatPlan keyPlan(keyfmt), valPlan(valfmt);
+
+        // Whole lines for each thread
+        jobs.resize(max(1, njobs));
+        const char *pos = body;
+        for (size_t cc = 0; cc < jobs.size(); cc++) {
+            LoadJob &job = jobs[cc];
+            job.begin = pos;
+            pos = min(end, pos + (end - body) / jobs.size());
+            const char *eol = (const char *)memchr(pos, '\n', end - pos);
+            pos = (eol && cc + 1 < jobs.size()) ? eol + 1 : end;
+            job.end = pos;
+            job.keyPlan = bValues ? NULL : &keyPlan;
+            job.valPlan = &valPlan;
+            job.bSplitLast = HasString(keyPlan) && !HasString(valPlan);
+        }
+
+        vector<pthread_t> threads(jobs.size());
+        vector<bool> bThread(jobs.size(), false);
+        for (size_t cc = 1; cc < jobs.size(); cc++) {
+            bThread[cc] = (0 == pthread_create(&threads[cc], NULL,
+                                               ParseLines, &jobs[cc]));
+            if (!bThread[cc]) {
+                ParseLines(&jobs[cc]);
+            }
+        }
+        ParseLines(&jobs[0]);
+
+        for (size_t cc = 0; cc < jobs.size(); cc++) {
+            if (bThread[cc]) {
+                pthread_join(threads[cc], NULL);
+            }
+        }
+
+        for (size_t cc = 0; cc < jobs.size(); cc++) {
+            const LoadJob &job = jobs[cc];
+            if (!job.error.empty()) {
+                cerr << "Error: Invalid record \"" << job.error << "\""
+                     << endl;
+                return -1;
+            }
+            for (size_t cx = 0; cx < job.offsets.size(); cx++) {
+                recs.push_back(&job.arena[job.offsets[cx]]);
+            }
+        }
+    }
+
+    // Keys in order fill BTREE pages and bring duplicates together, equal
+    // keys stay in dump order
+    bool bSorted = true;
+    for (size_t cc = 1; bSorted && cc < recs.size(); cc++) {
+        bSorted = !LoadKeyLess(recs[cc], recs[cc - 1]);
+    }
+    if (!bSorted && !bRecno) {
+        stable_sort(recs.begin(), recs.end(), LoadKeyLess);
+    }
+
+    bool bDup = false, bDupSort = true;
+    size_t maxlen = 0;
+    for (size_t cc = 0; cc < recs.size(); cc++) {
+        LoadRecord rec(recs[cc]);
+        maxlen = max(maxlen, (size_t)rec.vlen);
+        if (cc && !bRecno && !LoadKeyLess(recs[cc - 1], recs[cc])) {
+            LoadRecord prev(recs[cc - 1]);
+            bDup = true;
+            bDupSort = bDupSort &&
+                CompareKeys(prev.val, prev.vlen, rec.val, rec.vlen) < 0;
+        }
+    }
+
+    Db dbh(envp, DB_CXX_NO_EXCEPTIONS);
+    if (bDup) {
+        dbh.set_flags(DB_DUP | (bDupSort ? DB_DUPSORT : 0));
+    }
+    if (DB_QUEUE == type) {
+        dbh.set_re_len(max(maxlen, (size_t)1));
+        dbh.set_re_pad(0);
+    }
+    if (NULL == envp) {
+        dbh.set_cachesize(0, BATCH_CACHE_MIN, 1);
+    }
+
+    // QUEUEs are one per file, without a table name
+    if (dbh.open(NULL, dbfile.c_str(),
+                 (DB_QUEUE == type) ? NULL : dbname.c_str(), type,
+                 DB_CREATE | DB_EXCL | (envp ? DB_AUTO_COMMIT : 0), 0644)) {
+        cerr << "Error: Failed to create DB \"" << dbfile
+             << "\", it may exist already" << endl;
+        return -1;
+    }
+
+    vector<char> bulkBuff(BULK_BUFSZ);
+    Dbt bulk, unused;
+    bulk.set_flags(DB_DBT_USERMEM);
+
+    // Transactions shrink when they outgrow the lock table
+    size_t txnLimit = LOAD_TXN_SZ;
+    DbTxn *txn = NULL;
+    size_t txnFirst = 0, txnBytes = 0;
+    int ret = 0;
+    for (size_t next = 0; 0 == ret && next < recs.size(); ) {
+        if (envp && NULL == txn) {
+            if (0 != (ret = envp->txn_begin(NULL, &txn, 0))) {
+                break;
+            }
+            txnFirst = next;
+            txnBytes = 0;
+        }
+
+        bulk.set_data(&bulkBuff[0]);
+        bulk.set_ulen(bulkBuff.size());
+        size_t count = FillBulk(bulk, recs, next, bRecno);
+        if (0 == count) {
+            // A record larger than the buffer
+            bulkBuff.resize(2 * bulkBuff.size());
+            continue;
+        }
+
+        ret = dbh.put(txn, &bulk, &unused, DB_MULTIPLE_KEY);
+        if (ENOMEM == ret && txn && txnLimit > bulkBuff.size()) {
+            txn->abort();
+            txn = NULL;
+            txnLimit /= 2;
+            next = txnFirst;
+            ret = 0;
+            continue;
+        }
+
+        next += count;
+        txnBytes += bulk.get_size();
+        if (txn && 0 == ret && (txnBytes >= txnLimit || next == recs.size())) {
+            ret = txn->commit(DB_TXN_NOSYNC);
+            txn = NULL;
+        }
+    }
+
+    if (txn) {
+        txn->abort();
+    }
+    if (0 == ret && envp) {
+        ret = envp->log_flush(NULL);
+    }
+    if (0 != dbh.close(0) && 0 == ret) {
+        ret = -1;
+    }
+
+    if (0 != ret) {
+        cerr << "Error: Failed to load DB \"" << dbfile << "\" with error "
+             << ret << endl;
+        return ret;
+    }
+
+    cerr << "Loaded " << recs.size() << " records into \"" << dbfile
+         << "\" in " << fixed << setprecision(2) << Now() - start << " s"
+         << endl;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// KeyReader
+//  The records of one key: all of its duplicates, or the record of a
+//  record number in a RECNO or QUEUE DB
+//-----------------------------------------------------------------------------
+class KeyReader : public RecordReader {
+public:
+    KeyReader(Db &dbh, const string &key);
+    ~KeyReader();
+
+    bool Next(Dbt &key, Dbt &val);
+    int Error() const { return _ret; }
+
+private:
+    Dbc *_cur;
+    bool _done;
+    int _ret;
+    uint32_t _flag;
+    Dbt _key;
+    Dbt _val;
+};
+
+KeyReader::KeyReader(Db &dbh, const string &key)
+    : _cur(NULL), _done(false), _ret(0), _flag(DB_SET)
+{
+    // Handles are opened with DB_THREAD, let libdb allocate
+    _key.set_flags(DB_DBT_REALLOC);
+    _val.set_flags(DB_DBT_REALLOC);
+
+    void *buff = malloc(key.size() ? key.size() : 1);
+    memcpy(buff, key.data(), key.size());
+    _key.set_data(buff);
+    _key.set_size(key.size());
+
+    _ret = dbh.cursor(NULL, &_cur, 0);
+    _done = (0 != _ret);
+}
+
+KeyReader::~KeyReader()
+{
+    free(_key.get_data());
+    free(_val.get_data());
+
+    if (_cur) {
+        _cur->close();
+    }
+}
+
+bool
+KeyReader::Next(Dbt &key, Dbt &val)
+{
+    if (_done) {
+        return false;
+    }
+
+    int ret = _cur->get(&_key, &_val, _flag);
+    if (0 != ret) {
+        _ret = (DB_NOTFOUND == ret || DB_KEYEMPTY == ret) ? 0 : ret;
+        _done = true;
+        return false;
+    }
+
+    _flag = DB_NEXT_DUP;
+    key = _key;
+    val = _val;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Server
+//  Keeps DBs open, with a warm cache, and answers requests on a Unix
+//  socket. Every worker thread accepts and serves one connection at a
+//  time. A request is a line of space separated words:
+//      get <db> <key>          The records of a key, with its duplicates,
+//                              or of a record number
+//      prefix <db> <key>       The records of keys starting with key
+//      range <db> <from> <to>  The records from 'from' up to 'to', as
+//                              --from/--to
+//      scan <db> [filter]      The whole DB, or the records matching the
+//                              --filter expression
+//      dbs                     The DBs served, with their formats
+//  <db> is the file name of a DB and keys are written as printed. Records
+//  come back as in a dump without header, then a line "#end <records>", or
+//  "#error <message>" if the request failed.
+//-----------------------------------------------------------------------------
+class Server {
+public:
+    Server(DbEnv *envp, const string &keyfmt, const string &valfmt);
+    ~Server();
+
+    // Open and warm up a DB to serve
+    bool Add(const string &dbfile);
+
+    // Listen on 'path', false if it is in use
+    bool Listen(const string &path);
+
+    // Serve with 'nworkers' threads until SIGINT or SIGTERM
+    int Run(int nworkers);
+
+private:
+    struct Served {
+        string name;            // File name clients ask for
+        Db *dbh;
+        DBTYPE type;
+        string keyfmt;
+        string valfmt;
+        size_t records;         // At startup
+    };
+
+    struct Worker {
+        Server *server;
+        volatile int fd;        // Connection being served, -1 if none
+        pthread_t thread;
+    };
+
+    static void *Accept(void *arg);
+    void Serve(Worker &worker);
+    bool Request(const string &line, OutBuf &out);
+    size_t Print(RecordReader &reader, const Served &db, OutBuf &out,
+                 const KeyRange *range, const Filter *filter);
+
+    DbEnv *_envp;
+    string _keyfmt;             // Empty to use the defaults of each file
+    string _valfmt;
+    vector<Served> _dbs;
+    string _path;
+    int _listen;
+    volatile bool _bStop;
+    vector<Worker> _workers;
+};
+
+Server::Server(DbEnv *envp, const string &keyfmt, const string &valfmt)
+    : _envp(envp), _keyfmt(keyfmt), _valfmt(valfmt), _listen(-1),
+      _bStop(false)
+{
+}
+
+Server::~Server()
+{
+    for (size_t cc = 0; cc < _dbs.size(); cc++) {
+        _dbs[cc].dbh->close(0);
+        delete _dbs[cc].dbh;
+    }
+
+    if (-1 != _listen) {
+        close(_listen);
+        unlink(_path.c_str());
+    }
+}
+
+bool
+Server::Add(const string &dbfile)
+{
+    Served db;
+    string dbdir, dbname;
+    SplitDbPath(dbfile, dbdir, db.name, dbname);
+
+    db.dbh = new Db(_envp, DB_CXX_NO_EXCEPTIONS);
+
+    // Without an environment the DB has a private cache, sized to hold it
+    struct stat st;
+    size_t cache = 0;
+    if (NULL == _envp && 0 == stat(dbfile.c_str(), &st)) {
+        cache = min(max((size_t)st.st_size, BATCH_CACHE_MIN),
+                    BATCH_CACHE_MAX);
+        db.dbh->set_cachesize(cache >> 30, cache & ((1 << 30) - 1), 1);
+    }
+
+    if (db.dbh->open(NULL, dbfile.c_str(), OpenName(dbfile, dbname),
+                     DB_UNKNOWN, DB_RDONLY | DB_THREAD, 0) ||
+        db.dbh->get_type(&db.type)) {
+        cerr << "Error: Failed to open DB \"" << dbfile << "\"" << endl;
+        delete db.dbh;
+        return false;
+    }
+
+    // Formats are fixed for the life of the server
+    db.keyfmt = _keyfmt;
+    db.valfmt = _valfmt;
+    if (db.keyfmt.empty() || db.valfmt.empty()) {
+        GetDefaultFormats(db.name, db.keyfmt, db.valfmt);
+    }
+    if (DB_RECNO == db.type || DB_QUEUE == db.type) {
+        db.keyfmt = "u32";
+    }
+    ResolveFormats(*db.dbh, KeyRange(), db.keyfmt, db.valfmt);
+
+    // One pass over the records brings the pages of a DB that fits the
+    // cache in, and counts them
+    db.records = 0;
+    BulkReader reader(*db.dbh);
+    for (Dbt key, val; reader.Next(key, val); ) {
+        db.records++;
+    }
+
+    _dbs.push_back(db);
+    cerr << "Serving \"" << db.name << "\", " << db.records << " records"
+         << endl;
+
+    return true;
+}
+
+bool
+Server::Listen(const string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Error: Socket path \"" << path << "\" is too long" << endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == fd) {
+        cerr << "Error: Unable to create a socket" << endl;
+        return false;
+    }
+
+    // A socket left by a server that is gone is replaced
+    struct stat st;
+    if (0 == stat(path.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+        if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            cerr << "Error: A server already listens on \"" << path << "\""
+                 << endl;
+            close(fd);
+            return false;
+        }
+        close(fd);
+        unlink(path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+
+    if (-1 == fd || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fd, SOMAXCONN)) {
+        cerr << "Error: Unable to listen on \"" << path << "\": "
+             << strerror(errno) << endl;
+        if (-1 != fd) {
+            close(fd);
+        }
+        return false;
+    }
+
+    _listen = fd;
+    _path = path;
+
+    return true;
+}
+
+int
+Server::Run(int nworkers)
+{
+    // Workers leave signals to this thread, and a client that goes away
+    // only fails its writes
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    _workers.resize(nworkers);
+    size_t started = 0;
+    for (size_t cc = 0; cc < _workers.size(); cc++) {
+        Worker &worker = _workers[cc];
+        worker.server = this;
+        worker.fd = -1;
+        if (pthread_create(&worker.thread, NULL, Accept, &worker)) {
+            cerr << "Error: Unable to create worker thread" << endl;
+            break;
+        }
+        started++;
+    }
+
+    if (0 == started) {
+        return -1;
+    }
+    cerr << "Listening on \"" << _path << "\" with " << started
+         << " workers" << endl;
+
+    int sig = 0;
+    sigwait(&sigs, &sig);
+
+    // Wake up the workers: blocked accepts fail, and reads of the
+    // connections being served end after the current request
+    _bStop = true;
+    __sync_synchronize();
+    shutdown(_listen, SHUT_RDWR);
+    for (size_t cc = 0; cc < started; cc++) {
+        int fd = _workers[cc].fd;
+        if (-1 != fd) {
+            shutdown(fd, SHUT_RD);
+        }
+    }
+
+    for (size_t cc = 0; cc < started; cc++) {
+        pthread_join(_workers[cc].thread, NULL);
+    }
+    cerr << "Stopped on signal " << sig << endl;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Server::Accept
+//  Thread routine: serve connections until the server stops
+//-----------------------------------------------------------------------------
+void *
+Server::Accept(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    Server *server = worker->server;
+
+    while (!server->_bStop) {
+        int fd = accept(server->_listen, NULL, NULL);
+        if (-1 == fd) {
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+            break;
+        }
+
+        // Published before looking at the stop flag, so that either this
+        // thread or Run() sees the other
+        worker->fd = fd;
+        __sync_synchronize();
+        if (!server->_bStop) {
+            server->Serve(*worker);
+        }
+        worker->fd = -1;
+        close(fd);
+    }
+
+    return worker;
+}
+
+//-----------------------------------------------------------------------------
+// Server::Serve
+//  Answer the requests of a connection, in order, until it closes
+//-----------------------------------------------------------------------------
+void
+Server::Serve(Worker &worker)
+{
+    OutBuf out(worker.fd, SERVE_OUT_BUFSZ);
+    string pending;
+    char buff[4096];
+
+    while (!_bStop) {
+        size_t pos = pending.find('\n');
+        if (string::npos == pos) {
+            if (pending.size() > SERVE_MAX_LINE) {
+                out << "#error Request too long\n";
+                out.Flush();
+                return;
+            }
+
+            ssize_t len = read(worker.fd, buff, sizeof(buff));
+            if (len < 0 && EINTR == errno) {
+                continue;
+            }
+            if (len <= 0) {
+                return;
+            }
+            pending.append(buff, len);
+            continue;
+        }
 
-    PrintData<Dbt>::DoPrint(obj, _valFmt);
-    cout << endl;
+        string line = pending.substr(0, pos);
+        pending.erase(0, pos + 1);
+        if (!line.empty() && '\r' == line[line.size() - 1]) {
+            line.resize(line.size() - 1);
+        }
+        if (line.empty()) {
+            continue;
+        }
 
-    // Do this at the end so that all code that depends on this
-    // flag gets a chance to see the correct state
-    if (_bFirst) {
-        _bFirst = false;
+        // Answers go out as each request completes
+        if (!Request(line, out) || !out.Flush()) {
+            return;
+        }
     }
 
     return;
 }
 
 //-----------------------------------------------------------------------------
-// For associated array types: key/value pairs
+// Server::Request
+//  Answer one request line, false if the connection should close
 //-----------------------------------------------------------------------------
-template<typename T>
-void PrintData<T>::operator() (T &obj)
+bool
+Server::Request(const string &line, OutBuf &out)
 {
-    // Print the output header
-    if (_bFirst) {
-        cout << "#key:value" << endl;
+    // Command, DB name and the rest of the line
+    size_t pos = line.find(' ');
+    string cmd = line.substr(0, pos);
+    string name, arg;
+    if (string::npos != pos) {
+        size_t end = line.find(' ', pos + 1);
+        name = line.substr(pos + 1, end - pos - 1);
+        if (string::npos != end) {
+            arg = line.substr(end + 1);
+        }
     }
 
-    PrintData<T>::DoPrint(obj.first, _keyFmt);
-    cout << ":";
-    PrintData<T>::DoPrint(obj.second, _valFmt);
-    cout << endl;
+    if ("dbs" == cmd) {
+        for (size_t cc = 0; cc < _dbs.size(); cc++) {
+            const Served &db = _dbs[cc];
+            out << db.name << ' ' << (DB_BTREE == db.type ? "btree" :
+                                      DB_HASH == db.type ? "hash" :
+                                      DB_RECNO == db.type ? "recno" :
+                                      "queue")
+                << ' ' << db.keyfmt << ' ' << db.valfmt << '\n';
+        }
+        out << "#end " << _dbs.size() << '\n';
+        return true;
+    }
 
-    // Do this at the end so that all code that depends on this
-    // flag gets a chance to see the correct state
-    if (_bFirst) {
-        _bFirst = false;
+    if ("get" != cmd && "prefix" != cmd && "range" != cmd &&
+        "scan" != cmd) {
+        out << "#error Unknown request \"" << cmd << "\"\n";
+        return true;
     }
 
-    return;
-}
+    const Served *db = NULL;
+    for (size_t cc = 0; !db && cc < _dbs.size(); cc++) {
+        if (name == _dbs[cc].name) {
+            db = &_dbs[cc];
+        }
+    }
+    if (!db) {
+        out << "#error Unknown DB \"" << name << "\"\n";
+        return true;
+    }
 
-//-----------------------------------------------------------------------------
-// is_alive: Callback function for recovery FAILCHK
-// TODO: Figure out if we need to do a DB_FAILCHK in a stand alone tool
-//-----------------------------------------------------------------------------
-static int
-is_alive(DbEnv *envp, pid_t pid, db_threadid_t tid, uint32_t flags)
-{
-    return -1;
-}
+    bool bRecno = (DB_RECNO == db->type || DB_QUEUE == db->type);
+    if (db->keyfmt.empty() || db->valfmt.empty()) {
+        out << "#error No formats for \"" << name << "\"\n";
+        return true;
+    }
+    FormatPlan keyPlan(db->keyfmt);
 
-//-----------------------------------------------------------------------------
-// makelower
-//  Helper function used to downcase a string
-//-----------------------------------------------------------------------------
-void
-downcase(char &a)
-{
-    a = tolower(a);
-    return;
-}
+    size_t records = 0;
+    int ret = 0;
+    if ("get" == cmd) {
+        string key;
+        if (!keyPlan.Encode(arg, key, false)) {
+            out << "#error Invalid key \"" << arg << "\"\n";
+            return true;
+        }
 
-//-----------------------------------------------------------------------------
-// GetDefaultFormats
-//	Try to get a key/value print format
-//	ATTN: REMEMBER TO UPDATE THIS WHEN YOU CREATE A NEW DB FILE TYPE
-//-----------------------------------------------------------------------------
-void
-GetDefaultFormats(string dbfile, string &keyfmt, string &valuefmt)
-{
-    typedef tr1::tuple<string, string> format;
+        KeyReader reader(*db->dbh, key);
+        records = Print(reader, *db, out, NULL, NULL);
+        ret = reader.Error();
+    } else if ("scan" == cmd) {
+        Filter filter(bRecno ? "" : db->keyfmt, db->valfmt);
+        if (!arg.empty() && !filter.Compile(arg)) {
+            out << "#error Invalid filter \"" << arg << "\"\n";
+            return true;
+        }
 
-    static bool bFirst = true;
-    static tr1::unordered_map<string, format> fmtMap;
+        BulkReader reader(*db->dbh);
+        records = Print(reader, *db, out, NULL,
+                        arg.empty() ? NULL : &filter);
+        ret = reader.Error();
+    } else {
+        if (DB_BTREE != db->type) {
+            out << "#error Key ranges need a BTREE DB\n";
+            return true;
+        }
 
-    for_each(dbfile.begin(), dbfile.end(), downcase);
+        KeyRange range;
+        bool bValid;
+        if ("prefix" == cmd) {
+            bValid = keyPlan.Encode(arg, range.from, true);
+            range.to = range.from;
+        } else {
+            pos = arg.find(' ');
+            bValid = (string::npos != pos) &&
+                keyPlan.Encode(arg.substr(0, pos), range.from, false) &&
+                keyPlan.Encode(arg.substr(pos + 1), range.to, false);
+        }
+        if (!bValid) {
+            out << "#error Invalid key range \"" << arg << "\"\n";
+            return true;
+        }
+        range.bFrom = range.bTo = range.bToPrefix = true;
 
-    // Populate the lookup table
-    if (bFirst) {
-        // All keys in lower case
-        fmtMap["attrname.db"] = format("s", "u32:i32");
-        fmtMap["attrname_attrid.sdb"] = format("u32:i32", "s");
-        fmtMap["oid.db"] = format("hex", "u64");
-        fmtMap["oid_oidid.sdb"] = format("u64", "hex");
-        fmtMap["oidid.db"] = format("u64", "u32:i32");
-        bFirst = false;
+        // Ranges are usually short, start with a small buffer
+        BulkReader reader(*db->dbh, SERVE_BULK_BUFSZ);
+        reader.Seek(range.from.data(), range.from.size());
+        records = Print(reader, *db, out, &range, NULL);
+        ret = reader.Error();
     }
 
-    do {
-        tr1::unordered_map<string, format>::const_iterator it;
+    if (0 != ret) {
+        out << "#error Failed to read DB with error " << ret << '\n';
+    } else {
+        out << "#end " << records << '\n';
+    }
 
-        it = fmtMap.find(dbfile);
-        if (fmtMap.end() == it) {
-            break;
-        }
+    return out.Good();
+}
 
-        if (keyfmt.empty()) {
-            keyfmt = tr1::get<0>(it->second);
-        }
+//-----------------------------------------------------------------------------
+// Server::Print
+//  Print records as a dump does, values only for RECNO and QUEUE
+//-----------------------------------------------------------------------------
+size_t
+Server::Print(RecordReader &reader, const Served &db, OutBuf &out,
+              const KeyRange *range, const Filter *filter)
+{
+    string keyfmt = db.keyfmt, valfmt = db.valfmt;
+    if (DB_RECNO != db.type && DB_QUEUE != db.type) {
+        return DumpRecords(reader, keyfmt, valfmt, out, false, range,
+                           filter);
+    }
 
-        if (valuefmt.empty()) {
-            valuefmt = tr1::get<1>(it->second);
-        }
+    PrintData<Dbt> p(valfmt, out, false);
+    size_t records = 0;
 
-    } while(0);
+    Dbt key, val;
+    while (reader.Next(key, val)) {
+        if (!filter || filter->Match(key, val)) {
+            p(val);
+            records++;
+        }
+    }
 
-    return;
+    return records;
 }
 
 //-----------------------------------------------------------------------------
@@ -363,12 +8370,95 @@ main(int argc, char *argv[])
     bool opt_env = false;
     bool opt_recover = false;
     bool opt_file = false;
+    bool opt_mmap = false;
+    int opt_jobs = 1;
+    bool opt_bJobs = false;
+    string opt_outdir;
+    size_t opt_bench = 0;
     string opt_keyfmt;
     string opt_valfmt;
+    string opt_from;
+    string opt_to;
+    bool opt_bFrom = false;
+    bool opt_bTo = false;
+    vector<string> opt_prefixes;
+    string opt_filter;
+    bool opt_stats = false;
+    bool opt_diff = false;
+    string opt_cdc;
+    vector<string> opt_joins;
+    bool opt_live = false;
+    bool opt_snapshot = false;
+    double opt_maxrate = 0;
+    double opt_maxmbps = 0;
+    bool opt_binary = false;
+    bool opt_columnar = false;
+    size_t opt_groupRows = COL_GROUP_ROWS;
+    string opt_serve;
+    bool opt_pipeline = false;
+    bool opt_compress = false;
+    string opt_decompress;
+    vector<string> opt_schemas;
+    string opt_load;
+    string opt_type;
+
+    // Long only options
+    enum {
+        OPT_FROM = 256,
+        OPT_TO,
+        OPT_PREFIX,
+        OPT_PREFIX_FILE,
+        OPT_FILTER,
+        OPT_STATS,
+        OPT_DIFF,
+        OPT_CDC,
+        OPT_JOIN,
+        OPT_LIVE,
+        OPT_SNAPSHOT,
+        OPT_MAX_RATE,
+        OPT_MAX_MBPS,
+        OPT_BINARY,
+        OPT_LOAD,
+        OPT_TYPE,
+        OPT_COLUMNAR,
+        OPT_ROW_GROUP,
+        OPT_SERVE,
+        OPT_PIPELINE,
+        OPT_COMPRESS,
+        OPT_DECOMPRESS,
+        OPT_SCHEMA
+    };
+
+    static const struct option longopts[] = {
+        { "from",        required_argument, NULL, OPT_FROM },
+        { "to",          required_argument, NULL, OPT_TO },
+        { "prefix",      required_argument, NULL, OPT_PREFIX },
+        { "prefix-file", required_argument, NULL, OPT_PREFIX_FILE },
+        { "filter",      required_argument, NULL, OPT_FILTER },
+        { "stats",       no_argument,       NULL, OPT_STATS },
+        { "diff",        no_argument,       NULL, OPT_DIFF },
+        { "cdc",         required_argument, NULL, OPT_CDC },
+        { "join",        required_argument, NULL, OPT_JOIN },
+        { "live",        no_argument,       NULL, OPT_LIVE },
+        { "snapshot",    no_argument,       NULL, OPT_SNAPSHOT },
+        { "max-rate",    required_argument, NULL, OPT_MAX_RATE },
+        { "max-mbps",    required_argument, NULL, OPT_MAX_MBPS },
+        { "binary",      no_argument,       NULL, OPT_BINARY },
+        { "load",        required_argument, NULL, OPT_LOAD },
+        { "type",        required_argument, NULL, OPT_TYPE },
+        { "columnar",    no_argument,       NULL, OPT_COLUMNAR },
+        { "row-group",   required_argument, NULL, OPT_ROW_GROUP },
+        { "serve",       required_argument, NULL, OPT_SERVE },
+        { "pipeline",    no_argument,       NULL, OPT_PIPELINE },
+        { "compress",    no_argument,       NULL, OPT_COMPRESS },
+        { "decompress",  required_argument, NULL, OPT_DECOMPRESS },
+        { "schema",      required_argument, NULL, OPT_SCHEMA },
+        { NULL,          0,                 NULL, 0 }
+    };
 
     string dbfile;
     do {
-        opt = getopt(argc, argv, "erhk:v:f:");
+        opt = getopt_long(argc, argv, "ermhk:v:f:j:o:B:", longopts, NULL);
         switch(opt) {
             case 'e':
                 opt_env = true;
@@ -376,6 +8466,9 @@ main(int argc, char *argv[])
             case 'r':
                 opt_recover = true;
                 break;
+            case 'm':
+                opt_mmap = true;
+                break;
             case 'h':
                 usage(0);
                 return 0;
@@ -389,11 +8482,169 @@ main(int argc, char *argv[])
             case 'v':
                 opt_valfmt = optarg;
                 break;
+            case 'o':
+                opt_outdir = optarg;
+                break;
+            case 'B':
+                opt_bench = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                opt_bJobs = true;
+                opt_jobs = atoi(optarg);
+                if (opt_jobs < 1) {
+                    usage(-1, "Error: Invalid number of jobs");
+                }
+                break;
+            case OPT_FROM:
+                opt_from = optarg;
+                opt_bFrom = true;
+                break;
+            case OPT_TO:
+                opt_to = optarg;
+                opt_bTo = true;
+                break;
+            case OPT_PREFIX:
+                opt_prefixes.push_back(optarg);
+                break;
+            case OPT_PREFIX_FILE: {
+                ifstream in(optarg);
+                if (!in) {
+                    cerr << "Error: Unable to open \"" << optarg << "\""
+                         << endl;
+                    return -1;
+                }
+                for (string line; getline(in, line); ) {
+                    if (!line.empty()) {
+                        opt_prefixes.push_back(line);
+                    }
+                }
+                break;
+            }
+            case OPT_FILTER:
+                opt_filter = optarg;
+                break;
+            case OPT_STATS:
+                opt_stats = true;
+                break;
+            case OPT_DIFF:
+                opt_diff = true;
+                break;
+            case OPT_CDC:
+                opt_cdc = optarg;
+                break;
+            case OPT_JOIN:
+                opt_joins.push_back(optarg);
+                break;
+            case OPT_LIVE:
+                opt_live = true;
+                break;
+            case OPT_SNAPSHOT:
+                opt_live = true;
+                opt_snapshot = true;
+                break;
+            case OPT_MAX_RATE:
+                opt_live = true;
+                opt_maxrate = atof(optarg);
+                if (opt_maxrate <= 0) {
+                    usage(-1, "Error: Invalid record rate");
+                }
+                break;
+            case OPT_MAX_MBPS:
+                opt_live = true;
+                opt_maxmbps = atof(optarg);
+                if (opt_maxmbps <= 0) {
+                    usage(-1, "Error: Invalid bandwidth");
+                }
+                break;
+            case OPT_BINARY:
+                opt_binary = true;
+                break;
+            case OPT_LOAD:
+                opt_load = optarg;
+                break;
+            case OPT_TYPE:
+                opt_type = optarg;
+                break;
+            case OPT_COLUMNAR:
+                opt_columnar = true;
+                break;
+            case OPT_ROW_GROUP:
+                opt_groupRows = strtoul(optarg, NULL, 0);
+                if (opt_groupRows < 1 || opt_groupRows > UINT32_MAX) {
+                    usage(-1, "Error: Invalid row group size");
+                }
+                break;
+            case OPT_SERVE:
+                opt_serve = optarg;
+                break;
+            case OPT_PIPELINE:
+                opt_pipeline = true;
+                break;
+            case OPT_COMPRESS:
+                opt_pipeline = true;
+                opt_compress = true;
+                break;
+            case OPT_DECOMPRESS:
+                opt_decompress = optarg;
+                break;
+            case OPT_SCHEMA:
+                opt_schemas.push_back(optarg);
+                break;
             default:
                 break;
         }
     } while(-1 != opt);
 
+    // Schema files of DBDUMP_SCHEMA first, so that --schema overrides them
+    const char *envSchema = getenv("DBDUMP_SCHEMA");
+    if (envSchema) {
+        vector<string> files;
+        string paths = envSchema;
+        size_t pos = 0;
+        while (pos <= paths.size()) {
+            size_t end = paths.find(':', pos);
+            if (string::npos == end) {
+                end = paths.size();
+            }
+            if (end > pos) {
+                files.push_back(paths.substr(pos, end - pos));
+            }
+            pos = end + 1;
+        }
+        opt_schemas.insert(opt_schemas.begin(), files.begin(), files.end());
+    }
+    for (size_t cc = 0; cc < opt_schemas.size(); cc++) {
+        if (!FormatRegistry::Get().Load(opt_schemas[cc])) {
+            return -1;
+        }
+    }
+
+    // Layouts in -k/-v are expanded once, so that the formats they make
+    // get their fused decoders
+    string fmtErr;
+    if (!FormatRegistry::Get().Expand(opt_keyfmt, opt_keyfmt, fmtErr) ||
+        !FormatRegistry::Get().Expand(opt_valfmt, opt_valfmt, fmtErr)) {
+        cerr << "Error: " << fmtErr << endl;
+        usage(-1);
+    }
+
+    // Decoder benchmark runs on synthetic records, no DB involved
+    if (opt_bench) {
+        OutBuf out(STDOUT_FILENO);
+        return BenchDecoders(opt_bench, opt_keyfmt, opt_valfmt, out);
+    }
+
+    // Text of a compressed dump, no DB involved either
+    if (!opt_decompress.empty()) {
+        OutBuf out(STDOUT_FILENO);
+        int status = Decompress(opt_decompress, out);
+        if (!out.Flush() && 0 == status) {
+            cerr << "Error: Failed to write output" << endl;
+            status = -1;
+        }
+        return status;
+    }
+
     if (false == opt_file) {
         if (argc == optind) {
             usage(-1, "Error: Missing DB file");
@@ -402,36 +8653,157 @@ main(int argc, char *argv[])
         dbfile = argv[optind];
     }
 
-    string dbdir;               // DB folder
-    string dbname;              // Name of the DB table
-    string dbfilebase;          // Actual DB File portion from path
+    // Second DB compared against the first one
+    string difffile;
+    if (opt_diff) {
+        if (argc <= optind + (opt_file ? 0 : 1)) {
+            usage(-1, "Error: --diff needs two DB files");
+        }
+        difffile = argv[optind + (opt_file ? 0 : 1)];
+    }
 
-    size_t pos = dbfile.find_last_of("/");
-    if (string::npos == pos) {
-        dbfilebase = dbfile;
-        dbdir = "./";
-    } else {
-        dbfilebase = dbfile.substr(pos + 1);
-        dbdir = dbfile.substr(0, pos);
+    // Binary and columnar records only come out of plain dumps
+    if ((opt_binary || opt_columnar) &&
+        (opt_stats || opt_diff || !opt_cdc.empty() || !opt_joins.empty() ||
+         opt_live || !opt_outdir.empty() || !opt_load.empty() ||
+         (opt_binary && opt_columnar))) {
+        usage(-1, "Error: --binary and --columnar are for plain dumps of"
+              " one DB");
     }
 
-    dbname = dbfilebase;
-    pos = dbfilebase.find_last_of(".");
-    if (string::npos != pos) {
-        dbname[pos] = '_';
+    // The writer thread is for dumps and batches of them
+    if (opt_pipeline && (opt_diff || !opt_cdc.empty() || !opt_joins.empty() ||
+                         opt_live || !opt_serve.empty() || !opt_load.empty())) {
+        usage(-1, "Error: --pipeline and --compress are for dumps and -o");
+    }
+
+    // Many DB files, or folders of them, are dumped as a batch
+    Batch batch;
+    bool bBatch = false;
+    if (!opt_diff && opt_load.empty()) {
+        vector<string> paths(1, dbfile);
+        paths.insert(paths.end(), argv + optind + (opt_file ? 0 : 1),
+                     argv + argc);
+
+        bBatch = (paths.size() > 1 || !opt_outdir.empty());
+        for (size_t cc = 0; cc < paths.size(); cc++) {
+            bBatch = AddDbFiles(paths[cc], batch.files) || bBatch;
+        }
+    }
+
+    // The server takes the DBs as given, with the environment of the first
+    if (!opt_serve.empty()) {
+        if (opt_bFrom || opt_bTo || !opt_prefixes.empty() ||
+            !opt_filter.empty() || opt_stats || opt_diff ||
+            !opt_cdc.empty() || !opt_joins.empty() || opt_live ||
+            opt_binary || opt_columnar || opt_mmap ||
+            !opt_outdir.empty() || !opt_load.empty()) {
+            usage(-1, "Error: --serve takes key ranges and filters in its"
+                  " requests");
+        }
+        if (batch.files.empty()) {
+            cerr << "Error: No DB files to serve" << endl;
+            return -1;
+        }
+
+        batch.keyfmt = opt_keyfmt;
+        batch.valfmt = opt_valfmt;
+        if (!opt_bJobs) {
+            opt_jobs = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+        }
+        dbfile = batch.files[0];
+        bBatch = false;
+    }
+
+    if (bBatch) {
+        if (opt_outdir.empty()) {
+            usage(-1, "Error: A batch of DBs needs an output folder, use -o");
+        }
+        if (opt_bFrom || opt_bTo || !opt_prefixes.empty() ||
+            !opt_cdc.empty() || !opt_joins.empty() || opt_live) {
+            usage(-1, "Error: Key ranges, --cdc, --join and --live take a"
+                  " single DB");
+        }
+        if (batch.files.empty()) {
+            cerr << "Error: No DB files to dump" << endl;
+            return -1;
+        }
+
+        batch.outdir = opt_outdir;
+        batch.keyfmt = opt_keyfmt;
+        batch.valfmt = opt_valfmt;
+        batch.filter = opt_filter;
+        batch.bStats = opt_stats;
+        batch.bMmap = opt_mmap;
+        batch.bPipeline = opt_pipeline;
+        batch.bCompress = opt_compress;
+
+        // One DB per thread, as many at once as there are CPUs by default
+        if (!opt_bJobs) {
+            opt_jobs = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+        }
+        opt_jobs = min((size_t)opt_jobs, batch.files.size());
+
+        // The environment lives with the first DB
+        dbfile = batch.files[0];
     }
 
+    string dbdir;               // DB folder
+    string dbname;              // Name of the DB table
+    string dbfilebase;          // Actual DB File portion from path
+    SplitDbPath(dbfile, dbdir, dbfilebase, dbname);
+
     // Get the default parameters from the internal lookup
     if (opt_keyfmt.empty() || opt_valfmt.empty()) {
         GetDefaultFormats(dbfilebase, opt_keyfmt, opt_valfmt);
     }
 
-    if (access(dbfile.c_str(), R_OK)) {
+    // Key ranges are given as text in the key format
+    vector<KeyRange> ranges;
+    if (opt_bFrom || opt_bTo || !opt_prefixes.empty()) {
+        if (opt_keyfmt.empty()) {
+            usage(-1, "Error: Key ranges need a key format");
+        }
+        if (!ParseKeyRanges(opt_keyfmt, opt_bFrom ? &opt_from : NULL,
+                            opt_bTo ? &opt_to : NULL, opt_prefixes, ranges)) {
+            return -1;
+        }
+    }
+
+    if (opt_load.empty() && access(dbfile.c_str(), R_OK)) {
         cerr << "Error: Unable to open DB file \""
              << dbfile.c_str() << "\" for read" << endl;
         return -1;
     }
 
+    // Offline read of the pages, libdb takes the files it cannot parse
+    if (opt_mmap && !opt_diff && !bBatch && opt_joins.empty() &&
+        !opt_live && !opt_binary && !opt_columnar && opt_load.empty()) {
+        if (!ranges.empty()) {
+            usage(-1, "Error: Key ranges need key order, not given by '-m'");
+        }
+
+        PageReader pages;
+        if (pages.Open(dbfile, dbname)) {
+            OutBuf out(STDOUT_FILENO);
+            if (opt_pipeline && !out.Pipeline(opt_compress)) {
+                return -1;
+            }
+            int status = DumpPages(pages, opt_keyfmt, opt_valfmt,
+                                   opt_filter, opt_stats, out);
+            if (!out.Flush() && 0 == status) {
+                cerr << "Error: Failed to write output" << endl;
+                status = -1;
+            }
+            return status;
+        }
+    }
+
+    // Transactions come from the environment of the live DB
+    if (opt_live && !opt_env) {
+        usage(-1, "Error: --live and --snapshot need '-e'");
+    }
+
     int ret = -1;
     DbEnv env(DB_CXX_NO_EXCEPTIONS);
     DbEnv *envp = NULL;
@@ -452,9 +8824,27 @@ main(int argc, char *argv[])
         // | DB_FAILCHK
         | DB_RECOVER;
 
+    // Handles are shared by the range workers and the server threads
+    if (opt_jobs > 1 || !opt_serve.empty()) {
+        envFlags |= DB_THREAD;
+    }
+
     if (opt_recover || opt_env) {
         // Set some basic env features
         env.set_lk_detect(DB_LOCK_DEFAULT);
+
+        // A cache that holds the batch, when the environment is created
+        if (bBatch) {
+            size_t cache = 0;
+            for (size_t cc = 0; cc < batch.files.size(); cc++) {
+                struct stat st;
+                if (0 == stat(batch.files[cc].c_str(), &st)) {
+                    cache += st.st_size;
+                }
+            }
+            cache = min(max(cache, BATCH_CACHE_MIN), BATCH_CACHE_MAX);
+            env.set_cachesize(cache >> 30, cache & ((1 << 30) - 1), 1);
+        }
         env.set_errpfx("Error");
         env.set_errfile(0);
 
@@ -492,10 +8882,43 @@ main(int argc, char *argv[])
         }
     }
 
+    // A new DB from a dump, parsed by one thread per CPU by default
+    if (!opt_load.empty()) {
+        if (!opt_bJobs) {
+            opt_jobs = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+        }
+        return LoadDb(envp, dbfile, dbname, opt_load, opt_type, opt_keyfmt,
+                      opt_valfmt, opt_jobs);
+    }
+
+    // Requests answered from DBs kept open
+    if (!opt_serve.empty()) {
+        Server server(envp, batch.keyfmt, batch.valfmt);
+        for (size_t cc = 0; cc < batch.files.size(); cc++) {
+            if (!server.Add(batch.files[cc])) {
+                return -1;
+            }
+        }
+        if (!server.Listen(opt_serve)) {
+            return -1;
+        }
+        return server.Run(opt_jobs);
+    }
+
+    // Environment opened, and recovered, once for the whole batch
+    if (bBatch) {
+        batch.envp = envp;
+        return RunBatch(batch, opt_jobs);
+    }
+
     // Open the given DB for read
     Db dbh(envp, DB_CXX_NO_EXCEPTIONS);
-    if (dbh.open(NULL, dbfile.c_str(), dbname.c_str(),
-                 DB_UNKNOWN, DB_RDONLY, 0)) {
+    uint32_t openFlags = DB_RDONLY | ((opt_jobs > 1) ? DB_THREAD : 0);
+    if (opt_live) {
+        openFlags |= DB_AUTO_COMMIT | (opt_snapshot ? DB_MULTIVERSION : 0);
+    }
+    if (dbh.open(NULL, dbfile.c_str(), OpenName(dbfile, dbname),
+                 DB_UNKNOWN, openFlags, 0)) {
         cerr << "Error: Failed to open DB \""
              << dbfile << "\"" << endl;
         return -1;
@@ -509,34 +8932,176 @@ main(int argc, char *argv[])
         return -1;
     }
 
+    if (opt_jobs > 1 && (opt_stats || opt_diff || !opt_joins.empty() ||
+                         opt_live || opt_binary || opt_columnar)) {
+        cerr << "Warning: Ignoring '-j' for --stats, --diff, --join, --live,"
+             << " --binary and --columnar" << endl;
+        opt_jobs = 1;
+    }
+
+    // Key ranges only make sense for the sorted access method
+    if (opt_jobs > 1 && DB_BTREE != type) {
+        cerr << "Warning: Ignoring '-j' for non BTREE DB" << endl;
+        opt_jobs = 1;
+    }
+
+    if (!ranges.empty() && DB_BTREE != type) {
+        cerr << "Error: Key ranges need a BTREE DB" << endl;
+        return -1;
+    }
+
+    // Changes since the previous run, from the log of the environment
+    if (!opt_cdc.empty()) {
+        if (NULL == envp || DB_BTREE != type) {
+            cerr << "Error: --cdc needs a BTREE DB opened with '-e'" << endl;
+            return -1;
+        }
+
+        ResolveFormats(dbh, KeyRange(), opt_keyfmt, opt_valfmt);
+
+        LogTail tail(env, dbh, dbfile);
+        if (!tail.LoadState(opt_cdc)) {
+            cerr << "Warning: No saved position in \"" << opt_cdc
+                 << "\", starting at the end of the log" << endl;
+        }
+
+        OutBuf out(STDOUT_FILENO);
+        int status = tail.Scan();
+        if (0 == status) {
+            status = tail.Print(opt_keyfmt, opt_valfmt, out);
+        }
+        if (!out.Flush() && 0 == status) {
+            cerr << "Error: Failed to write output" << endl;
+            status = -1;
+        }
+
+        // Move on only once the changes are out
+        if (0 == status && !tail.SaveState(opt_cdc)) {
+            cerr << "Error: Failed to save position to \"" << opt_cdc
+                 << "\"" << endl;
+            status = -1;
+        }
+
+        return status;
+    }
+
+    if (opt_diff) {
+        string diffdir, difffilebase, diffname;
+        SplitDbPath(difffile, diffdir, difffilebase, diffname);
+
+        Db diffdbh(envp, DB_CXX_NO_EXCEPTIONS);
+        DBTYPE difftype = DB_UNKNOWN;
+        if (diffdbh.open(NULL, difffile.c_str(),
+                         OpenName(difffile, diffname), DB_UNKNOWN,
+                         DB_RDONLY, 0) ||
+            diffdbh.get_type(&difftype)) {
+            cerr << "Error: Failed to open DB \""
+                 << difffile << "\"" << endl;
+            return -1;
+        }
+
+        if (DB_BTREE != type || DB_BTREE != difftype) {
+            cerr << "Error: --diff needs two BTREE DBs" << endl;
+            return -1;
+        }
+
+        // Either side may be empty
+        KeyRange first = ranges.empty() ? KeyRange() : ranges[0];
+        ResolveFormats(dbh, first, opt_keyfmt, opt_valfmt);
+        ResolveFormats(diffdbh, first, opt_keyfmt, opt_valfmt);
+
+        Filter filter(opt_keyfmt, opt_valfmt);
+        if (!opt_filter.empty() && !filter.Compile(opt_filter)) {
+            return -1;
+        }
+
+        OutBuf out(STDOUT_FILENO);
+        int status = DiffDbs(dbh, diffdbh, ranges, opt_keyfmt, opt_valfmt,
+                             opt_filter.empty() ? NULL : &filter, out);
+        if (!out.Flush() && 0 == status) {
+            cerr << "Error: Failed to write output" << endl;
+            status = -1;
+        }
+
+        return status;
+    }
+
+    if (!opt_joins.empty()) {
+        if (DB_BTREE != type && DB_HASH != type) {
+            cerr << "Error: --join needs a BTREE or HASH DB" << endl;
+            return -1;
+        }
+
+        ResolveFormats(dbh, ranges.empty() ? KeyRange() : ranges[0],
+                       opt_keyfmt, opt_valfmt);
+
+        Filter filter(opt_keyfmt, opt_valfmt);
+        if (!opt_filter.empty() && !filter.Compile(opt_filter)) {
+            return -1;
+        }
+
+        int status = 0;
+        vector<Join *> joins;
+        for (size_t cc = 0; 0 == status && cc < opt_joins.size(); cc++) {
+            joins.push_back(new Join(envp));
+            status = joins.back()->Open(opt_joins[cc]) ? 0 : -1;
+        }
+
+        OutBuf out(STDOUT_FILENO);
+        if (0 == status) {
+            status = JoinDbs(dbh, dbfile, ranges, joins, opt_keyfmt,
+                             opt_valfmt, opt_filter.empty() ? NULL : &filter,
+                             out);
+        }
+        if (!out.Flush() && 0 == status) {
+            cerr << "Error: Failed to write output" << endl;
+            status = -1;
+        }
+
+        for (size_t cc = 0; cc < joins.size(); cc++) {
+            delete joins[cc];
+        }
+
+        return status;
+    }
+
+    // Paced walk in short transactions, for DBs in use by others
+    if (opt_live) {
+        if (DB_BTREE != type) {
+            cerr << "Error: --live and --snapshot need a BTREE DB" << endl;
+            return -1;
+        }
+
+        Throttle throttle(opt_maxrate, opt_maxmbps);
+        OutBuf out(STDOUT_FILENO);
+        int status = DumpLive(env, dbh, ranges, opt_keyfmt, opt_valfmt,
+                              opt_filter, opt_stats, opt_snapshot, throttle,
+                              out);
+        if (!out.Flush() && 0 == status) {
+            cerr << "Error: Failed to write output" << endl;
+            status = -1;
+        }
+
+        return status;
+    }
+
     int status = -1;
+    OutBuf out(STDOUT_FILENO);
+    if (opt_pipeline && !out.Pipeline(opt_compress)) {
+        return -1;
+    }
     try {
-        if (DB_BTREE & type || DB_HASH & type) {
-            // If DB supports duplicate keys, use a multimap
-            if (DB_DUP & flags) {
-                mds_mmap_t data(&dbh, envp);
-                PrintData< mds_mmap_t::value_type_wrap > p(opt_keyfmt,
-                                                           opt_valfmt);
-                for_each(data.begin(
-                            ReadModifyWriteOption::no_read_modify_write(),
-                                    true), data.end(), p);
-            } else {
-                mds_map_t data(&dbh, envp);
-                PrintData< mds_map_t::value_type_wrap > p(opt_keyfmt,
-                                                          opt_valfmt);
-                for_each(data.begin(
-                            ReadModifyWriteOption::no_read_modify_write(),
-                                    true), data.end(), p);
-            }
-
-            status = 0;
-        } else if (DB_RECNO & type || DB_QUEUE & type) {
-            mds_vec_t data(&dbh, envp);
-            PrintData< Dbt > p(opt_valfmt);
-            for_each(data.begin(ReadModifyWriteOption::no_read_modify_write(),
-                                        true), data.end(), p);
-
-            status = 0;
+        if (opt_binary) {
+            status = DumpBinary(dbh, ranges, opt_keyfmt, opt_valfmt,
+                                opt_filter, out);
+        } else if (opt_columnar) {
+            status = DumpColumns(dbh, ranges, opt_keyfmt, opt_valfmt,
+                                 opt_filter, opt_groupRows, out);
+        } else if (DB_BTREE == type || DB_HASH == type) {
+            status = DumpKeyRanges(dbh, opt_jobs, ranges, opt_keyfmt,
+                                   opt_valfmt, opt_filter, opt_stats, out);
+        } else if (DB_RECNO == type || DB_QUEUE == type) {
+            status = DumpValues(dbh, opt_valfmt, opt_filter, opt_stats, out);
         } else {
             cerr << "Error: Unrecognized DB type " << type
                  << endl;
@@ -546,5 +9111,11 @@ main(int argc, char *argv[])
         cerr << "Error: Unhandled exception encountered" << endl;
     }
 
+    // Only explicit flush point of the dump
+    if (!out.Flush() && 0 == status) {
+        cerr << "Error: Failed to write output" << endl;
+        status = -1;
+    }
+
     return status;
-}
\ No newline at end of file
+}
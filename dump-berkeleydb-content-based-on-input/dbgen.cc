@@ -0,0 +1,364 @@
+// -*-c++-*-
+//
+// dbgen: Fill a Berkeley DB with synthetic records laid out like the ones
+// dbdump knows, so that dump throughput can be measured on any machine.
+//
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <strings.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#ifdef _ONTAP_
+#include <bdb/db_cxx.h>
+#else
+#include <db_cxx.h>
+#endif
+
+using namespace std;
+
+// Store the program name without the path information
+static string progname;
+
+//-----------------------------------------------------------------------------
+// usage
+//-----------------------------------------------------------------------------
+static void
+usage(int ret, const char *msg = NULL)
+{
+    if (msg) {
+        cerr << msg << endl;
+    }
+
+    cerr << "Usage: " << progname
+         << " [-t type] [-n count] [-d dups] [-k fmt] [-v fmt]"
+         << " [-p pagesize]" << endl
+         << "       [-s seed] [-h] db_file" << endl;
+    cerr << "\t -t \tAccess method: btree (default), hash, recno or queue"
+         << endl;
+    cerr << "\t -n \tNumber of records, 1000000 by default" << endl;
+    cerr << "\t -d \tValues per key of a BTREE or HASH, more than one"
+         << " makes a DB with" << endl;
+    cerr << "\t    \t sorted duplicates" << endl;
+    cerr << "\t -k \tKey format, as given to dbdump" << endl;
+    cerr << "\t -v \tValue format, as given to dbdump" << endl;
+    cerr << "\t    \tBoth default to the ones dbdump uses for the file name"
+         << endl;
+    cerr << "\t -p \tPage size, the libdb default if not given" << endl;
+    cerr << "\t -s \tSeed of the generated bytes" << endl;
+    cerr << "\t -h \tShow this help" << endl;
+
+    exit(ret);
+}
+
+//-----------------------------------------------------------------------------
+// GetDefaultFormats
+//  Formats of the known DB files
+//  ATTN: KEEP IN SYNC WITH GetDefaultFormats OF dbdump.cc
+//-----------------------------------------------------------------------------
+static void
+GetDefaultFormats(const string &dbfile, string &keyfmt, string &valfmt)
+{
+    static const char *formats[][3] = {
+        { "attrname.db",         "s",       "u32:i32" },
+        { "attrname_attrid.sdb", "u32:i32", "s" },
+        { "oid.db",              "hex",     "u64" },
+        { "oid_oidid.sdb",       "u64",     "hex" },
+        { "oidid.db",            "u64",     "u32:i32" },
+    };
+
+    for (size_t cc = 0; cc < sizeof(formats) / sizeof(formats[0]); cc++) {
+        if (0 == strcasecmp(dbfile.c_str(), formats[cc][0])) {
+            if (keyfmt.empty()) {
+                keyfmt = formats[cc][1];
+            }
+            if (valfmt.empty()) {
+                valfmt = formats[cc][2];
+            }
+            break;
+        }
+    }
+
+    return;
+}
+
+//-----------------------------------------------------------------------------
+// Mix64
+//  Scramble a number, the finalizer of SplitMix64
+//-----------------------------------------------------------------------------
+static uint64_t
+Mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+//-----------------------------------------------------------------------------
+// Record
+//  Builds the bytes of a record from a ':' separated format. Every field is
+//  derived from the record number: numbers count up, strings are numbered
+//  names, hex fields are 16 scrambled bytes, so keys are unique and values
+//  can be checked by a filter. A format made of 'c' fields only has 26
+//  records, after that they repeat.
+//-----------------------------------------------------------------------------
+class Record {
+public:
+    Record(const string &fmt, uint64_t seed);
+
+    // Bytes of record 'id', valid until the next call
+    const string &Build(uint64_t id);
+
+private:
+    vector<string> _fields;
+    uint64_t _seed;
+    string _data;
+};
+
+Record::Record(const string &fmt, uint64_t seed)
+    : _seed(seed)
+{
+    size_t start = 0;
+    while (start <= fmt.size()) {
+        size_t end = fmt.find(':', start);
+        if (string::npos == end) {
+            end = fmt.size();
+        }
+
+        string field = fmt.substr(start, end - start);
+        if (field != "c" && field != "s" && field != "i32" &&
+            field != "u32" && field != "i64" && field != "u64" &&
+            field != "hex") {
+            cerr << "Error: Unknown field type \"" << field << "\"" << endl;
+            exit(-1);
+        }
+        _fields.push_back(field);
+        start = end + 1;
+    }
+}
+
+const string &
+Record::Build(uint64_t id)
+{
+    _data.clear();
+    for (size_t cc = 0; cc < _fields.size(); cc++) {
+        const string &field = _fields[cc];
+        if ("c" == field) {
+            _data += (char)('a' + id % 26);
+        } else if ("s" == field) {
+            char name[32];
+            snprintf(name, sizeof(name), "name%010llu",
+                     (unsigned long long)id);
+            _data.append(name, strlen(name) + 1);
+        } else if ("i32" == field) {
+            int32_t val = -(int32_t)id;
+            _data.append((const char *)&val, sizeof(val));
+        } else if ("u32" == field) {
+            uint32_t val = (uint32_t)id;
+            _data.append((const char *)&val, sizeof(val));
+        } else if ("i64" == field) {
+            int64_t val = -(int64_t)id;
+            _data.append((const char *)&val, sizeof(val));
+        } else if ("u64" == field) {
+            uint64_t val = id;
+            _data.append((const char *)&val, sizeof(val));
+        } else {
+            uint64_t val[2] = { Mix64(id ^ _seed), Mix64(~id ^ _seed) };
+            _data.append((const char *)val, sizeof(val));
+        }
+    }
+
+    return _data;
+}
+
+//-----------------------------------------------------------------------------
+// Now
+//  Wall clock in seconds
+//-----------------------------------------------------------------------------
+static double
+Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//-----------------------------------------------------------------------------
+// main
+//-----------------------------------------------------------------------------
+int
+main(int argc, char *argv[])
+{
+    // Get the program name for future usage
+    progname = basename(argv[0]);
+
+    int opt;
+    string opt_type = "btree";
+    uint64_t opt_count = 1000000;
+    uint64_t opt_dups = 1;
+    uint64_t opt_seed = 1;
+    uint32_t opt_pagesize = 0;
+    string opt_keyfmt;
+    string opt_valfmt;
+
+    do {
+        opt = getopt(argc, argv, "ht:n:d:k:v:p:s:");
+        switch(opt) {
+            case 'h':
+                usage(0);
+                return 0;
+            case 't':
+                opt_type = optarg;
+                break;
+            case 'n':
+                opt_count = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                opt_dups = strtoull(optarg, NULL, 0);
+                if (opt_dups < 1) {
+                    usage(-1, "Error: Invalid number of duplicates");
+                }
+                break;
+            case 'k':
+                opt_keyfmt = optarg;
+                break;
+            case 'v':
+                opt_valfmt = optarg;
+                break;
+            case 'p':
+                opt_pagesize = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                opt_seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                break;
+        }
+    } while(-1 != opt);
+
+    if (argc == optind) {
+        usage(-1, "Error: Missing DB file");
+    }
+    string dbfile = argv[optind];
+
+    DBTYPE type = DB_UNKNOWN;
+    if ("btree" == opt_type) {
+        type = DB_BTREE;
+    } else if ("hash" == opt_type) {
+        type = DB_HASH;
+    } else if ("recno" == opt_type) {
+        type = DB_RECNO;
+    } else if ("queue" == opt_type) {
+        type = DB_QUEUE;
+    } else {
+        usage(-1, "Error: Unknown access method");
+    }
+    bool bRecno = (DB_RECNO == type || DB_QUEUE == type);
+
+    // Same file and table naming as dbdump
+    string dbfilebase = dbfile.substr(dbfile.find_last_of("/") + 1);
+    string dbname = dbfilebase;
+    size_t pos = dbname.find_last_of(".");
+    if (string::npos != pos) {
+        dbname[pos] = '_';
+    }
+
+    GetDefaultFormats(dbfilebase, opt_keyfmt, opt_valfmt);
+    if ((!bRecno && opt_keyfmt.empty()) || opt_valfmt.empty()) {
+        usage(-1, "Error: No default formats for this file, use -k/-v");
+    }
+    if (bRecno && opt_dups > 1) {
+        usage(-1, "Error: Duplicates need a BTREE or HASH");
+    }
+
+    Record key(bRecno ? "u32" : opt_keyfmt, opt_seed);
+    Record val(opt_valfmt, opt_seed + 1);
+
+    Db dbh(NULL, DB_CXX_NO_EXCEPTIONS);
+    dbh.set_cachesize(0, 64 * 1024 * 1024, 1);
+    if (opt_pagesize) {
+        dbh.set_pagesize(opt_pagesize);
+    }
+    if (opt_dups > 1) {
+        dbh.set_flags(DB_DUP | DB_DUPSORT);
+    }
+    if (DB_QUEUE == type) {
+        // Fields are fixed width, all values have the size of the first
+        dbh.set_re_len(val.Build(0).size());
+    }
+
+    // QUEUEs are one per file, without a table name
+    if (dbh.open(NULL, dbfile.c_str(),
+                 (DB_QUEUE == type) ? NULL : dbname.c_str(), type,
+                 DB_CREATE | DB_TRUNCATE, 0644)) {
+        cerr << "Error: Failed to create DB \"" << dbfile << "\"" << endl;
+        return -1;
+    }
+
+    // Formats with few distinct values repeat records. Those already in
+    // the DB are skipped rather than overwritten or failed on, so that the
+    // count is that of the records the DB holds.
+    uint32_t flags = (opt_dups > 1) ? DB_NODUPDATA : DB_NOOVERWRITE;
+
+    double start = Now();
+    size_t bytes = 0;
+    uint64_t written = 0;
+    uint64_t skipped = 0;
+    int ret = 0;
+    for (uint64_t cc = 0; 0 == ret && cc < opt_count; cc++) {
+        const string &v = val.Build(cc);
+        Dbt dval((void *)v.data(), v.size());
+
+        if (bRecno) {
+            db_recno_t recno = 0;
+            Dbt dkey(&recno, sizeof(recno));
+            ret = dbh.put(NULL, &dkey, &dval, DB_APPEND);
+            bytes += v.size();
+        } else {
+            const string &k = key.Build(cc / opt_dups);
+            Dbt dkey((void *)k.data(), k.size());
+            ret = dbh.put(NULL, &dkey, &dval, flags);
+            if (DB_KEYEXIST == ret) {
+                skipped++;
+                ret = 0;
+                continue;
+            }
+            bytes += k.size() + v.size();
+        }
+
+        if (0 == ret) {
+            written++;
+        }
+    }
+
+    if (0 != ret) {
+        cerr << "Error: Failed to write DB \"" << dbfile << "\" with error "
+             << ret << endl;
+    }
+
+    if (0 != dbh.close(0) && 0 == ret) {
+        cerr << "Error: Failed to close DB \"" << dbfile << "\"" << endl;
+        ret = -1;
+    }
+
+    if (0 == ret) {
+        double secs = Now() - start;
+        cerr << "Wrote " << written << " records, " << bytes / 1048576.0
+             << " MB in " << secs << " s" << endl;
+        if (skipped) {
+            cerr << "Skipped " << skipped << " records already written, the"
+                 << " formats repeat them" << endl;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,188 @@
+// -*-c++-*-
+//
+// dbtest: Checks of dbdump on small DBs built for the purpose. dbdump is
+// compiled in, so its internals can be checked as well as its output.
+//
+//      g++ -o dbtest dbtest.cc -ldb_cxx -lpthread && ./dbtest
+//
+
+#define main dbdump_main
+#include "dbdump.cc"
+#undef main
+
+// Checks that failed
+static int failures = 0;
+
+//-----------------------------------------------------------------------------
+// Check
+//  Report a check, count it if it failed
+//-----------------------------------------------------------------------------
+static void
+Check(bool bOk, const string &what)
+{
+    cout << (bOk ? "ok      " : "FAILED  ") << what << endl;
+    if (!bOk) {
+        failures++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// CreateDb
+//  Create 'file' afresh, its table named as dbdump expects
+//-----------------------------------------------------------------------------
+static bool
+CreateDb(Db &dbh, const string &file, DBTYPE type)
+{
+    string dbdir, dbfilebase, dbname;
+    SplitDbPath(file, dbdir, dbfilebase, dbname);
+    unlink(file.c_str());
+
+    if (dbh.open(NULL, file.c_str(), dbname.c_str(), type, DB_CREATE, 0644)) {
+        cerr << "Error: Failed to create DB \"" << file << "\"" << endl;
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Dbdump
+//  Run dbdump with 'args', its output going to 'outfile' if one is given
+//-----------------------------------------------------------------------------
+static int
+Dbdump(const vector<string> &args, const string &outfile = "")
+{
+    vector<char *> argv(1, (char *)"dbdump");
+    for (size_t cc = 0; cc < args.size(); cc++) {
+        argv.push_back((char *)args[cc].c_str());
+    }
+    argv.push_back(NULL);
+
+    int saved = -1;
+    if (!outfile.empty()) {
+        int fd = open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Error: Unable to create \"" << outfile << "\"" << endl;
+            return -1;
+        }
+        saved = dup(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    optind = 1;
+    int ret = dbdump_main(argv.size() - 1, &argv[0]);
+
+    if (saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    return ret;
+}
+
+//-----------------------------------------------------------------------------
+// TestPrefixSplits
+//  -j cuts the keys under a --prefix into several jobs, all under it
+//-----------------------------------------------------------------------------
+static void
+TestPrefixSplits(const string &dir)
+{
+    Db dbh(NULL, DB_CXX_NO_EXCEPTIONS);
+    if (!CreateDb(dbh, dir + "/splits.db", DB_BTREE)) {
+        failures++;
+        return;
+    }
+
+    for (uint32_t cc = 0; cc < 5000; cc++) {
+        char key[32];
+        snprintf(key, sizeof(key), "host%02u.%04u", cc / 1000, cc % 1000);
+        Dbt dkey(key, strlen(key) + 1), dval(&cc, sizeof(cc));
+        dbh.put(NULL, &dkey, &dval, 0);
+    }
+
+    KeyRange range;
+    range.from = range.to = "host01";
+    range.bFrom = range.bTo = range.bToPrefix = true;
+
+    vector<string> splits;
+    GetRangeSplits(dbh, 4, range, splits);
+    Check(splits.size() > 1, "-j 4 --prefix splits the keys under it");
+
+    bool bUnder = true;
+    for (size_t cc = 0; cc < splits.size(); cc++) {
+        bUnder = bUnder && 0 == splits[cc].compare(0, 6, "host01");
+    }
+    Check(bUnder, "-j 4 --prefix splits stay under the prefix");
+
+    dbh.close(0);
+}
+
+//-----------------------------------------------------------------------------
+// TestEmptyLoad
+//  An empty DB dumps to nothing, which loads back as an empty DB
+//-----------------------------------------------------------------------------
+static void
+TestEmptyLoad(const string &dir)
+{
+    Db dbh(NULL, DB_CXX_NO_EXCEPTIONS);
+    if (!CreateDb(dbh, dir + "/oidid.db", DB_BTREE)) {
+        failures++;
+        return;
+    }
+    dbh.close(0);
+
+    vector<string> args(1, dir + "/oidid.db");
+    bool bDumped = (0 == Dbdump(args, dir + "/empty.txt"));
+    Check(bDumped, "an empty DB dumps");
+
+    args.clear();
+    args.push_back("--load");
+    args.push_back(dir + "/empty.txt");
+    args.push_back("-k");
+    args.push_back("u64");
+    args.push_back("-v");
+    args.push_back("u32:i32");
+    args.push_back(dir + "/loaded.db");
+    Check(bDumped && 0 == Dbdump(args), "its dump loads");
+
+    args.clear();
+    args.push_back("-k");
+    args.push_back("u64");
+    args.push_back("-v");
+    args.push_back("u32:i32");
+    args.push_back(dir + "/loaded.db");
+    bool bRedumped = (0 == Dbdump(args, dir + "/reloaded.txt"));
+
+    struct stat st;
+    Check(bRedumped && 0 == stat((dir + "/reloaded.txt").c_str(), &st) &&
+          0 == st.st_size, "the loaded DB is empty");
+}
+
+int
+main(int argc, char *argv[])
+{
+    progname = basename(argv[0]);
+
+    // Scratch DBs go to a folder of their own
+    const char *tmpdir = getenv("TMPDIR");
+    string tmpl = string(tmpdir ? tmpdir : "/tmp") + "/dbtest.XXXXXX";
+    vector<char> path(tmpl.begin(), tmpl.end());
+    path.push_back('\0');
+    if (NULL == mkdtemp(&path[0])) {
+        cerr << "Error: Unable to create a folder in \"" << tmpl << "\""
+             << endl;
+        return -1;
+    }
+    string dir = &path[0];
+
+    TestPrefixSplits(dir);
+    TestEmptyLoad(dir);
+
+    if (failures) {
+        cerr << failures << " checks failed, DBs kept in \"" << dir << "\""
+             << endl;
+        return 1;
+    }
+
+    string cmd = "rm -rf '" + dir + "'";
+    return system(cmd.c_str()) ? 1 : 0;
+}